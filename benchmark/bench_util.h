@@ -0,0 +1,117 @@
+//
+//  bench_util.h
+//
+//  Minimal timing harness shared by the benchmarks.
+//
+
+#ifndef SIO_BENCH_UTIL_H
+#define SIO_BENCH_UTIL_H
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+    typedef std::chrono::steady_clock clock;
+
+    // Keeps the optimizer from discarding a result.
+    template <typename T>
+    inline void keep(T const &value)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        asm volatile("" : : "g"(&value) : "memory");
+#else
+        static volatile char const *sink;
+        sink = reinterpret_cast<char const *>(&value);
+#endif
+    }
+
+    struct options
+    {
+        // Samples per benchmark; the median is reported.
+        unsigned samples = 15;
+        // Target duration of one sample.
+        std::chrono::milliseconds sample_time{20};
+        // Only run benchmarks whose name contains this.
+        std::string filter;
+    };
+
+    inline options parse_options(int argc, char **argv)
+    {
+        options opts;
+        for (int i = 1; i < argc; ++i)
+        {
+            if (std::strcmp(argv[i], "--samples") == 0 && i + 1 < argc)
+            {
+                opts.samples = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+            }
+            else if (std::strcmp(argv[i], "--sample-ms") == 0 && i + 1 < argc)
+            {
+                opts.sample_time = std::chrono::milliseconds(std::max(1, std::atoi(argv[++i])));
+            }
+            else
+            {
+                opts.filter = argv[i];
+            }
+        }
+        return opts;
+    }
+
+    // Runs f(), which processes bytes_per_op bytes, in timed batches and prints
+    // the median and best time per call plus the median throughput.
+    template <typename F>
+    void run(options const &opts, char const *name, size_t bytes_per_op, F &&f)
+    {
+        if (!opts.filter.empty() && std::string(name).find(opts.filter) == std::string::npos)
+        {
+            return;
+        }
+        // Size batches so one takes about sample_time.
+        size_t batch = 1;
+        for (;;)
+        {
+            clock::time_point start = clock::now();
+            for (size_t i = 0; i < batch; ++i)
+            {
+                f();
+            }
+            if (clock::now() - start >= opts.sample_time || batch >= (size_t(1) << 30))
+            {
+                break;
+            }
+            batch *= 2;
+        }
+        std::vector<double> ns_per_op;
+        ns_per_op.reserve(opts.samples);
+        for (unsigned s = 0; s < opts.samples; ++s)
+        {
+            clock::time_point start = clock::now();
+            for (size_t i = 0; i < batch; ++i)
+            {
+                f();
+            }
+            std::chrono::duration<double, std::nano> elapsed = clock::now() - start;
+            ns_per_op.push_back(elapsed.count() / static_cast<double>(batch));
+        }
+        std::sort(ns_per_op.begin(), ns_per_op.end());
+        double median = ns_per_op[ns_per_op.size() / 2];
+        double mb_per_s = bytes_per_op > 0 ? static_cast<double>(bytes_per_op) / median * 1e3 : 0;
+        std::printf("%-36s %12.1f ns/op %12.1f ns best %10.1f MB/s\n", name, median, ns_per_op.front(), mb_per_s);
+    }
+
+    // Value at quantile q (0..1) of sorted samples.
+    inline double quantile(std::vector<double> const &sorted, double q)
+    {
+        if (sorted.empty())
+        {
+            return 0;
+        }
+        size_t index = static_cast<size_t>(q * static_cast<double>(sorted.size() - 1) + 0.5);
+        return sorted[std::min(index, sorted.size() - 1)];
+    }
+}
+#endif // SIO_BENCH_UTIL_H
@@ -0,0 +1,220 @@
+//
+//  codec_bench.cpp
+//
+//  Encode/decode microbenchmarks for the packet codec.
+//  Usage: sio_codec_bench [--samples N] [--sample-ms MS] [name filter]
+//
+
+#include <internal/sio_packet.h>
+#include "bench_util.h"
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace sio;
+
+namespace
+{
+    struct shape
+    {
+        char const *name;
+        message::ptr event;
+    };
+
+    object_message *as_object(message::ptr const &msg)
+    {
+        return static_cast<object_message *>(msg.get());
+    }
+
+    // ["chat",{"user":"alice","text":"...","ts":...}]
+    message::ptr small_event()
+    {
+        message::ptr body = object_message::create();
+        as_object(body)->insert("user", "alice");
+        as_object(body)->insert("text", "hello there, how is it going?");
+        as_object(body)->insert("ts", int_message::create(1700000000123));
+        message::list args(body);
+        return args.to_array_message("chat");
+    }
+
+    // One object with 256 mixed fields.
+    message::ptr wide_object()
+    {
+        message::ptr body = object_message::create();
+        for (int i = 0; i < 256; ++i)
+        {
+            std::string key = "field_" + std::to_string(i);
+            switch (i % 4)
+            {
+            case 0:
+                as_object(body)->insert(key, int_message::create(i * 7919));
+                break;
+            case 1:
+                as_object(body)->insert(key, "value \"" + std::to_string(i) + "\"");
+                break;
+            case 2:
+                as_object(body)->insert(key, double_message::create(i * 0.125));
+                break;
+            default:
+                as_object(body)->insert(key, bool_message::create(i % 8 == 3));
+            }
+        }
+        message::list args(body);
+        return args.to_array_message("state");
+    }
+
+    // 4096 doubles, as in sensor batches.
+    message::ptr double_array()
+    {
+        message::ptr arr = array_message::create();
+        for (int i = 0; i < 4096; ++i)
+        {
+            arr->get_vector().push_back(double_message::create(i * 0.3183098861837907 - 512.25));
+        }
+        message::list args(arr);
+        return args.to_array_message("samples");
+    }
+
+    // Metadata plus four 64 KiB attachments.
+    message::ptr binary_event()
+    {
+        message::list args(string_message::create("frame"));
+        for (int i = 0; i < 4; ++i)
+        {
+            args.push(std::make_shared<const std::string>(64 * 1024, static_cast<char>('a' + i)));
+        }
+        return args.to_array_message("image");
+    }
+
+    struct encoded
+    {
+        std::string text;
+        std::vector<std::shared_ptr<const std::string>> buffers;
+        size_t bytes;
+    };
+
+    encoded encode(message::ptr const &event)
+    {
+        encoded e;
+        packet p("/bench", event);
+        p.accept(e.text, e.buffers);
+        e.bytes = e.text.size();
+        for (auto const &buffer : e.buffers)
+        {
+            e.bytes += buffer->size();
+        }
+        return e;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bench::options opts = bench::parse_options(argc, argv);
+    std::vector<shape> shapes = {
+        {"small", small_event()},
+        {"wide_object", wide_object()},
+        {"double_array", double_array()},
+        {"binary", binary_event()},
+    };
+
+    for (shape const &s : shapes)
+    {
+        encoded e = encode(s.event);
+        std::string name;
+
+        // Message tree to text frame (plus attachment list).
+        // Attachments are shared rather than copied, so throughput counts the text frame only.
+        name = std::string("accept/") + s.name;
+        bench::run(opts, name.c_str(), e.text.size(), [&]() {
+            packet p("/bench", s.event);
+            std::string text;
+            std::vector<std::shared_ptr<const std::string>> buffers;
+            p.accept(text, buffers);
+            bench::keep(text);
+        });
+
+        // Text frame to packet, with the JSON decoded into a tree (from_json) or
+        // kept raw (lazy: only the header is parsed, the tree is never built).
+        // Binary packets stop short at the pending attachments.
+        decode_options tree;
+        decode_options zero_copy;
+        zero_copy.zero_copy = true;
+        decode_options lazy;
+        lazy.lazy = true;
+        std::pair<char const *, decode_options> modes[] = {{"tree", tree}, {"zero_copy", zero_copy}, {"lazy", lazy}};
+        std::shared_ptr<const std::string> frame = std::make_shared<const std::string>(e.text);
+        for (auto const &mode : modes)
+        {
+            name = std::string("parse/") + mode.first + "/" + s.name;
+            bench::run(opts, name.c_str(), e.text.size(), [&]() {
+                packet p;
+                p.parse(frame, mode.second);
+                bench::keep(p);
+            });
+        }
+
+        // Whole inbound path: text frame and attachments through packet_manager.
+        std::vector<std::shared_ptr<const std::string>> frames;
+        frames.push_back(frame);
+        for (auto const &buffer : e.buffers)
+        {
+            std::shared_ptr<std::string> binary = std::make_shared<std::string>(1, static_cast<char>(packet::frame_message));
+            binary->append(*buffer);
+            frames.push_back(binary);
+        }
+        packet_manager manager;
+        size_t decoded = 0;
+        manager.set_decode_callback([&decoded](packet const &p) {
+            decoded += p.get_message() ? 1 : 0;
+        });
+        name = std::string("put_payload/") + s.name;
+        bench::run(opts, name.c_str(), e.bytes, [&]() {
+            for (auto const &f : frames)
+            {
+                manager.put_payload(f);
+            }
+        });
+        bench::keep(decoded);
+
+        // Encode through packet_manager, as client_impl::send does.
+        name = std::string("encode/") + s.name;
+        packet_manager encoder;
+        size_t encoded_bytes = 0;
+        encoder.set_encode_callback([&encoded_bytes](bool, std::shared_ptr<const std::string> const &payload) {
+            encoded_bytes += payload->size();
+        });
+        bench::run(opts, name.c_str(), e.text.size(), [&]() {
+            packet p("/bench", s.event);
+            encoder.encode(p);
+        });
+        bench::keep(encoded_bytes);
+
+        // The same packet as one MessagePack frame (client_options::wire_format::msgpack).
+        packet_manager msgpack;
+        msgpack.set_parser(std::unique_ptr<packet_parser>(new msgpack_packet_parser()));
+        std::shared_ptr<const std::string> msgpack_frame;
+        msgpack.set_encode_callback([&msgpack_frame](bool, std::shared_ptr<const std::string> const &payload) {
+            msgpack_frame = payload;
+        });
+        {
+            packet p("/bench", s.event);
+            msgpack.encode(p);
+        }
+        name = std::string("encode_msgpack/") + s.name;
+        bench::run(opts, name.c_str(), msgpack_frame->size(), [&]() {
+            packet p("/bench", s.event);
+            msgpack.encode(p);
+        });
+        name = std::string("put_payload_msgpack/") + s.name;
+        msgpack.set_decode_callback([&decoded](packet const &p) {
+            decoded += p.get_message() ? 1 : 0;
+        });
+        bench::run(opts, name.c_str(), msgpack_frame->size(), [&]() {
+            msgpack.put_payload(msgpack_frame);
+        });
+        bench::keep(decoded);
+        std::printf("%-36s %12zu bytes json %12zu bytes msgpack\n", s.name, e.bytes, msgpack_frame->size());
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+//
+//  e2e_bench.cpp
+//
+//  Emit/ack throughput and latency against test/echo_server.
+//  Usage: sio_e2e_bench [url] [count] [window] [payload bytes]
+//
+
+#include <sio_client.h>
+#include "bench_util.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace sio;
+
+int main(int argc, char **argv)
+{
+    std::string url = argc > 1 ? argv[1] : "http://127.0.0.1:3000";
+    unsigned count = argc > 2 ? static_cast<unsigned>(std::atoi(argv[2])) : 20000;
+    unsigned window = argc > 3 ? static_cast<unsigned>(std::max(1, std::atoi(argv[3]))) : 64;
+    size_t payload_bytes = argc > 4 ? static_cast<size_t>(std::atoi(argv[4])) : 64;
+
+    client c;
+    c.set_logs_quiet();
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool open = false;
+    c.set_socket_open_listener([&](std::string const &) {
+        std::lock_guard<std::mutex> guard(mutex);
+        open = true;
+        cv.notify_all();
+    });
+    c.connect(url);
+    socket::ptr s = c.socket();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!cv.wait_for(lock, std::chrono::seconds(10), [&]() { return open; }))
+        {
+            std::fprintf(stderr, "could not connect to %s (is test/echo_server running?)\n", url.c_str());
+            return 1;
+        }
+    }
+    message::ptr data = string_message::create(std::string(payload_bytes, 'x'));
+
+    // Acked round trips, at most window in flight.
+    std::vector<double> latency_us(count);
+    unsigned completed = 0;
+    bench::clock::time_point start = bench::clock::now();
+    for (unsigned seq = 0; seq < count; ++seq)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&]() { return seq - completed < window; });
+        }
+        message::list args(int_message::create(seq));
+        args.push(data);
+        bench::clock::time_point sent = bench::clock::now();
+        s->emit_with_ack("bench_ack", args, [&, seq, sent](message::list const &) {
+            std::chrono::duration<double, std::micro> rtt = bench::clock::now() - sent;
+            latency_us[seq] = rtt.count();
+            std::lock_guard<std::mutex> guard(mutex);
+            ++completed;
+            cv.notify_all();
+        });
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!cv.wait_for(lock, std::chrono::seconds(60), [&]() { return completed == count; }))
+        {
+            std::fprintf(stderr, "timed out with %u of %u acks\n", completed, count);
+            return 1;
+        }
+    }
+    std::chrono::duration<double> acked = bench::clock::now() - start;
+    std::sort(latency_us.begin(), latency_us.end());
+    std::printf("emit_with_ack: %u x %zu bytes, window %u: %.0f acks/s\n", count, payload_bytes, window, count / acked.count());
+    std::printf("  rtt us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+                bench::quantile(latency_us, 0.5), bench::quantile(latency_us, 0.9), bench::quantile(latency_us, 0.99),
+                bench::quantile(latency_us, 0.999), latency_us.empty() ? 0.0 : latency_us.back());
+
+    // Fire-and-forget, closed by one ack: it is answered after every emit before it.
+    auto wait_barrier = [&]() {
+        bool barrier = false;
+        s->emit_with_ack("bench_ack", nullptr, [&](message::list const &) {
+            std::lock_guard<std::mutex> guard(mutex);
+            barrier = true;
+            cv.notify_all();
+        });
+        std::unique_lock<std::mutex> lock(mutex);
+        return cv.wait_for(lock, std::chrono::seconds(60), [&]() { return barrier; });
+    };
+    start = bench::clock::now();
+    for (unsigned seq = 0; seq < count; ++seq)
+    {
+        message::list args(int_message::create(seq));
+        args.push(data);
+        s->emit("bench", args);
+    }
+    if (!wait_barrier())
+    {
+        std::fprintf(stderr, "timed out waiting for the emit barrier\n");
+        return 1;
+    }
+    std::chrono::duration<double> fired = bench::clock::now() - start;
+    std::printf("emit: %u x %zu bytes: %.0f events/s, %.1f MB/s\n", count, payload_bytes, count / fired.count(),
+                count * static_cast<double>(payload_bytes) / fired.count() / 1e6);
+
+    // The same events, window at a time through emit_batch.
+    std::vector<batch_event> batch;
+    batch.reserve(window);
+    start = bench::clock::now();
+    for (unsigned seq = 0; seq < count; ++seq)
+    {
+        message::list args(int_message::create(seq));
+        args.push(data);
+        batch.push_back(batch_event{"bench", std::move(args)});
+        if (batch.size() == window || seq + 1 == count)
+        {
+            s->emit_batch(batch);
+            batch.clear();
+        }
+    }
+    if (!wait_barrier())
+    {
+        std::fprintf(stderr, "timed out waiting for the emit_batch barrier\n");
+        return 1;
+    }
+    fired = bench::clock::now() - start;
+    std::printf("emit_batch of %u: %u x %zu bytes: %.0f events/s, %.1f MB/s\n", window, count, payload_bytes, count / fired.count(),
+                count * static_cast<double>(payload_bytes) / fired.count() / 1e6);
+
+    c.sync_close();
+    return 0;
+}
@@ -0,0 +1,121 @@
+//
+//  sio_ack_slab.h
+//
+//  Pending-ack slots indexed by generation-tagged ack ids.
+//
+
+#ifndef SIO_ACK_SLAB_H
+#define SIO_ACK_SLAB_H
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace sio
+{
+    // Each pending ack lives in a slot of one vector, and its id names the slot:
+    // the low index_bits are the slot index, the bits above its generation, bumped
+    // whenever the slot is freed so a late ack for a completed or expired id isn't
+    // taken for the slot's next user. Freed slots are reused first, so once the
+    // vector has grown to the peak number of pending acks, insert and erase
+    // allocate nothing and are O(1). Ids are non-negative ints, unique per slab
+    // until a slot has been reused 2^15 times. Not synchronized.
+    template <typename T>
+    class ack_slab
+    {
+    public:
+        static constexpr unsigned index_bits = 16;
+        static constexpr std::uint32_t max_slots = std::uint32_t(1) << index_bits;
+
+        ack_slab() = default;
+
+        ack_slab(ack_slab const &) = delete;
+        ack_slab &operator=(ack_slab const &) = delete;
+
+        // The id of the new entry, or -1 once max_slots are pending.
+        int insert(T &&value)
+        {
+            std::uint32_t index;
+            if (m_free != none)
+            {
+                index = m_free;
+                m_free = m_slots[index].next_free;
+            }
+            else
+            {
+                if (m_slots.size() >= max_slots)
+                {
+                    return -1;
+                }
+                index = static_cast<std::uint32_t>(m_slots.size());
+                m_slots.emplace_back();
+            }
+            slot &s = m_slots[index];
+            s.value = std::move(value);
+            s.live = true;
+            ++m_size;
+            return static_cast<int>((s.generation << index_bits) | index);
+        }
+
+        // Null unless id is pending; the pointer is valid until the next insert or erase.
+        T *find(int id)
+        {
+            if (id < 0)
+            {
+                return nullptr;
+            }
+            std::uint32_t index = static_cast<std::uint32_t>(id) & (max_slots - 1);
+            if (index >= m_slots.size())
+            {
+                return nullptr;
+            }
+            slot &s = m_slots[index];
+            return s.live && s.generation == static_cast<std::uint32_t>(id) >> index_bits ? &s.value : nullptr;
+        }
+
+        // False if id wasn't pending.
+        bool erase(int id)
+        {
+            if (!find(id))
+            {
+                return false;
+            }
+            std::uint32_t index = static_cast<std::uint32_t>(id) & (max_slots - 1);
+            slot &s = m_slots[index];
+            s.value = T();
+            s.live = false;
+            s.generation = (s.generation + 1) & generation_mask;
+            s.next_free = m_free;
+            m_free = index;
+            --m_size;
+            return true;
+        }
+
+        std::size_t size() const
+        {
+            return m_size;
+        }
+
+        bool empty() const
+        {
+            return m_size == 0;
+        }
+
+    private:
+        static constexpr std::uint32_t generation_mask = (std::uint32_t(1) << (31 - index_bits)) - 1;
+        static constexpr std::uint32_t none = ~std::uint32_t(0);
+
+        struct slot
+        {
+            T value{};
+            std::uint32_t generation = 0;
+            std::uint32_t next_free = none;
+            bool live = false;
+        };
+
+        std::vector<slot> m_slots;
+        std::uint32_t m_free = none;
+        std::size_t m_size = 0;
+    };
+}
+#endif // SIO_ACK_SLAB_H
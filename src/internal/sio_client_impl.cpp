@@ -7,10 +7,13 @@
 //
 
 #include "sio_client_impl.h"
+#include <algorithm>
+#include <cassert>
 #include <functional>
 #include <sstream>
 #include <chrono>
 #include <mutex>
+#include <future>
 #include <cmath>
 #if (DEBUG || _DEBUG) && !defined(SIO_DISABLE_LOGGING)
 #include <iostream>
@@ -27,6 +30,7 @@
 // If using Asio's SSL support, you will also need to add this #include.
 // Source: http://think-async.com/Asio/asio-1.10.6/doc/asio/using.html
 // #include <asio/ssl/impl/src.hpp>
+#include <openssl/ssl.h>
 #endif
 
 using std::chrono::milliseconds;
@@ -38,9 +42,29 @@ namespace sio
     client_impl::client_impl(client_options const &options) : m_ping_interval(0),
                                                               m_ping_timeout(0),
                                                               m_network_thread(),
+                                                              m_run_io_thread(options.run_io_thread || options.io_context == nullptr),
+                                                              m_connecting(false),
+                                                              m_send_queue(options.send_batch_max_bytes, std::chrono::microseconds(options.send_linger_us)),
+                                                              m_send_linger(options.send_linger_us),
+                                                              m_transport_backlog(0),
+                                                              m_send_backlog_max_bytes(options.send_backlog_max_bytes),
+                                                              m_backlog_waiting(false),
+                                                              m_record_timings(options.record_timings),
+                                                              m_frame_handler_time(0),
+#ifndef SIO_DISABLE_TRACING
+                                                              m_tracer(options.tracer),
+#endif
+#if SIO_PERMESSAGE_DEFLATE
+                                                              m_compress(options.permessage_deflate),
+                                                              m_compress_min_bytes(options.compress_min_bytes),
+                                                              m_deflate_negotiated(false),
+#endif
                                                               m_con_state(con_closed),
+                                                              m_worker_ordering(options.worker_ordering),
                                                               m_reconn_delay(5000),
                                                               m_reconn_delay_max(25000),
+                                                              m_reconn_randomization(0.5),
+                                                              m_reconn_rng(std::random_device()()),
                                                               m_reconn_attempts(static_cast<unsigned>(-1)),
                                                               m_reconn_made(0)
     {
@@ -58,6 +82,12 @@ namespace sio
         {
             m_client.init_asio();
         }
+        if (options.dns_refresh_ms > 0)
+        {
+            m_resolver.reset(new host_resolver(m_client.get_io_context(),
+                                               milliseconds(options.dns_refresh_ms),
+                                               milliseconds(options.connect_attempt_delay_ms)));
+        }
 
         // Set up event handlers using modern lambdas
         m_client.set_open_handler([this](auto hdl) { on_open(hdl); });
@@ -66,15 +96,56 @@ namespace sio
         m_client.set_message_handler([this](auto hdl, auto msg) { on_message(hdl, msg); });
 #if SIO_TLS
         m_client.set_tls_init_handler([this](auto hdl) { return on_tls_init(hdl); });
+        m_client.set_socket_init_handler([this](auto, auto &stream) { on_tls_socket_init(stream.native_handle()); });
+#endif
+        decode_options decode_opts;
+        decode_opts.zero_copy = options.zero_copy_decode;
+        decode_opts.lazy = options.lazy_decode;
+        m_packet_mgr.set_decode_options(decode_opts);
+        if (options.parser == client_options::wire_format::msgpack)
+        {
+            m_packet_mgr.set_parser(std::unique_ptr<packet_parser>(new msgpack_packet_parser()));
+        }
+        m_packet_mgr.set_tracer(m_tracer);
+#ifdef SIO_DISABLE_TRACING
+        if (options.tracer)
+        {
+            cerr << "tracer set, but sioclient was built with DISABLE_TRACING" << endl;
+        }
 #endif
         m_packet_mgr.set_decode_callback([this](auto const& p) { on_decode(p); });
         m_packet_mgr.set_encode_callback([this](auto const& p1, auto const& p2) { on_encode(p1, p2); });
+        if (options.event_worker_threads > 0)
+        {
+            m_event_workers.reset(new worker_pool(options.event_worker_threads));
+        }
+#if !SIO_PERMESSAGE_DEFLATE
+        if (options.permessage_deflate)
+        {
+            cerr << "permessage-deflate requested, but sioclient was built without ENABLE_PERMESSAGE_DEFLATE" << endl;
+        }
+#endif
     }
 
     client_impl::~client_impl()
     {
         this->sockets_invoke_void(&sio::socket::on_close);
         sync_close();
+        if (m_event_workers)
+        {
+            // Let handlers still running finish before the rest of the client goes
+            // away, then wait out the packets they handed back to a shared io_context.
+            m_workers_stopping.store(true, std::memory_order_release);
+            m_event_workers->join();
+            asio::io_context &io = get_io_service();
+            if (!m_run_io_thread && !io.get_executor().running_in_this_thread())
+            {
+                std::promise<void> drained;
+                asio::post(io, [&drained]() { drained.set_value(); });
+                drained.get_future().wait();
+            }
+            m_event_workers.reset();
+        }
     }
 
     void client_impl::set_proxy_basic_auth(const std::string &uri, const std::string &username, const std::string &password)
@@ -108,8 +179,14 @@ namespace sio
                 return;
             }
         }
+        else if (!m_run_io_thread && m_con_state.load(std::memory_order_acquire) != con_closed)
+        {
+            // The io_context is run by the owner: already connecting, connected or still closing.
+            return;
+        }
         m_con_state.store(con_opening, std::memory_order_release);
         notify_state_change(client::connection_state::connecting);
+        bool new_host = uri != m_base_url;
         m_base_url = uri;
         m_reconn_made = 0;
 
@@ -134,8 +211,20 @@ namespace sio
 
         this->reset_states();
         m_abort_retries = false;
-        asio::dispatch(m_client.get_io_context(), [this, uri, query_str = m_query_string]() { connect_impl(uri, query_str); });
-        m_network_thread.reset(new thread([this]() { run_loop(); }));
+        asio::dispatch(m_client.get_io_context(), [this, uri, query_str = m_query_string, new_host]() {
+#if SIO_TLS
+            if (new_host)
+            {
+                // A session only resumes with the server that issued it.
+                m_tls_session.reset();
+            }
+#endif
+            connect_impl(uri, query_str);
+        });
+        if (m_run_io_thread)
+        {
+            m_network_thread.reset(new thread([this]() { run_loop(); }));
+        }
     }
 
     socket::ptr const &client_impl::socket(string const &nsp)
@@ -190,6 +279,10 @@ namespace sio
             m_network_thread->join();
             m_network_thread.reset();
         }
+        else if (!m_run_io_thread)
+        {
+            wait_closed();
+        }
     }
 
     void client_impl::set_logs_default()
@@ -212,7 +305,88 @@ namespace sio
     /*************************protected:*************************/
     void client_impl::send(packet &p)
     {
+        if (!m_record_timings)
+        {
+            m_packet_mgr.encode(p);
+            return;
+        }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
         m_packet_mgr.encode(p);
+        m_encode_time.record(std::chrono::steady_clock::now() - start);
+    }
+
+    void client_impl::send(packet &p, std::string const &coalesce_key)
+    {
+        if (coalesce_key.empty())
+        {
+            send(p);
+            return;
+        }
+        std::vector<outbound_frame> frames;
+        encode_frames(p, coalesce_key, frames);
+        enqueue_frames(frames);
+    }
+
+    size_t client_impl::encode_frames(packet &p, std::string const &coalesce_key, std::vector<outbound_frame> &frames)
+    {
+        size_t first = frames.size();
+        size_t bytes = 0;
+        std::chrono::steady_clock::time_point start;
+        if (m_record_timings)
+        {
+            start = std::chrono::steady_clock::now();
+        }
+        m_packet_mgr.encode(p, [&frames, &bytes](bool isBinary, shared_ptr<const string> const &payload) {
+            bytes += payload->size();
+            frames.push_back(outbound_frame{payload, isBinary, std::string()});
+        });
+        if (m_record_timings)
+        {
+            m_encode_time.record(std::chrono::steady_clock::now() - start);
+        }
+        // A binary packet spans several frames and isn't coalesced.
+        if (!coalesce_key.empty() && frames.size() == first + 1)
+        {
+            frames[first].coalesce_key = coalesce_key;
+        }
+        return bytes;
+    }
+
+    void client_impl::enqueue_frames(std::vector<outbound_frame> &frames)
+    {
+        if (frames.empty())
+        {
+            return;
+        }
+        if (m_record_timings)
+        {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            for (outbound_frame &f : frames)
+            {
+                f.enqueued_at = now;
+            }
+        }
+        std::lock_guard<std::mutex> guard(m_send_mutex);
+        for (outbound_frame &f : frames)
+        {
+            m_send_queue.push(std::move(f));
+        }
+        frames.clear();
+        kick_send_locked();
+    }
+
+    bool client_impl::is_writable()
+    {
+        if (m_con_state.load(std::memory_order_acquire) != con_opened)
+        {
+            return false;
+        }
+        if (m_send_backlog_max_bytes == 0)
+        {
+            return true;
+        }
+        std::lock_guard<std::mutex> guard(m_send_mutex);
+        return m_transport_backlog + m_send_queue.bytes() < m_send_backlog_max_bytes;
     }
 
     void client_impl::remove_socket(string const &nsp)
@@ -291,41 +465,73 @@ namespace sio
     }
 
     void client_impl::connect_impl(const string &uri, const string &queryString)
+    {
+        websocketpp::uri uo(uri);
+        asio::error_code ec;
+        asio::ip::make_address(uo.get_host(), ec);
+        bool is_address = !ec;
+        // Through a proxy, the proxy resolves the host.
+        if (!m_resolver || is_address || !m_proxy_base_url.empty())
+        {
+            connect_to(uri, queryString, nullptr);
+            return;
+        }
+        m_connecting = true;
+        m_resolver->resolve(uo.get_host(), std::to_string(uo.get_port()), [this, uri, queryString](asio::error_code const &ec, host_resolver::endpoint const &address) {
+            bool closing = m_con_state.load(std::memory_order_acquire) == con_closing;
+            if (ec == asio::error::operation_aborted && !closing)
+            {
+                // Dropped for a lookup of another host, or with the resolver:
+                // this attempt stops, and m_connecting is no longer its own.
+                LOG("Lookup aborted." << endl);
+                return;
+            }
+            m_connecting = false;
+            if (closing)
+            {
+                LOG("Resolved while closing." << endl);
+                this->close();
+                return;
+            }
+            // Unresolvable or unreachable: the transport tries again and reports the failure.
+            connect_to(uri, queryString, ec ? nullptr : &address);
+        });
+    }
+
+    void client_impl::connect_to(const string &uri, const string &queryString, asio::ip::tcp::endpoint const *address)
     {
         do
         {
             websocketpp::uri uo(uri);
-            ostringstream ss;
 #if SIO_TLS
             // TLS build (Release): HTTPS/WSS only
-            ss << "wss://";
+            string url("wss://");
 #else
             // Non-TLS build (Debug): HTTP/WS only
-            ss << "ws://";
+            string url("ws://");
 #endif
-            const std::string host(uo.get_host());
+            const std::string host(address ? address->address().to_string() : uo.get_host());
+            // If a resource path was included in the URI, use that, otherwise
+            // use the default /socket.io/.
+            const std::string path(uo.get_resource() == "/" ? "/socket.io/" : uo.get_resource());
+            url.reserve(url.size() + host.size() + path.size() + m_sid.size() + queryString.size() + 64);
             // As per RFC2732, literal IPv6 address should be enclosed in "[" and "]".
             if (host.find(':') != std::string::npos)
             {
-                ss << "[" << uo.get_host() << "]";
+                url.append("[").append(host).append("]");
             }
             else
             {
-                ss << uo.get_host();
+                url.append(host);
             }
-
-            // If a resource path was included in the URI, use that, otherwise
-            // use the default /socket.io/.
-            const std::string path(uo.get_resource() == "/" ? "/socket.io/" : uo.get_resource());
-
-            ss << ":" << uo.get_port() << path << "?EIO=4&transport=websocket";
+            url.append(":").append(std::to_string(uo.get_port())).append(path).append("?EIO=4&transport=websocket");
             if (m_sid.size() > 0)
             {
-                ss << "&sid=" << m_sid;
+                url.append("&sid=").append(m_sid);
             }
-            ss << "&t=" << time(NULL) << queryString;
+            url.append("&t=").append(std::to_string(time(NULL))).append(queryString);
             lib::error_code ec;
-            client_type::connection_ptr con = m_client.get_connection(ss.str(), ec);
+            client_type::connection_ptr con = m_client.get_connection(url, ec);
             if (ec)
             {
                 m_client.get_alog().write(websocketpp::log::alevel::app,
@@ -333,6 +539,14 @@ namespace sio
                 break;
             }
 
+            m_connect_host.clear();
+            if (address)
+            {
+                // Connected by address: name the host for virtual hosting and SNI.
+                con->replace_header("Host", uo.get_host_port());
+                m_connect_host = uo.get_host();
+            }
+
             for (auto &&header : m_http_headers)
             {
                 con->replace_header(header.first, header.second);
@@ -360,6 +574,7 @@ namespace sio
             }
 
             m_client.connect(con);
+            m_connecting = true;
             return;
         } while (0);
         client::fail_listener listener;
@@ -383,6 +598,23 @@ namespace sio
         }
         if (m_con.expired())
         {
+            if (m_connecting)
+            {
+                if (m_resolver)
+                {
+                    // A lookup in flight reports operation_aborted before this
+                    // returns, and its callback finishes the close.
+                    m_resolver->cancel();
+                }
+                // on_open or on_fail sees the closing state and finishes the close.
+                return;
+            }
+            if (!m_run_io_thread && m_con_state.load(std::memory_order_acquire) == con_closing)
+            {
+                // Nothing to close: let sync_close() return.
+                mark_closed();
+                return;
+            }
             cerr << "Error: No active session" << endl;
         }
         else
@@ -396,12 +628,35 @@ namespace sio
     {
         if (m_con_state.load(std::memory_order_acquire) == con_opened)
         {
+            SIO_TRACE_SCOPE(m_tracer, trace_point::write, std::string_view(), std::string_view(), -1, payload_ptr->size());
             lib::error_code ec;
-            m_client.send(m_con, *payload_ptr, opcode, ec);
+#if SIO_PERMESSAGE_DEFLATE
+            if (m_deflate_negotiated)
+            {
+                client_type::connection_ptr con = m_client.get_con_from_hdl(m_con, ec);
+                if (!ec)
+                {
+                    // The one copy endpoint::send makes as well, into a message
+                    // that says whether to deflate it: small frames cost more to
+                    // deflate than they save.
+                    client_type::message_ptr msg = con->get_message(opcode, payload_ptr->size());
+                    msg->append_payload(*payload_ptr);
+                    msg->set_compressed(m_compress && payload_ptr->size() >= m_compress_min_bytes);
+                    ec = con->send(msg);
+                }
+            }
+            else
+#endif
+            {
+                m_client.send(m_con, *payload_ptr, opcode, ec);
+            }
             if (ec)
             {
                 cerr << "Send failed,reason:" << ec.message() << endl;
+                return;
             }
+            m_frames_sent.fetch_add(1, std::memory_order_relaxed);
+            m_bytes_sent.fetch_add(payload_ptr->size(), std::memory_order_relaxed);
         }
     }
 
@@ -442,9 +697,9 @@ namespace sio
         }
     }
 
-    unsigned client_impl::next_delay() const
+    unsigned client_impl::next_delay()
     {
-        // Exponential backoff with jitter-free saturation to m_reconn_delay_max
+        // Exponential backoff saturating at m_reconn_delay_max, then jittered
         unsigned delay = m_reconn_delay;
         unsigned attempts = m_reconn_made;
         while (attempts-- > 0 && delay < m_reconn_delay_max)
@@ -456,6 +711,13 @@ namespace sio
             }
             delay *= 2;
         }
+        if (m_reconn_randomization > 0)
+        {
+            // Uniform in delay * (1 +- randomization), so clients dropped together spread out.
+            double spread = m_reconn_randomization * delay;
+            std::uniform_real_distribution<double> jitter(delay - spread, delay + spread);
+            delay = static_cast<unsigned>(std::min(jitter(m_reconn_rng), static_cast<double>(m_reconn_delay_max)));
+        }
         LOG("next_delay: attempt=" << m_reconn_made
                                    << ", base_delay=" << m_reconn_delay
                                    << ", max_delay=" << m_reconn_delay_max
@@ -494,6 +756,7 @@ namespace sio
 
     void client_impl::on_fail(connection_hdl)
     {
+        m_connecting = false;
         if (m_con_state.load(std::memory_order_acquire) == con_closing)
         {
             LOG("Connection failed while closing." << endl);
@@ -502,7 +765,13 @@ namespace sio
         }
 
         m_con.reset();
-        m_con_state.store(con_closed, std::memory_order_release);
+        if (m_resolver)
+        {
+            // The address may have moved: look the host up again on the next attempt.
+            m_resolver->forget();
+        }
+        mark_closed();
+        fail_writable_waiters();
         notify_state_change(client::connection_state::disconnected);
         this->sockets_invoke_void(&sio::socket::on_disconnect);
         LOG("Connection failed." << endl);
@@ -535,6 +804,7 @@ namespace sio
 
     void client_impl::on_open(connection_hdl con)
     {
+        m_connecting = false;
         if (m_con_state.load(std::memory_order_acquire) == con_closing)
         {
             LOG("Connection opened while closing." << endl);
@@ -543,6 +813,14 @@ namespace sio
         }
 
         LOG("Connected." << endl);
+#if SIO_PERMESSAGE_DEFLATE
+        {
+            // Offered on every handshake; in use only if the server's response names it.
+            lib::error_code ec;
+            client_type::connection_ptr conn = m_client.get_con_from_hdl(con, ec);
+            m_deflate_negotiated = !ec && conn->get_response_header("Sec-WebSocket-Extensions").find("permessage-deflate") != std::string::npos;
+        }
+#endif
         m_con_state.store(con_opened, std::memory_order_release);
         notify_state_change(client::connection_state::connected);
         m_con = con;
@@ -563,7 +841,7 @@ namespace sio
     {
         LOG("Client Disconnected." << endl);
         con_state m_con_state_was = m_con_state.load(std::memory_order_acquire);
-        m_con_state.store(con_closed, std::memory_order_release);
+        mark_closed();
         notify_state_change(client::connection_state::disconnected);
         lib::error_code ec;
         close::status::value code = close::status::normal;
@@ -579,6 +857,7 @@ namespace sio
 
         m_con.reset();
         this->clear_timers();
+        fail_writable_waiters();
         client::disconnect_reason reason;
 
         // Check if a specific disconnect reason was set (e.g., ping_timeout)
@@ -646,8 +925,22 @@ namespace sio
 
     void client_impl::on_message(connection_hdl, client_type::message_ptr msg)
     {
-        // Parse the incoming message according to socket.IO rules
-        m_packet_mgr.put_payload(msg->get_payload());
+        // Parse the incoming message according to socket.IO rules.
+        // The aliasing pointer shares ownership of the websocket message, so the
+        // payload is never copied out of it.
+        SIO_TRACE_SCOPE(m_tracer, trace_point::receive, std::string_view(), std::string_view(), -1, msg->get_payload().size());
+        m_frames_received.fetch_add(1, std::memory_order_relaxed);
+        m_bytes_received.fetch_add(msg->get_payload().size(), std::memory_order_relaxed);
+        if (!m_record_timings)
+        {
+            m_packet_mgr.put_payload(shared_ptr<const string>(msg, &msg->get_payload()));
+            return;
+        }
+        // Handlers run inside put_payload; on_decode adds their time to m_frame_handler_time.
+        m_frame_handler_time = std::chrono::nanoseconds(0);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        m_packet_mgr.put_payload(shared_ptr<const string>(msg, &msg->get_payload()));
+        m_decode_time.record(std::chrono::steady_clock::now() - start - m_frame_handler_time);
     }
 
     void client_impl::on_handshake(message::ptr const &message)
@@ -655,30 +948,29 @@ namespace sio
         if (message && message->get_flag() == message::flag_object)
         {
             const object_message *obj_ptr = static_cast<object_message *>(message.get());
-            const map<string, message::ptr> *values = &(obj_ptr->get_map());
-            auto it = values->find("sid");
-            if (it != values->end())
+            message::ptr value = obj_ptr->at("sid");
+            if (value)
             {
-                m_sid = static_pointer_cast<string_message>(it->second)->get_string();
+                m_sid = static_pointer_cast<string_message>(value)->get_string();
             }
             else
             {
                 goto failed;
             }
-            it = values->find("pingInterval");
-            if (it != values->end() && it->second->get_flag() == message::flag_integer)
+            value = obj_ptr->at("pingInterval");
+            if (value && value->get_flag() == message::flag_integer)
             {
-                m_ping_interval = (unsigned)static_pointer_cast<int_message>(it->second)->get_int();
+                m_ping_interval = (unsigned)static_pointer_cast<int_message>(value)->get_int();
             }
             else
             {
                 m_ping_interval = 25000;
             }
-            it = values->find("pingTimeout");
+            value = obj_ptr->at("pingTimeout");
 
-            if (it != values->end() && it->second->get_flag() == message::flag_integer)
+            if (value && value->get_flag() == message::flag_integer)
             {
-                m_ping_timeout = (unsigned)static_pointer_cast<int_message>(it->second)->get_int();
+                m_ping_timeout = (unsigned)static_pointer_cast<int_message>(value)->get_int();
             }
             else
             {
@@ -735,17 +1027,36 @@ namespace sio
                 if (message && message->get_flag() == message::flag_object)
                 {
                     const object_message *obj_ptr = static_cast<object_message *>(message.get());
-                    const std::map<std::string, message::ptr> *values = &(obj_ptr->get_map());
-                    auto it = values->find("sid");
-                    if (it != values->end())
+                    message::ptr const &sid = obj_ptr->at("sid");
+                    if (sid)
                     {
-                        m_sid = std::static_pointer_cast<string_message>(it->second)->get_string();
+                        m_sid = std::static_pointer_cast<string_message>(sid)->get_string();
                     }
                 }
             }
             socket::ptr so_ptr = get_socket_locked(p.get_nsp());
-            if (so_ptr)
+            if (!so_ptr)
+                break;
+            std::chrono::steady_clock::time_point start;
+            if (m_record_timings)
+            {
+                start = std::chrono::steady_clock::now();
+            }
+            if (m_event_workers)
+            {
+                dispatch_to_workers(so_ptr, p);
+            }
+            else
+            {
+                so_ptr->take_offset(p);
                 so_ptr->on_message_packet(p);
+            }
+            if (m_record_timings)
+            {
+                std::chrono::nanoseconds handled = std::chrono::steady_clock::now() - start;
+                m_handler_time.record(handled);
+                m_frame_handler_time += handled;
+            }
             break;
         }
         case packet::frame_open:
@@ -764,11 +1075,332 @@ namespace sio
         }
     }
 
+    void client_impl::dispatch_to_workers(socket::ptr const &so_ptr, packet const &p)
+    {
+        auto held = m_held_packets.find(p.get_nsp());
+        if (held != m_held_packets.end())
+        {
+            held->second.push_back(p);
+            return;
+        }
+        // Handlers captured by one strand run in order; the socket stays alive until they ran.
+        size_t key = std::hash<std::string>()(p.get_nsp());
+        if (p.get_type() == packet::type_connect || p.get_type() == packet::type_disconnect ||
+            p.get_type() == packet::type_error)
+        {
+            // These change the socket's state, which only the io thread does:
+            // once the handlers queued before it ran, the packet comes back here.
+            // Until then the namespace's packets wait, so none overtakes it.
+            m_held_packets[p.get_nsp()];
+            std::shared_ptr<const packet> pack = std::make_shared<packet>(p);
+            std::function<void()> back = [this, so_ptr, pack]() {
+                if (m_workers_stopping.load(std::memory_order_acquire))
+                {
+                    return;
+                }
+                asio::post(get_io_service(), [this, so_ptr, pack]() {
+                    if (m_workers_stopping.load(std::memory_order_acquire))
+                    {
+                        return;
+                    }
+                    so_ptr->on_message_packet(*pack);
+                    release_held_packets(pack->get_nsp());
+                });
+            };
+            if (m_worker_ordering == client_options::handler_ordering::per_event)
+            {
+                m_event_workers->post_after_all(std::move(back));
+            }
+            else
+            {
+                m_event_workers->post(key, std::move(back));
+            }
+            return;
+        }
+        if (m_worker_ordering == client_options::handler_ordering::per_event &&
+            (p.get_type() == packet::type_event || p.get_type() == packet::type_binary_event))
+        {
+            std::string name;
+            if (!p.get_raw_json().empty())
+            {
+                p.get_event_name(name);
+            }
+            else
+            {
+                message::ptr const &msg = p.get_message();
+                if (msg && msg->get_flag() == message::flag_array && !msg->get_vector().empty() &&
+                    msg->get_vector()[0]->get_flag() == message::flag_string)
+                {
+                    name = msg->get_vector()[0]->get_string();
+                }
+            }
+            key = key * 31 + std::hash<std::string>()(name);
+        }
+        // After any hold, so a connect that resets the offset can't come after it.
+        so_ptr->take_offset(p);
+        std::shared_ptr<const packet> pack = std::make_shared<packet>(p);
+        m_event_workers->post(key, [so_ptr, pack]() { so_ptr->on_message_packet(*pack); });
+    }
+
+    void client_impl::release_held_packets(std::string const &nsp)
+    {
+        auto held = m_held_packets.find(nsp);
+        if (held == m_held_packets.end())
+        {
+            return;
+        }
+        std::deque<packet> packets;
+        packets.swap(held->second);
+        m_held_packets.erase(held);
+        for (packet const &p : packets)
+        {
+            // A packet after another connect, disconnect or error is held again,
+            // and the rest with it.
+            if (socket::ptr so_ptr = get_socket_locked(nsp))
+            {
+                dispatch_to_workers(so_ptr, p);
+            }
+        }
+    }
+
     void client_impl::on_encode(bool isBinary, shared_ptr<const string> const &payload)
     {
         LOG("encoded payload length:" << payload->length() << endl);
-        auto opcode = isBinary ? frame::opcode::binary : frame::opcode::text;
-        asio::dispatch(m_client.get_io_context(), [this, payload, opcode]() { send_impl(payload, opcode); });
+        enqueue_frame(outbound_frame{payload, isBinary, std::string()});
+    }
+
+    void client_impl::enqueue_frame(outbound_frame &&f)
+    {
+        if (m_record_timings)
+        {
+            f.enqueued_at = std::chrono::steady_clock::now();
+        }
+        std::lock_guard<std::mutex> guard(m_send_mutex);
+        m_send_queue.push(std::move(f));
+        kick_send_locked();
+    }
+
+    void client_impl::kick_send_locked()
+    {
+        switch (m_send_queue.schedule())
+        {
+        case send_queue::kick::none:
+            break;
+        case send_queue::kick::linger:
+            if (!m_send_timer)
+            {
+                m_send_timer.reset(new asio::steady_timer(get_io_service()));
+            }
+            m_send_timer->expires_after(m_send_linger);
+            m_send_timer->async_wait([this](asio::error_code const &ec) {
+                if (!ec)
+                {
+                    flush_send_queue();
+                }
+            });
+            break;
+        case send_queue::kick::flush_now:
+            // Batch is full, stop waiting for more.
+            m_send_timer->cancel();
+            asio::post(get_io_service(), [this]() { flush_send_queue(); });
+            break;
+        case send_queue::kick::flush:
+            asio::post(get_io_service(), [this]() { flush_send_queue(); });
+            break;
+        }
+    }
+
+    void client_impl::flush_send_queue()
+    {
+        // Runs on the io thread. Sending all queued frames from one handler lets
+        // websocketpp pick them up in a single gathered write.
+        if (transport_backlogged())
+        {
+            // The flush stays scheduled; the backlog timer runs it once the transport drains.
+            return;
+        }
+        std::deque<outbound_frame> batch;
+        {
+            std::lock_guard<std::mutex> guard(m_send_mutex);
+            if (m_send_queue.take_batch(batch))
+            {
+                // Let other handlers run before the next batch.
+                asio::post(get_io_service(), [this]() { flush_send_queue(); });
+            }
+        }
+        if (m_record_timings && !batch.empty())
+        {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            for (outbound_frame const &f : batch)
+            {
+                m_send_queue_wait.record(now - f.enqueued_at);
+            }
+        }
+        for (outbound_frame const &f : batch)
+        {
+            send_impl(f.payload, f.binary ? frame::opcode::binary : frame::opcode::text);
+        }
+        transport_backlogged();
+    }
+
+    transport_metrics client_impl::get_transport_metrics()
+    {
+        transport_metrics metrics;
+        metrics.frames_sent = m_frames_sent.load(std::memory_order_relaxed);
+        metrics.frames_received = m_frames_received.load(std::memory_order_relaxed);
+        metrics.bytes_sent = m_bytes_sent.load(std::memory_order_relaxed);
+        metrics.bytes_received = m_bytes_received.load(std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> guard(m_send_mutex);
+            metrics.send_queue_frames = m_send_queue.size();
+            metrics.send_queue_bytes = m_send_queue.bytes();
+            metrics.send_queue_peak_frames = m_send_queue.peak();
+        }
+        metrics.encode_time = m_encode_time.snapshot();
+        metrics.decode_time = m_decode_time.snapshot();
+        metrics.send_queue_wait = m_send_queue_wait.snapshot();
+        metrics.handler_time = m_handler_time.snapshot();
+        return metrics;
+    }
+
+    uint64_t client_impl::bytes_queued()
+    {
+        std::lock_guard<std::mutex> guard(m_send_mutex);
+        return m_send_queue.pushed();
+    }
+
+    uint64_t client_impl::bytes_written()
+    {
+        size_t buffered = 0;
+        lib::error_code ec;
+        client_type::connection_ptr con = m_client.get_con_from_hdl(m_con, ec);
+        if (!ec)
+        {
+            buffered = con->get_buffered_amount();
+        }
+        std::lock_guard<std::mutex> guard(m_send_mutex);
+        m_transport_backlog = buffered;
+        // Buffered bytes include frame headers, so this can only come out low.
+        uint64_t unwritten = m_send_queue.bytes() + buffered;
+        return m_send_queue.pushed() > unwritten ? m_send_queue.pushed() - unwritten : 0;
+    }
+
+    bool client_impl::transport_backlogged()
+    {
+        // Runs on the io thread. Refreshes the backlog seen by is_writable(), and
+        // while it's over the limit polls until the transport has drained.
+        if (m_send_backlog_max_bytes == 0)
+        {
+            return false;
+        }
+        size_t buffered = 0;
+        lib::error_code ec;
+        client_type::connection_ptr con = m_client.get_con_from_hdl(m_con, ec);
+        if (!ec)
+        {
+            buffered = con->get_buffered_amount();
+        }
+        {
+            std::lock_guard<std::mutex> guard(m_send_mutex);
+            m_transport_backlog = buffered;
+        }
+        if (buffered < m_send_backlog_max_bytes)
+        {
+            return false;
+        }
+        arm_backlog_timer();
+        return true;
+    }
+
+    void client_impl::arm_backlog_timer()
+    {
+        if (m_backlog_waiting)
+        {
+            return;
+        }
+        if (!m_backlog_timer)
+        {
+            m_backlog_timer.reset(new asio::steady_timer(get_io_service()));
+        }
+        m_backlog_waiting = true;
+        // websocketpp doesn't report write completion, so poll, but only while
+        // a flush or a when_writable() waits for it.
+        m_backlog_timer->expires_after(milliseconds(5));
+        m_backlog_timer->async_wait([this](asio::error_code const &ec) {
+            m_backlog_waiting = false;
+            if (!ec)
+            {
+                on_backlog_timer();
+            }
+        });
+    }
+
+    void client_impl::on_backlog_timer()
+    {
+        if (!transport_backlogged())
+        {
+            bool pending;
+            {
+                std::lock_guard<std::mutex> guard(m_send_mutex);
+                pending = m_send_queue.flush_pending();
+            }
+            if (pending)
+            {
+                flush_send_queue();
+            }
+        }
+        if (m_writable_waiters.empty())
+        {
+            return;
+        }
+        if (m_con_state.load(std::memory_order_acquire) != con_opened)
+        {
+            fail_writable_waiters();
+        }
+        else if (is_writable())
+        {
+            uint64_t written = bytes_written();
+            std::vector<writable_waiter> ready;
+            std::vector<writable_waiter> waiting;
+            for (writable_waiter &waiter : m_writable_waiters)
+            {
+                (waiter.written <= written ? ready : waiting).push_back(std::move(waiter));
+            }
+            m_writable_waiters.swap(waiting);
+            for (writable_waiter &waiter : ready)
+            {
+                waiter.f(true);
+            }
+            if (!m_writable_waiters.empty())
+            {
+                arm_backlog_timer();
+            }
+        }
+        else
+        {
+            arm_backlog_timer();
+        }
+    }
+
+    void client_impl::when_writable(std::function<void(bool)> &&f, uint64_t written)
+    {
+        if (m_con_state.load(std::memory_order_acquire) != con_opened)
+        {
+            f(false);
+            return;
+        }
+        m_writable_waiters.push_back(writable_waiter{written, std::move(f)});
+        arm_backlog_timer();
+    }
+
+    void client_impl::fail_writable_waiters()
+    {
+        std::vector<writable_waiter> waiters;
+        waiters.swap(m_writable_waiters);
+        for (writable_waiter &waiter : waiters)
+        {
+            waiter.f(false);
+        }
     }
 
     void client_impl::clear_timers()
@@ -794,15 +1426,102 @@ namespace sio
         m_ping_timeout_timer->async_wait([this](auto const& ec) { timeout_ping(ec); });
     }
 
+    void client_impl::mark_closed()
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_closed_mutex);
+            m_con_state.store(con_closed, std::memory_order_release);
+        }
+        m_closed_cv.notify_all();
+    }
+
+    void client_impl::wait_closed()
+    {
+        asio::io_context &io = m_client.get_io_context();
+        bool on_io_thread = io.get_executor().running_in_this_thread();
+        // Waiting here would keep the io thread from ever closing the connection.
+        assert(!on_io_thread && "sync_close() or ~client() called from a handler of a client with run_io_thread = false");
+        if (on_io_thread)
+        {
+            cerr << "Error: sync_close called on the io thread, not waiting for the close" << endl;
+            return;
+        }
+        {
+            std::unique_lock<std::mutex> lock(m_closed_mutex);
+            m_closed_cv.wait(lock, [this]() { return m_con_state.load(std::memory_order_acquire) == con_closed; });
+        }
+        // Stop the send timers, then wait behind every handler already queued for
+        // this client (cancelled timers complete as queued handlers too).
+        std::promise<void> drained;
+        asio::post(io, [this, &io, &drained]() {
+            if (m_send_timer)
+            {
+                m_send_timer->cancel();
+            }
+            if (m_backlog_timer)
+            {
+                m_backlog_timer->cancel();
+            }
+            asio::post(io, [&drained]() { drained.set_value(); });
+        });
+        drained.get_future().wait();
+    }
+
     void client_impl::reset_states()
     {
-        m_client.reset();
+        // A shared io_context is still running for other clients: leave it alone.
+        if (m_run_io_thread)
+        {
+            m_client.reset();
+        }
         m_sid.clear();
         m_packet_mgr.reset();
     }
 
 #if SIO_TLS
-    client_impl::context_ptr client_impl::on_tls_init(connection_hdl conn)
+    // Slot in each SSL holding its client_impl, for on_tls_new_session.
+    static int tls_client_index()
+    {
+        static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+        return index;
+    }
+
+    client_impl::context_ptr client_impl::on_tls_init(connection_hdl)
+    {
+        if (!m_tls_context)
+        {
+            m_tls_context = make_tls_context();
+        }
+        return m_tls_context;
+    }
+
+    void client_impl::on_tls_socket_init(SSL *ssl)
+    {
+        SSL_set_ex_data(ssl, tls_client_index(), this);
+        if (!m_connect_host.empty())
+        {
+            // The transport only sends SNI for a host name, and it was handed an address.
+            SSL_set_tlsext_host_name(ssl, m_connect_host.c_str());
+        }
+        if (m_tls_session)
+        {
+            SSL_set_session(ssl, m_tls_session.get());
+        }
+    }
+
+    int client_impl::on_tls_new_session(SSL *ssl, SSL_SESSION *session)
+    {
+        client_impl *self = static_cast<client_impl *>(SSL_get_ex_data(ssl, tls_client_index()));
+        if (!self)
+        {
+            return 0;
+        }
+        // Returning 1 keeps the reference OpenSSL passed in.
+        self->m_tls_session.reset(session, SSL_SESSION_free);
+        return 1;
+    }
+
+    client_impl::context_ptr client_impl::make_tls_context()
     {
         context_ptr ctx = context_ptr(new asio::ssl::context(asio::ssl::context::tls));
         asio::error_code ec;
@@ -815,6 +1534,11 @@ namespace sio
         {
             cerr << "Init tls failed,reason:" << ec.message() << endl;
         }
+        // Sessions (TLS 1.2 ids and TLS 1.3 tickets) are handed to each client
+        // through the new-session callback rather than kept in the context, so a
+        // context shared by a hub resumes every connection with its own session.
+        SSL_CTX_set_session_cache_mode(ctx->native_handle(), SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx->native_handle(), &client_impl::on_tls_new_session);
 
         return ctx;
     }
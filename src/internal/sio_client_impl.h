@@ -34,22 +34,51 @@ typedef websocketpp::config::asio_client client_config;
 #include <asio/ssl/context.hpp>
 #endif
 
+#if SIO_PERMESSAGE_DEFLATE
+#include <websocketpp/extensions/permessage_deflate/enabled.hpp>
+// client_config with the permessage-deflate extension (RFC 7692): every
+// handshake offers it, and frames are inflated and deflated once negotiated.
+struct deflate_client_config : public client_config
+{
+    typedef deflate_client_config type;
+
+    struct permessage_deflate_config
+    {
+    };
+
+    typedef websocketpp::extensions::permessage_deflate::enabled<permessage_deflate_config> permessage_deflate_type;
+};
+#endif
+
 #include <asio/steady_timer.hpp>
 #include <asio/error_code.hpp>
 #include <asio/io_context.hpp>
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <memory>
 #include <map>
+#include <random>
 #include <thread>
 #include "../sio_client.h"
 #include "sio_packet.h"
+#include "sio_histogram.h"
+#include "sio_host_resolver.h"
+#include "sio_send_queue.h"
+#include "sio_trace_scope.h"
+#include "sio_worker_pool.h"
 
 namespace sio
 {
     using namespace websocketpp;
     
+#if SIO_PERMESSAGE_DEFLATE
+    typedef websocketpp::client<deflate_client_config> client_type;
+#else
     typedef websocketpp::client<client_config> client_type;
+#endif
     
     class client_impl {
         
@@ -133,6 +162,8 @@ namespace sio
 
         void set_reconnect_delay_max(unsigned millis) {m_reconn_delay_max = millis;if(m_reconn_delay>millis) m_reconn_delay = millis;}
 
+        void set_reconnect_randomization(double factor) {m_reconn_randomization = factor < 0 ? 0 : (factor > 1 ? 1 : factor);}
+
         void set_logs_default();
 
         void set_logs_quiet();
@@ -142,7 +173,38 @@ namespace sio
         void set_proxy_basic_auth(const std::string& uri, const std::string& username, const std::string& password);
 
     protected:
+        typedef send_queue::frame outbound_frame;
+
         void send(packet& p);
+
+        // Single-frame packets with a coalesce key replace a queued frame with the same key.
+        void send(packet& p, std::string const& coalesce_key);
+
+        // send() in two steps, for many packets at once: encode_frames appends the
+        // frames of p and returns their bytes, and enqueue_frames queues all
+        // collected frames in order under one lock with one flush posted, then
+        // clears them. Callers hand them over once they reach a batch's worth.
+        size_t encode_frames(packet& p, std::string const& coalesce_key, std::vector<outbound_frame>& frames);
+
+        void enqueue_frames(std::vector<outbound_frame>& frames);
+
+        // client_options::send_batch_max_bytes.
+        size_t batch_max_bytes() const { return m_send_queue.batch_max_bytes(); }
+
+        // Connected, and the transport isn't over client_options::send_backlog_max_bytes.
+        bool is_writable();
+
+        // io thread only. Runs f(true) on the io thread once is_writable() and
+        // bytes_written() reached written, or f(false) if the connection closes first.
+        void when_writable(std::function<void(bool)>&& f, uint64_t written = 0);
+
+        // Bytes ever queued for sending, and how many of them the transport has
+        // written (io thread only). websocketpp doesn't report write completion:
+        // what has left the send queue and isn't buffered any more is written.
+        uint64_t bytes_queued();
+        uint64_t bytes_written();
+
+        transport_metrics get_transport_metrics();
         
         void remove_socket(std::string const& nsp);
         
@@ -159,9 +221,26 @@ namespace sio
 
         void connect_impl(const std::string& uri, const std::string& query);
 
+        // address: where the host resolver says to connect, null to let the transport resolve.
+        void connect_to(const std::string& uri, const std::string& query, asio::ip::tcp::endpoint const* address);
+
         void close_impl(close::status::value const& code,std::string const& reason);
         
         void send_impl(std::shared_ptr<const std::string> const&  payload_ptr,frame::opcode::value opcode);
+
+        void enqueue_frame(outbound_frame&& f);
+
+        void kick_send_locked();
+
+        void flush_send_queue();
+
+        bool transport_backlogged();
+
+        void arm_backlog_timer();
+
+        void on_backlog_timer();
+
+        void fail_writable_waiters();
         
         void ping(const asio::error_code& ec);
         
@@ -169,13 +248,15 @@ namespace sio
 
         void timeout_reconnect(asio::error_code const& ec);
 
-        unsigned next_delay() const;
+        unsigned next_delay();
 
         socket::ptr get_socket_locked(std::string const& nsp);
         
         void sockets_invoke_void(void (sio::socket::*fn)(void));
         
         void on_decode(packet const& pack);
+        void dispatch_to_workers(socket::ptr const& so_ptr, packet const& pack);
+        void release_held_packets(std::string const& nsp);
         void on_encode(bool isBinary,shared_ptr<const string> const& payload);
         
         //websocket callbacks
@@ -197,11 +278,28 @@ namespace sio
         void clear_timers();
 
         void update_ping_timeout_timer();
+
+        void mark_closed();
+
+        void wait_closed();
         
         #if SIO_TLS
         typedef websocketpp::lib::shared_ptr<asio::ssl::context> context_ptr;
+
+        static context_ptr make_tls_context();
         
         context_ptr on_tls_init(connection_hdl con);
+
+        void on_tls_socket_init(SSL* ssl);
+
+        static int on_tls_new_session(SSL* ssl, SSL_SESSION* session);
+
+        // Created on the first handshake and reused by reconnects; client_hub
+        // shares one across its clients.
+        context_ptr m_tls_context;
+        // Last session the server issued, offered for resumption on the next
+        // handshake to the same host (io thread only).
+        std::shared_ptr<SSL_SESSION> m_tls_session;
         #endif
         
         // Percent encode query string
@@ -220,12 +318,23 @@ namespace sio
         std::string m_proxy_basic_username;
         std::string m_proxy_basic_password;
 
+        // Null with client_options::dns_refresh_ms 0 (io thread only).
+        std::unique_ptr<host_resolver> m_resolver;
+        // Host name for TLS SNI while connected by address (io thread only).
+        std::string m_connect_host;
+
         unsigned int m_ping_interval;
         unsigned int m_ping_timeout;
         std::chrono::steady_clock::time_point m_last_ping_sent;
         std::atomic<std::chrono::milliseconds::rep> m_last_ping_latency_ms{0};
         
         std::unique_ptr<std::thread> m_network_thread;
+        // False when the owner runs the io_context, see client_options::run_io_thread.
+        const bool m_run_io_thread;
+        // A websocket connect is in flight (io thread only).
+        bool m_connecting;
+        std::mutex m_closed_mutex;
+        std::condition_variable m_closed_cv;
         
         packet_manager m_packet_mgr;
         
@@ -233,7 +342,61 @@ namespace sio
 
         std::unique_ptr<asio::steady_timer> m_reconn_timer;
 
+        // Encoded frames waiting for the io thread, written in batches; guarded by m_send_mutex.
+        send_queue m_send_queue;
+        std::unique_ptr<asio::steady_timer> m_send_timer;
+        std::mutex m_send_mutex;
+        const std::chrono::microseconds m_send_linger;
+        // Unwritten bytes websocketpp held at the last check (under m_send_mutex),
+        // polled by m_backlog_timer while over send_backlog_max_bytes.
+        size_t m_transport_backlog;
+        const size_t m_send_backlog_max_bytes;
+        std::unique_ptr<asio::steady_timer> m_backlog_timer;
+        bool m_backlog_waiting;
+        // when_writable() callbacks (io thread only).
+        struct writable_waiter
+        {
+            uint64_t written;
+            std::function<void(bool)> f;
+        };
+        std::vector<writable_waiter> m_writable_waiters;
+
+        // Behind transport_metrics. Frame and byte counts are only written by the
+        // io thread.
+        const bool m_record_timings;
+        std::atomic<uint64_t> m_frames_sent{0};
+        std::atomic<uint64_t> m_frames_received{0};
+        std::atomic<uint64_t> m_bytes_sent{0};
+        std::atomic<uint64_t> m_bytes_received{0};
+        histogram_recorder m_encode_time;
+        histogram_recorder m_decode_time;
+        histogram_recorder m_send_queue_wait;
+        histogram_recorder m_handler_time;
+        // Handler time within the frame on_message is decoding, taken out of
+        // its decode time (io thread only).
+        std::chrono::nanoseconds m_frame_handler_time;
+
+        // client_options::tracer, fixed for the client's lifetime.
+        const trace_listener m_tracer;
+#if SIO_PERMESSAGE_DEFLATE
+        // client_options::permessage_deflate and compress_min_bytes.
+        bool m_compress;
+        size_t m_compress_min_bytes;
+        // The server accepted the extension for the current connection (io thread only).
+        bool m_deflate_negotiated;
+#endif
+
         std::atomic<con_state> m_con_state;
+
+        // Event and ack handlers run here when client_options::event_worker_threads is set.
+        std::unique_ptr<worker_pool> m_event_workers;
+        const client_options::handler_ordering m_worker_ordering;
+        // Namespaces whose connect, disconnect or error packet waits for the
+        // handlers queued before it, and what arrived for them meanwhile (io
+        // thread only).
+        std::map<std::string, std::deque<packet>> m_held_packets;
+        // Set by the destructor: workers stop handing packets back to the io thread.
+        std::atomic<bool> m_workers_stopping{false};
         
         client::con_listener m_open_listener;
         client::fail_listener m_fail_listener;
@@ -254,6 +417,10 @@ namespace sio
 
         unsigned m_reconn_delay_max;
 
+        double m_reconn_randomization;
+
+        std::minstd_rand m_reconn_rng;
+
         unsigned m_reconn_attempts;
 
         unsigned m_reconn_made;
@@ -265,6 +432,7 @@ namespace sio
         std::atomic<bool> m_has_pending_reason { false };
 
         friend class sio::client;
+        friend class sio::client_hub;
         friend class sio::socket;
     };
 }
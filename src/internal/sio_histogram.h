@@ -0,0 +1,110 @@
+//
+//  sio_histogram.h
+//
+//  Lock-free latency histogram behind latency_histogram snapshots.
+//
+
+#ifndef SIO_HISTOGRAM_H
+#define SIO_HISTOGRAM_H
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include "../sio_metrics.h"
+
+namespace sio
+{
+    // Fixed log-linear buckets over the whole 64-bit nanosecond range: values
+    // below 16 get a bucket each, then every power of two is split into 16.
+    // record() is a few relaxed atomic adds, safe from any thread; snapshot()
+    // may run concurrently and sees each bucket at some point during the copy.
+    class histogram_recorder
+    {
+    public:
+        static constexpr unsigned sub_bucket_bits = 4;
+        static constexpr std::size_t sub_buckets = std::size_t(1) << sub_bucket_bits;
+        static constexpr std::size_t bucket_count = (64 - sub_bucket_bits + 1) * sub_buckets;
+
+        histogram_recorder() : m_sum(0), m_min(std::numeric_limits<std::uint64_t>::max()), m_max(0)
+        {
+            for (std::atomic<std::uint64_t> &b : m_buckets)
+            {
+                b.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        histogram_recorder(histogram_recorder const &) = delete;
+        histogram_recorder &operator=(histogram_recorder const &) = delete;
+
+        void record(std::chrono::nanoseconds d)
+        {
+            std::uint64_t v = d.count() > 0 ? static_cast<std::uint64_t>(d.count()) : 0;
+            m_buckets[index_of(v)].fetch_add(1, std::memory_order_relaxed);
+            m_sum.fetch_add(v, std::memory_order_relaxed);
+            std::uint64_t seen = m_min.load(std::memory_order_relaxed);
+            while (v < seen && !m_min.compare_exchange_weak(seen, v, std::memory_order_relaxed))
+            {
+            }
+            seen = m_max.load(std::memory_order_relaxed);
+            while (v > seen && !m_max.compare_exchange_weak(seen, v, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        latency_histogram snapshot() const
+        {
+            latency_histogram h;
+            for (std::size_t i = 0; i < bucket_count; ++i)
+            {
+                std::uint64_t n = m_buckets[i].load(std::memory_order_relaxed);
+                if (n > 0)
+                {
+                    h.buckets.push_back(latency_histogram::bucket{
+                        std::chrono::nanoseconds(static_cast<std::int64_t>(std::min(upper_bound(i), max_ns))), n});
+                    h.count += n;
+                }
+            }
+            if (h.count > 0)
+            {
+                h.sum = std::chrono::nanoseconds(static_cast<std::int64_t>(std::min(m_sum.load(std::memory_order_relaxed), max_ns)));
+                h.min = std::chrono::nanoseconds(static_cast<std::int64_t>(std::min(m_min.load(std::memory_order_relaxed), max_ns)));
+                h.max = std::chrono::nanoseconds(static_cast<std::int64_t>(std::min(m_max.load(std::memory_order_relaxed), max_ns)));
+            }
+            return h;
+        }
+
+        static std::size_t index_of(std::uint64_t v)
+        {
+            if (v < sub_buckets)
+            {
+                return static_cast<std::size_t>(v);
+            }
+            unsigned msb = 63 - static_cast<unsigned>(std::countl_zero(v));
+            unsigned shift = msb - sub_bucket_bits;
+            return (msb - sub_bucket_bits + 1) * sub_buckets + static_cast<std::size_t>((v >> shift) & (sub_buckets - 1));
+        }
+
+        static std::uint64_t upper_bound(std::size_t index)
+        {
+            if (index < sub_buckets)
+            {
+                return index;
+            }
+            unsigned shift = static_cast<unsigned>(index / sub_buckets) - 1;
+            std::uint64_t lower = static_cast<std::uint64_t>(sub_buckets + index % sub_buckets) << shift;
+            return lower + ((std::uint64_t(1) << shift) - 1);
+        }
+
+    private:
+        static constexpr std::uint64_t max_ns = static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max());
+
+        std::atomic<std::uint64_t> m_buckets[bucket_count];
+        std::atomic<std::uint64_t> m_sum;
+        std::atomic<std::uint64_t> m_min;
+        std::atomic<std::uint64_t> m_max;
+    };
+}
+#endif // SIO_HISTOGRAM_H
@@ -0,0 +1,292 @@
+//
+//  sio_host_resolver.h
+//
+//  DNS cache for the server host, with RFC 8305 (happy eyeballs) connection
+//  racing to pick the address reconnects go to.
+//
+
+#ifndef SIO_HOST_RESOLVER_H
+#define SIO_HOST_RESOLVER_H
+#include <asio/error_code.hpp>
+#include <asio/io_context.hpp>
+#include <asio/ip/tcp.hpp>
+#include <asio/steady_timer.hpp>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace sio
+{
+    // Resolves a host once and races TCP connections to its addresses, IPv6 and
+    // IPv4 interleaved and started attempt_delay apart, keeping the first that
+    // connects. Later lookups return that address at once; once it is older than
+    // refresh_after it is still returned while a lookup runs in the background,
+    // which only races again if the address is no longer in the answer. Not
+    // thread-safe: use it from the io thread.
+    class host_resolver
+    {
+    public:
+        typedef asio::ip::tcp::endpoint endpoint;
+        // ec is set if the host doesn't resolve or none of its addresses connect.
+        typedef std::function<void(asio::error_code const &ec, endpoint const &address)> handler;
+
+        host_resolver(asio::io_context &io, std::chrono::milliseconds refresh_after, std::chrono::milliseconds attempt_delay)
+            : m_io(io), m_resolver(io), m_refresh_after(refresh_after), m_attempt_delay(attempt_delay)
+        {
+        }
+
+        ~host_resolver()
+        {
+            cancel();
+        }
+
+        host_resolver(host_resolver const &) = delete;
+        host_resolver &operator=(host_resolver const &) = delete;
+
+        // Calls h before returning when an address is cached, else once the race ends.
+        void resolve(std::string const &host, std::string const &port, handler &&h)
+        {
+            if (host != m_host || port != m_port)
+            {
+                set_host(host, port);
+            }
+            if (m_cached)
+            {
+                if (!m_lookup && std::chrono::steady_clock::now() - m_resolved_at >= m_refresh_after)
+                {
+                    lookup();
+                }
+                h(asio::error_code(), m_address);
+                return;
+            }
+            m_waiters.push_back(std::move(h));
+            if (!m_lookup)
+            {
+                lookup();
+            }
+        }
+
+        // Races candidates in this order, as if host had resolved to them, and
+        // caches the winner as resolve would.
+        void resolve_to(std::string const &host, std::string const &port, std::vector<endpoint> &&candidates, handler &&h)
+        {
+            set_host(host, port);
+            m_waiters.push_back(std::move(h));
+            m_lookup = true;
+            start_race(std::move(candidates));
+        }
+
+        // The cached address failed to connect; the next resolve starts over.
+        void forget()
+        {
+            m_cached = false;
+        }
+
+        // Drops the lookup in flight. Its waiters are called with
+        // asio::error::operation_aborted before this returns, and may resolve again.
+        void cancel()
+        {
+            if (!m_lookup)
+            {
+                return;
+            }
+            ++m_generation;
+            m_resolver.cancel();
+            if (m_race)
+            {
+                end_race(m_race);
+                m_race.reset();
+            }
+            m_lookup = false;
+            std::vector<handler> waiters;
+            waiters.swap(m_waiters);
+            for (handler const &h : waiters)
+            {
+                h(make_error_code(asio::error::operation_aborted), endpoint());
+            }
+        }
+
+        // RFC 8305 section 4: alternate address families, starting with the
+        // family of the resolver's first (most preferred) answer.
+        static std::vector<endpoint> interleave(std::vector<endpoint> const &sorted)
+        {
+            std::vector<endpoint> first, second;
+            for (endpoint const &e : sorted)
+            {
+                (e.address().is_v6() == sorted.front().address().is_v6() ? first : second).push_back(e);
+            }
+            std::vector<endpoint> out;
+            out.reserve(sorted.size());
+            for (size_t i = 0; i < first.size() || i < second.size(); ++i)
+            {
+                if (i < first.size())
+                    out.push_back(first[i]);
+                if (i < second.size())
+                    out.push_back(second[i]);
+            }
+            return out;
+        }
+
+    private:
+        struct race
+        {
+            explicit race(asio::io_context &io) : timer(io) {}
+
+            std::vector<endpoint> candidates;
+            std::vector<std::unique_ptr<asio::ip::tcp::socket>> sockets;
+            asio::steady_timer timer;
+            size_t pending = 0;
+            bool done = false;
+            asio::error_code last_error;
+        };
+
+        void set_host(std::string const &host, std::string const &port)
+        {
+            cancel();
+            m_cached = false;
+            m_host = host;
+            m_port = port;
+        }
+
+        void lookup()
+        {
+            m_lookup = true;
+            std::weak_ptr<int> lifetime = m_lifetime;
+            unsigned generation = m_generation;
+            m_resolver.async_resolve(m_host, m_port, [this, lifetime, generation](asio::error_code const &ec, asio::ip::tcp::resolver::results_type const &results) {
+                // A result already queued when the lookup was cancelled is stale too.
+                if (!lifetime.lock() || ec == asio::error::operation_aborted || generation != m_generation)
+                {
+                    return;
+                }
+                if (ec || results.empty())
+                {
+                    finish(ec ? ec : make_error_code(asio::error::host_not_found), endpoint());
+                    return;
+                }
+                std::vector<endpoint> sorted;
+                for (auto const &entry : results)
+                {
+                    if (m_cached && entry.endpoint() == m_address)
+                    {
+                        // Still served: no need to race again.
+                        finish(asio::error_code(), m_address);
+                        return;
+                    }
+                    sorted.push_back(entry.endpoint());
+                }
+                start_race(interleave(sorted));
+            });
+        }
+
+        void start_race(std::vector<endpoint> &&candidates)
+        {
+            std::shared_ptr<race> r = std::make_shared<race>(m_io);
+            r->candidates = std::move(candidates);
+            m_race = r;
+            attempt(r);
+        }
+
+        void attempt(std::shared_ptr<race> const &r)
+        {
+            size_t index = r->sockets.size();
+            if (index == r->candidates.size())
+            {
+                // The timer expired as a failure started the last attempt: its
+                // handler was already queued, so cancelling it didn't stop it.
+                return;
+            }
+            r->sockets.emplace_back(new asio::ip::tcp::socket(m_io));
+            ++r->pending;
+            std::weak_ptr<int> lifetime = m_lifetime;
+            r->sockets[index]->async_connect(r->candidates[index], [this, lifetime, r, index](asio::error_code const &ec) {
+                --r->pending;
+                if (r->done || !lifetime.lock())
+                {
+                    return;
+                }
+                if (!ec)
+                {
+                    end_race(r);
+                    finish(asio::error_code(), r->candidates[index]);
+                    return;
+                }
+                r->last_error = ec;
+                if (r->sockets.size() < r->candidates.size())
+                {
+                    // A failed attempt starts the next one without waiting.
+                    r->timer.cancel();
+                    attempt(r);
+                }
+                else if (r->pending == 0)
+                {
+                    end_race(r);
+                    finish(r->last_error, endpoint());
+                }
+            });
+            if (r->sockets.size() < r->candidates.size())
+            {
+                r->timer.expires_after(m_attempt_delay);
+                r->timer.async_wait([this, lifetime, r](asio::error_code const &ec) {
+                    if (!ec && !r->done && lifetime.lock())
+                    {
+                        attempt(r);
+                    }
+                });
+            }
+        }
+
+        // The winner was only a probe: the transport opens its own connection to it.
+        static void end_race(std::shared_ptr<race> const &r)
+        {
+            r->done = true;
+            r->timer.cancel();
+            for (std::unique_ptr<asio::ip::tcp::socket> const &s : r->sockets)
+            {
+                asio::error_code ignored;
+                s->close(ignored);
+            }
+        }
+
+        void finish(asio::error_code const &ec, endpoint const &address)
+        {
+            m_lookup = false;
+            m_race.reset();
+            if (!ec)
+            {
+                m_cached = true;
+                m_address = address;
+                m_resolved_at = std::chrono::steady_clock::now();
+            }
+            std::vector<handler> waiters;
+            waiters.swap(m_waiters);
+            for (handler const &h : waiters)
+            {
+                h(ec, address);
+            }
+        }
+
+        asio::io_context &m_io;
+        asio::ip::tcp::resolver m_resolver;
+        std::chrono::milliseconds m_refresh_after;
+        std::chrono::milliseconds m_attempt_delay;
+
+        std::string m_host;
+        std::string m_port;
+        bool m_cached = false;
+        endpoint m_address;
+        std::chrono::steady_clock::time_point m_resolved_at;
+
+        bool m_lookup = false;
+        unsigned m_generation = 0;
+        std::shared_ptr<race> m_race;
+        std::vector<handler> m_waiters;
+
+        // Handlers still queued once the resolver is gone find it expired.
+        std::shared_ptr<int> m_lifetime = std::make_shared<int>(0);
+    };
+}
+#endif // SIO_HOST_RESOLVER_H
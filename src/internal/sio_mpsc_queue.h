@@ -0,0 +1,129 @@
+//
+//  sio_mpsc_queue.h
+//
+//  Lock-free multi-producer/single-consumer queue (Vyukov's intrusive design).
+//
+
+#ifndef SIO_MPSC_QUEUE_H
+#define SIO_MPSC_QUEUE_H
+#include <atomic>
+#include <new>
+#include <utility>
+#include "../sio_message_pool.h"
+
+namespace sio
+{
+    // push() is wait-free and may be called from any thread; pop() must only be
+    // called by one consumer at a time. Values are moved in and out, never copied.
+    template <typename T>
+    class mpsc_queue
+    {
+    public:
+        mpsc_queue() : m_head(&m_stub), m_tail(&m_stub)
+        {
+        }
+
+        ~mpsc_queue()
+        {
+            T drop;
+            while (pop(drop))
+            {
+            }
+        }
+
+        mpsc_queue(mpsc_queue const &) = delete;
+        mpsc_queue &operator=(mpsc_queue const &) = delete;
+
+        void push(T &&value)
+        {
+            node *n = new (message_pool::allocate(sizeof(node))) node(std::move(value));
+            push_node(n);
+        }
+
+        // Moves in [first, last) as one run: the nodes are linked privately and
+        // published with a single exchange, so the run stays contiguous and in order.
+        template <typename It>
+        void push_chain(It first, It last)
+        {
+            if (first == last)
+            {
+                return;
+            }
+            node *head = new (message_pool::allocate(sizeof(node))) node(std::move(*first));
+            node_base *tail = head;
+            for (++first; first != last; ++first)
+            {
+                node *n = new (message_pool::allocate(sizeof(node))) node(std::move(*first));
+                tail->next.store(n, std::memory_order_relaxed);
+                tail = n;
+            }
+            tail->next.store(nullptr, std::memory_order_relaxed);
+            node_base *prev = m_head.exchange(tail, std::memory_order_acq_rel);
+            prev->next.store(head, std::memory_order_release);
+        }
+
+        // Returns false when the queue is empty, or when the only remaining element
+        // is still being linked in by a producer; that producer's push completes
+        // shortly and a later pop() sees it.
+        bool pop(T &out)
+        {
+            node_base *tail = m_tail;
+            node_base *next = tail->next.load(std::memory_order_acquire);
+            if (tail == &m_stub)
+            {
+                if (next == nullptr)
+                {
+                    return false;
+                }
+                m_tail = next;
+                tail = next;
+                next = next->next.load(std::memory_order_acquire);
+            }
+            if (next == nullptr)
+            {
+                if (tail != m_head.load(std::memory_order_acquire))
+                {
+                    return false;
+                }
+                // tail is the last element: put the stub behind it so it can be unlinked.
+                push_node(&m_stub);
+                next = tail->next.load(std::memory_order_acquire);
+                if (next == nullptr)
+                {
+                    return false;
+                }
+            }
+            m_tail = next;
+            node *n = static_cast<node *>(tail);
+            out = std::move(n->value);
+            n->~node();
+            message_pool::deallocate(n, sizeof(node));
+            return true;
+        }
+
+    private:
+        struct node_base
+        {
+            std::atomic<node_base *> next{nullptr};
+        };
+
+        struct node : node_base
+        {
+            explicit node(T &&v) : value(std::move(v)) {}
+            T value;
+        };
+
+        void push_node(node_base *n)
+        {
+            n->next.store(nullptr, std::memory_order_relaxed);
+            node_base *prev = m_head.exchange(n, std::memory_order_acq_rel);
+            prev->next.store(n, std::memory_order_release);
+        }
+
+        // Producers and the consumer work on different cache lines.
+        alignas(64) std::atomic<node_base *> m_head;
+        alignas(64) node_base *m_tail;
+        node_base m_stub;
+    };
+}
+#endif // SIO_MPSC_QUEUE_H
@@ -0,0 +1,546 @@
+//
+//  sio_msgpack.h
+//
+//  MessagePack encoding of message trees, for msgpack_packet_parser.
+//
+
+#ifndef SIO_MSGPACK_H
+#define SIO_MSGPACK_H
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include "../sio_message.h"
+
+namespace sio
+{
+    namespace msgpack
+    {
+        // Big-endian, as MessagePack stores every multi-byte value.
+        inline void put_be(std::string &out, std::uint64_t v, unsigned bytes)
+        {
+            char buf[8];
+            for (unsigned i = 0; i < bytes; ++i)
+            {
+                buf[i] = static_cast<char>(v >> (8 * (bytes - 1 - i)));
+            }
+            out.append(buf, bytes);
+        }
+
+        // Writes the shortest header for a length; fix is the fix* tag with room for fix_max.
+        inline void put_length(std::string &out, std::size_t n, unsigned char fix, std::size_t fix_max,
+                               unsigned char tag8, unsigned char tag16, unsigned char tag32)
+        {
+            if (n <= fix_max && fix != 0)
+            {
+                out += static_cast<char>(fix | n);
+            }
+            else if (n <= 0xff && tag8 != 0)
+            {
+                out += static_cast<char>(tag8);
+                put_be(out, n, 1);
+            }
+            else if (n <= 0xffff)
+            {
+                out += static_cast<char>(tag16);
+                put_be(out, n, 2);
+            }
+            else
+            {
+                out += static_cast<char>(tag32);
+                put_be(out, n, 4);
+            }
+        }
+
+        inline void write_nil(std::string &out)
+        {
+            out += static_cast<char>(0xc0);
+        }
+
+        inline void write_bool(std::string &out, bool b)
+        {
+            out += static_cast<char>(b ? 0xc3 : 0xc2);
+        }
+
+        inline void write_int(std::string &out, std::int64_t v)
+        {
+            if (v >= 0)
+            {
+                std::uint64_t u = static_cast<std::uint64_t>(v);
+                if (u < 0x80)
+                {
+                    out += static_cast<char>(u);
+                }
+                else if (u <= 0xff)
+                {
+                    out += static_cast<char>(0xcc);
+                    put_be(out, u, 1);
+                }
+                else if (u <= 0xffff)
+                {
+                    out += static_cast<char>(0xcd);
+                    put_be(out, u, 2);
+                }
+                else if (u <= 0xffffffffu)
+                {
+                    out += static_cast<char>(0xce);
+                    put_be(out, u, 4);
+                }
+                else
+                {
+                    out += static_cast<char>(0xcf);
+                    put_be(out, u, 8);
+                }
+            }
+            else if (v >= -32)
+            {
+                out += static_cast<char>(v);
+            }
+            else if (v >= INT8_MIN)
+            {
+                out += static_cast<char>(0xd0);
+                put_be(out, static_cast<std::uint64_t>(v), 1);
+            }
+            else if (v >= INT16_MIN)
+            {
+                out += static_cast<char>(0xd1);
+                put_be(out, static_cast<std::uint64_t>(v), 2);
+            }
+            else if (v >= INT32_MIN)
+            {
+                out += static_cast<char>(0xd2);
+                put_be(out, static_cast<std::uint64_t>(v), 4);
+            }
+            else
+            {
+                out += static_cast<char>(0xd3);
+                put_be(out, static_cast<std::uint64_t>(v), 8);
+            }
+        }
+
+        inline void write_double(std::string &out, double d)
+        {
+            std::uint64_t bits;
+            std::memcpy(&bits, &d, sizeof(bits));
+            out += static_cast<char>(0xcb);
+            put_be(out, bits, 8);
+        }
+
+        inline void write_string(std::string &out, std::string_view s)
+        {
+            put_length(out, s.size(), 0xa0, 31, 0xd9, 0xda, 0xdb);
+            out.append(s.data(), s.size());
+        }
+
+        inline void write_binary(std::string &out, std::string const &b)
+        {
+            put_length(out, b.size(), 0, 0, 0xc4, 0xc5, 0xc6);
+            out.append(b);
+        }
+
+        inline void write_array_header(std::string &out, std::size_t n)
+        {
+            put_length(out, n, 0x90, 15, 0, 0xdc, 0xdd);
+        }
+
+        inline void write_map_header(std::string &out, std::size_t n)
+        {
+            put_length(out, n, 0x80, 15, 0, 0xde, 0xdf);
+        }
+
+        inline void write_message(message const &msg, std::string &out)
+        {
+            switch (msg.get_flag())
+            {
+            case message::flag_integer:
+                write_int(out, msg.get_int());
+                break;
+            case message::flag_double:
+                write_double(out, msg.get_double());
+                break;
+            case message::flag_string:
+                write_string(out, msg.get_string_view());
+                break;
+            case message::flag_boolean:
+                write_bool(out, msg.get_bool());
+                break;
+            case message::flag_binary:
+                if (msg.get_binary())
+                {
+                    write_binary(out, *msg.get_binary());
+                }
+                else
+                {
+                    write_binary(out, std::string());
+                }
+                break;
+            case message::flag_array:
+                write_array_header(out, msg.get_vector().size());
+                for (message::ptr const &element : msg.get_vector())
+                {
+                    if (element)
+                    {
+                        write_message(*element, out);
+                    }
+                    else
+                    {
+                        write_nil(out);
+                    }
+                }
+                break;
+            case message::flag_object:
+            {
+                object_message const &obj = static_cast<object_message const &>(msg);
+                write_map_header(out, obj.size());
+                auto write_fields = [&out](auto const &fields) {
+                    for (auto const &field : fields)
+                    {
+                        write_string(out, field.first);
+                        if (field.second)
+                        {
+                            write_message(*field.second, out);
+                        }
+                        else
+                        {
+                            write_nil(out);
+                        }
+                    }
+                };
+                // Insertion order while the object has one, as the JSON writer does.
+                if (obj.is_ordered())
+                {
+                    write_fields(obj.get_fields());
+                }
+                else
+                {
+                    write_fields(obj.get_map());
+                }
+                break;
+            }
+            default:
+                write_nil(out);
+                break;
+            }
+        }
+
+        // Reads MessagePack values from a buffer. Every read checks its bounds and
+        // fails (false or null) on truncated or malformed input.
+        class reader
+        {
+        public:
+            // With a view_owner, strings are decoded as views into the buffer,
+            // which the owner keeps alive.
+            reader(char const *data, std::size_t size, std::shared_ptr<const void> const &view_owner = nullptr)
+                : m_pos(data), m_end(data + size), m_view_owner(view_owner)
+            {
+            }
+
+            bool at_end() const
+            {
+                return m_pos == m_end;
+            }
+
+            bool read_map_header(std::size_t &n)
+            {
+                unsigned char tag;
+                if (!peek(tag))
+                {
+                    return false;
+                }
+                if ((tag & 0xf0) == 0x80)
+                {
+                    ++m_pos;
+                    n = tag & 0x0f;
+                    return true;
+                }
+                if (tag == 0xde || tag == 0xdf)
+                {
+                    ++m_pos;
+                    return read_be(tag == 0xde ? 2 : 4, n);
+                }
+                return false;
+            }
+
+            bool read_string(std::string_view &s)
+            {
+                unsigned char tag;
+                std::size_t n;
+                if (!peek(tag))
+                {
+                    return false;
+                }
+                if ((tag & 0xe0) == 0xa0)
+                {
+                    ++m_pos;
+                    n = tag & 0x1f;
+                }
+                else if (tag >= 0xd9 && tag <= 0xdb)
+                {
+                    ++m_pos;
+                    if (!read_be(1u << (tag - 0xd9), n))
+                    {
+                        return false;
+                    }
+                }
+                else
+                {
+                    return false;
+                }
+                return take(n, s);
+            }
+
+            bool read_int(std::int64_t &v)
+            {
+                message::ptr m = read_message(0);
+                if (!m || m->get_flag() != message::flag_integer)
+                {
+                    return false;
+                }
+                v = m->get_int();
+                return true;
+            }
+
+            // Null on malformed input. Extension types (undefined, dates) read as null.
+            message::ptr read_message(unsigned depth)
+            {
+                unsigned char tag;
+                if (depth > k_max_depth || !peek(tag))
+                {
+                    return message::ptr();
+                }
+                if (tag < 0x80 || tag >= 0xe0)
+                {
+                    ++m_pos;
+                    // positive and negative fixint
+                    return int_message::create(static_cast<signed char>(tag));
+                }
+                if ((tag & 0xf0) == 0x80 || tag == 0xde || tag == 0xdf)
+                {
+                    std::size_t n;
+                    return read_map_header(n) ? read_map(n, depth) : message::ptr();
+                }
+                if ((tag & 0xf0) == 0x90 || tag == 0xdc || tag == 0xdd)
+                {
+                    ++m_pos;
+                    std::size_t n = tag & 0x0f;
+                    if (tag >= 0xdc && !read_be(tag == 0xdc ? 2 : 4, n))
+                    {
+                        return message::ptr();
+                    }
+                    return read_array(n, depth);
+                }
+                if ((tag & 0xe0) == 0xa0 || (tag >= 0xd9 && tag <= 0xdb))
+                {
+                    std::string_view s;
+                    if (!read_string(s))
+                    {
+                        return message::ptr();
+                    }
+                    return m_view_owner ? string_message::create_view(s, m_view_owner) : string_message::create(std::string(s));
+                }
+                ++m_pos;
+                std::size_t n;
+                std::string_view bytes;
+                switch (tag)
+                {
+                case 0xc0:
+                    return null_message::create();
+                case 0xc2:
+                    return bool_message::create(false);
+                case 0xc3:
+                    return bool_message::create(true);
+                case 0xc4:
+                case 0xc5:
+                case 0xc6:
+                    if (!read_be(1u << (tag - 0xc4), n) || !take(n, bytes))
+                    {
+                        return message::ptr();
+                    }
+                    return binary_message::create(std::make_shared<const std::string>(bytes.data(), bytes.size()));
+                case 0xc7:
+                case 0xc8:
+                case 0xc9:
+                    // ext: length, type byte, data
+                    if (!read_be(1u << (tag - 0xc7), n) || !take(n + 1, bytes))
+                    {
+                        return message::ptr();
+                    }
+                    return null_message::create();
+                case 0xca:
+                {
+                    std::uint32_t bits;
+                    float f;
+                    if (!read_raw(4, bits))
+                    {
+                        return message::ptr();
+                    }
+                    std::memcpy(&f, &bits, sizeof(f));
+                    return double_message::create(f);
+                }
+                case 0xcb:
+                {
+                    std::uint64_t bits;
+                    double d;
+                    if (!read_raw(8, bits))
+                    {
+                        return message::ptr();
+                    }
+                    std::memcpy(&d, &bits, sizeof(d));
+                    return double_message::create(d);
+                }
+                case 0xcc:
+                case 0xcd:
+                case 0xce:
+                case 0xcf:
+                {
+                    std::uint64_t u;
+                    if (!read_raw(1u << (tag - 0xcc), u))
+                    {
+                        return message::ptr();
+                    }
+                    // Beyond int64 there's only the double to hold it.
+                    if (u > static_cast<std::uint64_t>(INT64_MAX))
+                    {
+                        return double_message::create(static_cast<double>(u));
+                    }
+                    return int_message::create(static_cast<std::int64_t>(u));
+                }
+                case 0xd0:
+                case 0xd1:
+                case 0xd2:
+                case 0xd3:
+                {
+                    unsigned bytes_len = 1u << (tag - 0xd0);
+                    std::uint64_t u;
+                    if (!read_raw(bytes_len, u))
+                    {
+                        return message::ptr();
+                    }
+                    // Sign-extend from bytes_len bytes.
+                    unsigned shift = 64 - 8 * bytes_len;
+                    return int_message::create(static_cast<std::int64_t>(u << shift) >> shift);
+                }
+                case 0xd4:
+                case 0xd5:
+                case 0xd6:
+                case 0xd7:
+                case 0xd8:
+                    // fixext: type byte, then 1 to 16 bytes
+                    if (!take((std::size_t(1) << (tag - 0xd4)) + 1, bytes))
+                    {
+                        return message::ptr();
+                    }
+                    return null_message::create();
+                default:
+                    return message::ptr();
+                }
+            }
+
+        private:
+            // Matches simdjson's default nesting limit for JSON.
+            static const unsigned k_max_depth = 1024;
+
+            message::ptr read_map(std::size_t n, unsigned depth)
+            {
+                // Each member takes at least two bytes.
+                if (n > static_cast<std::size_t>(m_end - m_pos) / 2)
+                {
+                    return message::ptr();
+                }
+                message::ptr obj = object_message::create();
+                object_message *fields = static_cast<object_message *>(obj.get());
+                for (std::size_t i = 0; i < n; ++i)
+                {
+                    std::string_view key;
+                    if (!read_string(key))
+                    {
+                        return message::ptr();
+                    }
+                    message::ptr value = read_message(depth + 1);
+                    if (!value)
+                    {
+                        return message::ptr();
+                    }
+                    fields->append(std::string(key), value);
+                }
+                return obj;
+            }
+
+            message::ptr read_array(std::size_t n, unsigned depth)
+            {
+                if (n > static_cast<std::size_t>(m_end - m_pos))
+                {
+                    return message::ptr();
+                }
+                message::ptr arr = array_message::create();
+                std::vector<message::ptr> &elements = arr->get_vector();
+                elements.reserve(n);
+                for (std::size_t i = 0; i < n; ++i)
+                {
+                    message::ptr value = read_message(depth + 1);
+                    if (!value)
+                    {
+                        return message::ptr();
+                    }
+                    elements.push_back(std::move(value));
+                }
+                return arr;
+            }
+
+            bool peek(unsigned char &tag) const
+            {
+                if (m_pos == m_end)
+                {
+                    return false;
+                }
+                tag = static_cast<unsigned char>(*m_pos);
+                return true;
+            }
+
+            bool take(std::size_t n, std::string_view &bytes)
+            {
+                if (n > static_cast<std::size_t>(m_end - m_pos))
+                {
+                    return false;
+                }
+                bytes = std::string_view(m_pos, n);
+                m_pos += n;
+                return true;
+            }
+
+            template <typename T>
+            bool read_raw(unsigned bytes, T &out)
+            {
+                std::string_view raw;
+                if (!take(bytes, raw))
+                {
+                    return false;
+                }
+                std::uint64_t v = 0;
+                for (char c : raw)
+                {
+                    v = (v << 8) | static_cast<unsigned char>(c);
+                }
+                out = static_cast<T>(v);
+                return true;
+            }
+
+            bool read_be(unsigned bytes, std::size_t &n)
+            {
+                std::uint64_t v;
+                if (!read_raw(bytes, v))
+                {
+                    return false;
+                }
+                n = static_cast<std::size_t>(v);
+                return true;
+            }
+
+            char const *m_pos;
+            char const *m_end;
+            std::shared_ptr<const void> m_view_owner;
+        };
+    }
+}
+#endif // SIO_MSGPACK_H
@@ -0,0 +1,173 @@
+//
+//  sio_offline_buffer.h
+//
+//  Packets emitted while a namespace isn't connected, and what to do when
+//  they don't fit.
+//
+
+#ifndef SIO_OFFLINE_BUFFER_H
+#define SIO_OFFLINE_BUFFER_H
+#include "sio_packet.h"
+#include "../sio_socket.h"
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace sio
+{
+    // Bounded by an offline_buffer_config. The buffer applies the overflow
+    // policy except for the wait of the block policy, which is the socket's:
+    // store returns full and the socket waits for room, then stores again.
+    // Not synchronized: the socket guards it with its offline mutex.
+    class offline_buffer
+    {
+    public:
+        typedef offline_buffer_config::overflow_policy overflow_policy;
+
+        struct entry
+        {
+            packet pack;
+            std::string event_name;
+            std::size_t bytes;
+            std::string coalesce_key;
+        };
+
+        enum class result
+        {
+            stored,  // p was moved into the buffer
+            dropped, // drop_newest, or larger than max_bytes
+            full     // block policy and no room; p is untouched
+        };
+
+        void configure(offline_buffer_config const &config)
+        {
+            m_config = config;
+        }
+
+        offline_buffer_config const &config() const
+        {
+            return m_config;
+        }
+
+        // Stores p, bytes being its estimated size. Ids of the packets it
+        // evicts or replaces are appended to evicted_acks, for the caller to
+        // forget once its lock is released.
+        result store(packet &p, std::size_t bytes, std::string const &event_name,
+                     std::string const &coalesce_key, std::vector<int> &evicted_acks)
+        {
+            if (m_config.max_bytes > 0 && bytes > m_config.max_bytes)
+            {
+                // Would never fit: evicting for it would only lose the rest.
+                return result::dropped;
+            }
+            if ((m_config.policy == overflow_policy::coalesce_by_event && !event_name.empty()) || !coalesce_key.empty())
+            {
+                for (std::size_t i = 0; i < m_entries.size(); ++i)
+                {
+                    entry &queued = m_entries[i];
+                    if (coalesce_key.empty() ? queued.event_name != event_name : queued.coalesce_key != coalesce_key)
+                    {
+                        continue;
+                    }
+                    evicted_acks.push_back(static_cast<int>(queued.pack.get_pack_id()));
+                    if (m_config.max_bytes == 0 || m_bytes - queued.bytes + bytes <= m_config.max_bytes)
+                    {
+                        // The newer value takes its place.
+                        m_bytes = m_bytes - queued.bytes + bytes;
+                        queued.pack = std::move(p);
+                        queued.bytes = bytes;
+                        return result::stored;
+                    }
+                    // Grown past max_bytes: the old value goes either way, and
+                    // the new one has to make room like any other packet.
+                    m_bytes -= queued.bytes;
+                    m_entries.erase(m_entries.begin() + i);
+                    break;
+                }
+            }
+            while (full(bytes))
+            {
+                if (m_config.policy == overflow_policy::drop_newest)
+                {
+                    return result::dropped;
+                }
+                if (m_config.policy == overflow_policy::block)
+                {
+                    return result::full;
+                }
+                entry &oldest = m_entries.front();
+                evicted_acks.push_back(static_cast<int>(oldest.pack.get_pack_id()));
+                m_bytes -= oldest.bytes;
+                m_entries.pop_front();
+            }
+            m_entries.push_back(entry{std::move(p), event_name, bytes, coalesce_key});
+            m_bytes += bytes;
+            return result::stored;
+        }
+
+        // No room for one more packet of bytes.
+        bool full(std::size_t bytes) const
+        {
+            return (m_config.max_packets > 0 && m_entries.size() >= m_config.max_packets) ||
+                   (m_config.max_bytes > 0 && m_bytes + bytes > m_config.max_bytes);
+        }
+
+        // After a store: true if the count crossed a watermark, with above
+        // telling which way, for the buffer listener.
+        bool crossed_watermark(bool &above)
+        {
+            bool now = m_above_high_watermark;
+            if (!now && m_config.high_watermark > 0 && m_entries.size() >= m_config.high_watermark)
+            {
+                now = true;
+            }
+            else if (now && m_entries.size() <= m_config.low_watermark)
+            {
+                now = false;
+            }
+            above = now;
+            if (now == m_above_high_watermark)
+            {
+                return false;
+            }
+            m_above_high_watermark = now;
+            return true;
+        }
+
+        // Moves every packet into out, oldest first. True if the buffer was
+        // above its high watermark, in which case the listener is told false.
+        bool take_all(std::deque<entry> &out)
+        {
+            out.swap(m_entries);
+            m_entries.clear();
+            m_bytes = 0;
+            bool was_above = m_above_high_watermark;
+            m_above_high_watermark = false;
+            return was_above;
+        }
+
+        void clear()
+        {
+            m_entries.clear();
+            m_bytes = 0;
+        }
+
+        std::size_t size() const
+        {
+            return m_entries.size();
+        }
+
+        std::size_t bytes() const
+        {
+            return m_bytes;
+        }
+
+    private:
+        offline_buffer_config m_config;
+        std::deque<entry> m_entries;
+        std::size_t m_bytes = 0;
+        bool m_above_high_watermark = false;
+    };
+}
+#endif // SIO_OFFLINE_BUFFER_H
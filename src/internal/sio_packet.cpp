@@ -6,11 +6,40 @@
 //
 
 #include "sio_packet.h"
+#include "sio_trace_scope.h"
+#include "sio_msgpack.h"
 #include <simdjson.h>
 #include <cassert>
 #include <algorithm>
-#include <sstream>
 #include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <charconv>
+#include <climits>
+
+// Floating-point to_chars needs a recent standard library (libc++ only ships
+// it from macOS 13.3 / iOS 16.3); without it doubles go through an ostream.
+#ifndef SIO_DOUBLE_TO_CHARS
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+#define SIO_DOUBLE_TO_CHARS 1
+#else
+#define SIO_DOUBLE_TO_CHARS 0
+#endif
+#endif
+#if !SIO_DOUBLE_TO_CHARS
+#include <locale>
+#include <sstream>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIO_ENCODE_SSE2 1
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#else
+#define SIO_ENCODE_SSE2 0
+#endif
 
 #define kBIN_PLACE_HOLDER "_placeholder"
 
@@ -20,16 +49,71 @@ namespace sio
 
     // Forward declarations
     void accept_message(message const &msg, string &json_str, vector<shared_ptr<const string>> &buffers, bool is_first = true);
-    string escape_json_string(const string &input);
     inline bool parse_unsigned_decimal(const char *p, size_t len, unsigned &out);
 
-    // Helper: Escape JSON string
-    string escape_json_string(const string &input)
+    inline bool needs_escape(unsigned char uc)
+    {
+        return uc == '"' || uc == '\\' || uc < 32;
+    }
+
+#if SIO_ENCODE_SSE2
+    inline unsigned first_set_bit(unsigned mask)
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return static_cast<unsigned>(index);
+#else
+        return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+    }
+#endif
+
+    // Length of the leading run of p that can be copied without escaping.
+    inline size_t plain_run(const char *p, size_t len)
+    {
+        size_t i = 0;
+#if SIO_ENCODE_SSE2
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i control = _mm_set1_epi8(31);
+        for (; i + 16 <= len; i += 16)
+        {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+            // unsigned c <= 31 exactly when max(c, 31) == 31
+            __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+                                        _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hits));
+            if (mask != 0)
+            {
+                return i + first_set_bit(mask);
+            }
+        }
+#endif
+        while (i < len && !needs_escape(static_cast<unsigned char>(p[i])))
+        {
+            ++i;
+        }
+        return i;
+    }
+
+    // Append input as the body of a JSON string, copying unescaped runs in bulk.
+    void append_escaped(string &out, string_view input)
     {
-        string out;
-        out.reserve(input.size() + 8); // heuristic
-        for (unsigned char uc : input)
+        const char *p = input.data();
+        size_t len = input.size();
+        while (len > 0)
         {
+            size_t run = plain_run(p, len);
+            out.append(p, run);
+            p += run;
+            len -= run;
+            if (len == 0)
+            {
+                break;
+            }
+            unsigned char uc = static_cast<unsigned char>(*p++);
+            --len;
             switch (uc)
             {
             case '"':
@@ -54,23 +138,47 @@ namespace sio
                 out += "\\t";
                 break;
             default:
-                if (uc < 32)
-                {
-                    char buf[6] = {'\\', 'u', 0, 0, 0, 0};
-                    static const char hex[] = "0123456789abcdef";
-                    buf[2] = '0';
-                    buf[3] = '0';
-                    buf[4] = hex[(uc >> 4) & 0xF];
-                    buf[5] = hex[uc & 0xF];
-                    out.append(buf, 6);
-                }
-                else
-                {
-                    out.push_back(static_cast<char>(uc));
-                }
+            {
+                static const char hex[] = "0123456789abcdef";
+                char buf[6] = {'\\', 'u', '0', '0', hex[(uc >> 4) & 0xF], hex[uc & 0xF]};
+                out.append(buf, 6);
+            }
             }
         }
-        return out;
+    }
+
+    template <typename T>
+    inline void append_number(string &out, T value)
+    {
+        char buf[24];
+        to_chars_result res = to_chars(buf, buf + sizeof(buf), value);
+        out.append(buf, res.ptr);
+    }
+
+    // Same text as an ostream with precision(15): %g with 15 significant digits.
+    inline void append_double(string &out, double value)
+    {
+#if SIO_DOUBLE_TO_CHARS
+        char buf[32];
+        to_chars_result res = to_chars(buf, buf + sizeof(buf), value, chars_format::general, 15);
+        out.append(buf, res.ptr);
+#else
+        ostringstream ss;
+        ss.imbue(locale::classic());
+        ss.precision(15);
+        ss << value;
+        out += ss.str();
+#endif
+    }
+
+    // Index of the first non-digit at or after pos.
+    inline size_t skip_digits(const char *p, size_t pos, size_t size)
+    {
+        while (pos < size && static_cast<unsigned char>(p[pos] - '0') <= 9)
+        {
+            ++pos;
+        }
+        return pos;
     }
 
     // Fast, no-throw decimal parser for non-negative integers.
@@ -107,71 +215,72 @@ namespace sio
 
     void accept_int_message(int_message const &msg, string &json_str)
     {
-        json_str += to_string(msg.get_int());
+        append_number(json_str, msg.get_int());
     }
 
     void accept_double_message(double_message const &msg, string &json_str)
     {
-        ostringstream ss;
-        ss.precision(15);
-        ss << msg.get_double();
-        json_str += ss.str();
+        append_double(json_str, msg.get_double());
     }
 
     void accept_string_message(string_message const &msg, string &json_str)
     {
-        json_str += "\"";
-        json_str += escape_json_string(msg.get_string());
-        json_str += "\"";
+        json_str += '"';
+        append_escaped(json_str, msg.get_string_view());
+        json_str += '"';
     }
 
     void accept_binary_message(binary_message const &msg, string &json_str, vector<shared_ptr<const string>> &buffers)
     {
         json_str += "{\"" kBIN_PLACE_HOLDER "\":true,\"num\":";
-        json_str += to_string(buffers.size());
-        json_str += "}";
+        append_number(json_str, buffers.size());
+        json_str += '}';
         buffers.push_back(msg.get_binary());
     }
 
     void accept_array_message(array_message const &msg, string &json_str, vector<shared_ptr<const string>> &buffers)
     {
-        // Heuristic to reduce reallocations during array serialization
-        if (!msg.get_vector().empty())
-        {
-            json_str.reserve(json_str.size() + msg.get_vector().size() * 8);
-        }
-        json_str += "[";
+        json_str += '[';
         bool first = true;
         for (vector<message::ptr>::const_iterator it = msg.get_vector().begin(); it != msg.get_vector().end(); ++it)
         {
             if (!first)
-                json_str += ",";
+                json_str += ',';
             first = false;
             accept_message(*(*it), json_str, buffers, false);
         }
-        json_str += "]";
+        json_str += ']';
     }
 
-    void accept_object_message(object_message const &msg, string &json_str, vector<shared_ptr<const string>> &buffers)
+    template <typename It>
+    void accept_object_fields(It begin, It end, string &json_str, vector<shared_ptr<const string>> &buffers)
     {
-        // Heuristic reserve: assume average 16 bytes per field (key+value delimiters)
-        if (!msg.get_map().empty())
-        {
-            json_str.reserve(json_str.size() + msg.get_map().size() * 16);
-        }
-        json_str += "{";
+        json_str += '{';
         bool first = true;
-        for (map<string, message::ptr>::const_iterator it = msg.get_map().begin(); it != msg.get_map().end(); ++it)
+        for (It it = begin; it != end; ++it)
         {
             if (!first)
-                json_str += ",";
+                json_str += ',';
             first = false;
-            json_str += "\"";
-            json_str += escape_json_string(it->first);
+            json_str += '"';
+            append_escaped(json_str, it->first);
             json_str += "\":";
             accept_message(*(it->second), json_str, buffers, false);
         }
-        json_str += "}";
+        json_str += '}';
+    }
+
+    void accept_object_message(object_message const &msg, string &json_str, vector<shared_ptr<const string>> &buffers)
+    {
+        // Ordered objects are written in insertion order, so decoded objects re-encode byte for byte.
+        if (msg.is_ordered())
+        {
+            accept_object_fields(msg.get_fields().begin(), msg.get_fields().end(), json_str, buffers);
+        }
+        else
+        {
+            accept_object_fields(msg.get_map().begin(), msg.get_map().end(), json_str, buffers);
+        }
     }
 
     void accept_message(message const &msg, string &json_str, vector<shared_ptr<const string>> &buffers, bool is_first)
@@ -208,8 +317,62 @@ namespace sio
         }
     }
 
-    // Parse JSON using simdjson DOM API
-    message::ptr from_json(simdjson::dom::element const &value, vector<shared_ptr<const string>> const &buffers)
+    template <typename It>
+    size_t estimate_object_fields(It begin, It end);
+
+    // Upper-bound-ish encoded size of msg without encoding it; attachments count in full.
+    size_t estimate_message_size(message const &msg)
+    {
+        switch (msg.get_flag())
+        {
+        case message::flag_integer:
+        case message::flag_double:
+            return 24;
+        case message::flag_string:
+            return msg.get_string_view().size() + 2;
+        case message::flag_boolean:
+        case message::flag_null:
+            return 5;
+        case message::flag_binary:
+            return 32 + (msg.get_binary() ? msg.get_binary()->size() : 0);
+        case message::flag_array:
+        {
+            size_t size = 2;
+            for (message::ptr const &child : msg.get_vector())
+            {
+                size += (child ? estimate_message_size(*child) : 4) + 1;
+            }
+            return size;
+        }
+        case message::flag_object:
+        {
+            object_message const &obj = static_cast<object_message const &>(msg);
+            if (obj.is_ordered())
+            {
+                return estimate_object_fields(obj.get_fields().begin(), obj.get_fields().end());
+            }
+            return estimate_object_fields(obj.get_map().begin(), obj.get_map().end());
+        }
+        default:
+            return 0;
+        }
+    }
+
+    template <typename It>
+    size_t estimate_object_fields(It begin, It end)
+    {
+        size_t size = 2;
+        for (It it = begin; it != end; ++it)
+        {
+            size += it->first.size() + 4 + (it->second ? estimate_message_size(*(it->second)) : 4);
+        }
+        return size;
+    }
+
+    // Parse JSON using simdjson DOM API.
+    // With an arena (the document owning value), strings are created as views into it.
+    message::ptr from_json(simdjson::dom::element const &value, vector<shared_ptr<const string>> const &buffers,
+                           shared_ptr<const void> const &arena = shared_ptr<const void>())
     {
         try
         {
@@ -228,6 +391,10 @@ namespace sio
             else if (value.is_string())
             {
                 string_view sv = value.get_string();
+                if (arena)
+                {
+                    return string_message::create_view(sv, arena);
+                }
                 string str(sv.data(), sv.length());
                 return string_message::create(std::move(str));
             }
@@ -240,7 +407,7 @@ namespace sio
                 vec->reserve(vec->size() + 8);
                 for (auto child : arr)
                 {
-                    vec->push_back(from_json(child, buffers));
+                    vec->push_back(from_json(child, buffers, arena));
                 }
                 return ptr;
             }
@@ -270,12 +437,12 @@ namespace sio
                 // Real object message
                 message::ptr ptr = object_message::create();
                 {
-                    auto &mp = static_cast<object_message *>(ptr.get())->get_map();
+                    auto *fields = static_cast<object_message *>(ptr.get());
                     for (auto field : obj)
                     {
                         string_view key_sv = field.key;
                         string key(key_sv.data(), key_sv.length());
-                        mp.emplace(std::move(key), from_json(field.value, buffers));
+                        fields->append(std::move(key), from_json(field.value, buffers, arena));
                     }
                 }
                 return ptr;
@@ -301,7 +468,8 @@ namespace sio
                                                                                           _nsp(nsp),
                                                                                           _pack_id(pack_id),
                                                                                           _message(msg),
-                                                                                          _pending_buffers(0)
+                                                                                          _pending_buffers(0),
+                                                                                          _json_pos(0)
     {
         assert((!isAck || (isAck && pack_id >= 0)));
     }
@@ -311,20 +479,33 @@ namespace sio
                                                                             _nsp(nsp),
                                                                             _pack_id(-1),
                                                                             _message(msg),
-                                                                            _pending_buffers(0)
+                                                                            _pending_buffers(0),
+                                                                            _json_pos(0)
+    {
+    }
+
+    packet::packet(string const &nsp, encoded_packet::ptr const &encoded, int pack_id) : _frame(frame_message),
+                                                                                         _type(type_event),
+                                                                                         _nsp(nsp),
+                                                                                         _pack_id(pack_id),
+                                                                                         _encoded(encoded),
+                                                                                         _pending_buffers(0),
+                                                                                         _json_pos(0)
     {
     }
 
     packet::packet(packet::frame_type frame) : _frame(frame),
                                                _type(type_undetermined),
                                                _pack_id(-1),
-                                               _pending_buffers(0)
+                                               _pending_buffers(0),
+                                               _json_pos(0)
     {
     }
 
     packet::packet() : _type(type_undetermined),
                        _pack_id(-1),
-                       _pending_buffers(0)
+                       _pending_buffers(0),
+                       _json_pos(0)
     {
     }
 
@@ -338,6 +519,17 @@ namespace sio
         return payload_ptr.size() > 0 && payload_ptr[0] == (frame_message + '0');
     }
 
+    bool packet::is_msgpack_message(string const &payload_ptr)
+    {
+        // A packet is always a map; engine.io text frames start with a digit.
+        if (payload_ptr.empty())
+        {
+            return false;
+        }
+        unsigned char tag = static_cast<unsigned char>(payload_ptr[0]);
+        return (tag & 0xf0) == 0x80 || tag == 0xde || tag == 0xdf;
+    }
+
     bool packet::is_message(string const &payload_ptr)
     {
         return is_binary_message(payload_ptr) || is_text_message(payload_ptr);
@@ -346,319 +538,1210 @@ namespace sio
     // Reuse a thread-local simdjson parser to avoid per-call allocations
     static thread_local simdjson::dom::parser s_dom_parser;
 
-    bool packet::parse_buffer(const string &buf_payload)
+    // Per-packet arena for zero-copy decoding: a simdjson document whose string
+    // buffer backs the string_message views of one packet. Documents are recycled
+    // once the last view is released, so steady-state decoding reuses their storage.
+    class arena_pool
     {
-        if (_pending_buffers > 0)
+    public:
+        static arena_pool &instance()
         {
-            assert(is_binary_message(buf_payload)); // this is ensured by outside.
-            _buffers.push_back(std::make_shared<string>(buf_payload.data(), buf_payload.size()));
-            _pending_buffers--;
-            if (_pending_buffers == 0)
-            {
-                // Parse using simdjson
-                simdjson::dom::element doc;
-                auto error = s_dom_parser.parse(_buffers.front()->data(), _buffers.front()->size()).get(doc);
-                _buffers.erase(_buffers.begin());
-
-                if (error == simdjson::SUCCESS)
-                {
-                    _message = from_json(doc, _buffers);
-                }
-                _buffers.clear();
-                return false;
-            }
-            return true;
+            // Intentionally leaked: arenas may be released during static destruction.
+            static arena_pool *s_pool = new arena_pool();
+            return *s_pool;
         }
-        return false;
-    }
-
-    bool packet::parse(const string &payload_ptr)
-    {
-        assert(!is_binary_message(payload_ptr)); // this is ensured by outside
-        _frame = (packet::frame_type)(payload_ptr[0] - '0');
-        _message.reset();
-        _pack_id = -1;
-        _buffers.clear();
-        _pending_buffers = 0;
-        size_t pos = 1;
 
-        if (_frame == frame_message)
+        shared_ptr<simdjson::dom::document> acquire(size_t len)
         {
-            _type = (packet::type)(payload_ptr[pos] - '0');
-            if (_type < type_min || _type > type_max)
-            {
-                return false;
-            }
-            pos++;
-            if (_type == type_binary_event || _type == type_binary_ack)
+            unique_ptr<arena> a;
             {
-                size_t score_pos = payload_ptr.find('-');
-                if (score_pos == string::npos || score_pos <= pos)
-                {
-                    return false;
-                }
-                unsigned pending = 0;
-                if (!parse_unsigned_decimal(payload_ptr.data() + pos, score_pos - pos, pending))
+                lock_guard<mutex> guard(m_mutex);
+                if (!m_free.empty())
                 {
-                    return false;
+                    a = std::move(m_free.back());
+                    m_free.pop_back();
                 }
-                _pending_buffers = pending;
-                pos = score_pos + 1;
-            }
-        }
-
-        size_t nsp_json_pos = payload_ptr.find_first_of("{[\"/", pos, 4);
-        if (nsp_json_pos == string::npos)
-        { // no namespace and no message, the end.
-            _nsp = "/";
-            return false;
-        }
-
-        size_t json_pos = nsp_json_pos;
-        if (payload_ptr[nsp_json_pos] == '/')
-        {                                                      // nsp_json_pos is start of nsp
-            size_t comma_pos = payload_ptr.find_first_of(","); // end of nsp
-            if (comma_pos == string::npos)
-            { // packet end with nsp
-                _nsp = payload_ptr.substr(nsp_json_pos);
-                return false;
             }
-            else
-            { // we have a message, maybe the message have an id.
-                _nsp = payload_ptr.substr(nsp_json_pos, comma_pos - nsp_json_pos);
-                pos = comma_pos + 1;                                  // start of the message
-                json_pos = payload_ptr.find_first_of("\"[{", pos, 3); // start of the json part of message
-                if (json_pos == string::npos)
-                {
-                    // no message, the end
-                    // assume if there's no message, there's no message id.
-                    return false;
-                }
+            if (!a)
+            {
+                a.reset(new arena());
             }
+            a->high_water = std::max(a->high_water, len);
+            simdjson::dom::document *doc = &a->doc;
+            return shared_ptr<simdjson::dom::document>(doc, [this, a = a.release()](simdjson::dom::document *) { release(a); });
         }
-        else
+
+    private:
+        struct arena
         {
-            _nsp = "/";
-        }
+            simdjson::dom::document doc;
+            size_t high_water = 0;
+        };
 
-        if (pos < json_pos)
-        { // we've got pack id.
-            unsigned pid = 0;
-            if (parse_unsigned_decimal(payload_ptr.data() + pos, json_pos - pos, pid))
+        void release(arena *a)
+        {
+            unique_ptr<arena> owned(a);
+            if (owned->high_water > k_max_cached_bytes)
             {
-                _pack_id = static_cast<int>(pid);
+                return; // don't pin memory of an occasional huge payload
             }
-            else
+            lock_guard<mutex> guard(m_mutex);
+            if (m_free.size() < k_max_cached)
             {
-                _pack_id = -1;
+                m_free.push_back(std::move(owned));
             }
         }
 
-        if (_frame == frame_message && (_type == type_binary_event || _type == type_binary_ack))
-        {
-            // parse later when all buffers are arrived.
-            _buffers.reserve(1 + _pending_buffers);
-            _buffers.push_back(make_shared<string>(payload_ptr.data() + json_pos, payload_ptr.length() - json_pos));
-            return true;
-        }
-        else
-        {
-            // Parse using simdjson
-            simdjson::dom::element doc;
-            auto error = s_dom_parser.parse(payload_ptr.data() + json_pos, payload_ptr.length() - json_pos).get(doc);
+        static const size_t k_max_cached = 32;
+        static const size_t k_max_cached_bytes = 1024 * 1024;
 
-            if (error == simdjson::SUCCESS)
-            {
-                _message = from_json(doc, vector<shared_ptr<const string>>());
-            }
-            return false;
-        }
-    }
+        mutex m_mutex;
+        vector<unique_ptr<arena>> m_free;
+    };
 
-    bool packet::accept(string &payload_ptr, vector<shared_ptr<const string>> &buffers)
+    // simdjson reads up to SIMDJSON_PADDING bytes past the input; only copy the
+    // input into a padded buffer when the string's spare capacity doesn't cover that.
+    inline bool needs_padding_copy(string const &payload, size_t json_pos)
     {
-        char frame_char = _frame + '0';
-        payload_ptr.append(&frame_char, 1);
-
-        if (_frame != frame_message)
-        {
-            return false;
-        }
-
-        bool hasMessage = false;
-        string json_str;
-        json_str.reserve(256); // small heuristic to reduce early reallocations
-
-        if (_message)
-        {
-            accept_message(*_message, json_str, buffers, true);
-            hasMessage = true;
-        }
-
-        bool hasBinary = buffers.size() > 0;
-        _type = _type & (~type_undetermined);
-
-        if (_type == type_event)
-        {
-            _type = hasBinary ? type_binary_event : type_event;
-        }
-        else if (_type == type_ack)
-        {
-            _type = hasBinary ? type_binary_ack : type_ack;
-        }
-
-        ostringstream ss;
-        ss.precision(8);
-        ss << _type;
-
-        if (hasBinary)
-        {
-            ss << buffers.size() << "-";
-        }
+        return json_pos > payload.size() || payload.capacity() - payload.size() < simdjson::SIMDJSON_PADDING;
+    }
 
-        if (_nsp.size() > 0 && _nsp != "/")
+    // Decode the JSON part of payload starting at json_pos into a message tree.
+    message::ptr decode_json(string const &payload, size_t json_pos, vector<shared_ptr<const string>> const &buffers,
+                             decode_options const &options)
+    {
+        const char *json = payload.data() + json_pos;
+        size_t json_len = payload.size() - json_pos;
+        bool realloc = needs_padding_copy(payload, json_pos);
+        simdjson::dom::element doc;
+        if (options.zero_copy)
         {
-            ss << _nsp;
-            if (hasMessage || _pack_id >= 0)
+            shared_ptr<simdjson::dom::document> arena = arena_pool::instance().acquire(json_len);
+            if (s_dom_parser.parse_into_document(*arena, json, json_len, realloc).get(doc) == simdjson::SUCCESS)
             {
-                ss << ",";
+                return from_json(doc, buffers, arena);
             }
         }
-
-        if (_pack_id >= 0)
-        {
-            ss << _pack_id;
-        }
-
-        // Reserve final payload size before appending to minimize reallocations
-        string meta = ss.str();
-        size_t expected_extra = meta.size() + (hasMessage ? json_str.size() : 0);
-        payload_ptr.reserve(payload_ptr.size() + expected_extra + 1);
-        payload_ptr.append(meta);
-
-        if (hasMessage)
+        else if (s_dom_parser.parse(json, json_len, realloc).get(doc) == simdjson::SUCCESS)
         {
-            payload_ptr.append(json_str);
+            return from_json(doc, buffers);
         }
-
-        return hasBinary;
-    }
-
-    packet::frame_type packet::get_frame() const
-    {
-        return _frame;
-    }
-
-    packet::type packet::get_type() const
-    {
-        assert((_type & type_undetermined) == 0);
-        return (type)_type;
-    }
-
-    string const &packet::get_nsp() const
-    {
-        return _nsp;
-    }
-
-    message::ptr const &packet::get_message() const
-    {
-        return _message;
-    }
-
-    unsigned packet::get_pack_id() const
-    {
-        return _pack_id;
+        return message::ptr();
     }
 
-    void packet_manager::set_decode_callback(function<void(packet const &)> const &decode_callback)
-    {
-        m_decode_callback = decode_callback;
-    }
+    // Reuse a thread-local On-Demand parser for lazy field access.
+    static thread_local simdjson::ondemand::parser s_ondemand_parser;
 
-    void packet_manager::set_encode_callback(function<void(bool, shared_ptr<const string> const &)> const &encode_callback)
+    // Start an On-Demand iteration over the JSON part of payload. scratch only
+    // receives a padded copy when the payload itself lacks simdjson's padding.
+    simdjson::error_code iterate_json(string const &payload, size_t json_pos, simdjson::padded_string &scratch,
+                                      simdjson::ondemand::document &doc)
     {
-        m_encode_callback = encode_callback;
+        string_view json(payload.data() + json_pos, payload.size() - json_pos);
+        if (needs_padding_copy(payload, json_pos))
+        {
+            scratch = simdjson::padded_string(json);
+            return s_ondemand_parser.iterate(scratch).get(doc);
+        }
+        return s_ondemand_parser.iterate(json, payload.capacity() - json_pos).get(doc);
     }
 
-    void packet_manager::reset()
+    // Copy the JSON part of a borrowed payload, leaving room for simdjson's padding.
+    shared_ptr<const string> copy_json(string const &payload, size_t json_pos)
     {
-        m_partial_packet.reset();
+        shared_ptr<string> copy = make_shared<string>();
+        copy->reserve(payload.size() - json_pos + simdjson::SIMDJSON_PADDING);
+        copy->append(payload, json_pos, string::npos);
+        return copy;
     }
 
-    void packet_manager::encode(packet &pack, encode_callback_function const &override_encode_callback) const
+    // Build a message tree from a single On-Demand value, consuming it.
+    message::ptr from_ondemand(simdjson::ondemand::value value, vector<shared_ptr<const string>> const &buffers)
     {
-        shared_ptr<string> ptr = make_shared<string>();
-        ptr->reserve(512); // heuristic reserve to reduce small-buffer churn
-        vector<shared_ptr<const string>> buffers;
-        buffers.reserve(4);
-        const encode_callback_function *cb_ptr = &m_encode_callback;
-
-        if (override_encode_callback)
+        simdjson::ondemand::json_type type;
+        if (value.type().get(type) != simdjson::SUCCESS)
         {
-            cb_ptr = &override_encode_callback;
+            return message::ptr();
         }
-
-        if (pack.accept(*ptr, buffers))
+        switch (type)
+        {
+        case simdjson::ondemand::json_type::number:
         {
-            if ((*cb_ptr))
+            simdjson::ondemand::number num;
+            if (value.get_number().get(num) != simdjson::SUCCESS)
             {
-                (*cb_ptr)(false, ptr);
+                return message::ptr();
             }
-            for (auto it = buffers.begin(); it != buffers.end(); ++it)
+            if (num.is_int64())
             {
-                if ((*cb_ptr))
-                {
-                    (*cb_ptr)(true, *it);
-                }
+                return int_message::create(num.get_int64());
             }
+            else if (num.is_uint64())
+            {
+                return int_message::create(int64_t(num.get_uint64()));
+            }
+            return double_message::create(num.get_double());
         }
-        else
+        case simdjson::ondemand::json_type::string:
         {
-            if ((*cb_ptr))
+            string_view sv;
+            if (value.get_string().get(sv) != simdjson::SUCCESS)
             {
-                (*cb_ptr)(false, ptr);
+                return message::ptr();
             }
+            return string_message::create(string(sv.data(), sv.length()));
         }
-    }
+        case simdjson::ondemand::json_type::boolean:
+        {
+            bool b = false;
+            if (value.get_bool().get(b) != simdjson::SUCCESS)
+            {
+                return message::ptr();
+            }
+            return bool_message::create(b);
+        }
+        case simdjson::ondemand::json_type::null:
+            return null_message::create();
+        case simdjson::ondemand::json_type::array:
+        {
+            simdjson::ondemand::array arr;
+            if (value.get_array().get(arr) != simdjson::SUCCESS)
+            {
+                return message::ptr();
+            }
+            message::ptr ptr = array_message::create();
+            auto &vec = static_cast<array_message *>(ptr.get())->get_vector();
+            for (auto child : arr)
+            {
+                simdjson::ondemand::value child_value;
+                if (child.get(child_value) != simdjson::SUCCESS)
+                {
+                    return message::ptr();
+                }
+                vec.push_back(from_ondemand(child_value, buffers));
+            }
+            return ptr;
+        }
+        case simdjson::ondemand::json_type::object:
+        {
+            simdjson::ondemand::object obj;
+            if (value.get_object().get(obj) != simdjson::SUCCESS)
+            {
+                return message::ptr();
+            }
+            message::ptr ptr = object_message::create();
+            auto *fields = static_cast<object_message *>(ptr.get());
+            for (auto field : obj)
+            {
+                string_view key_sv;
+                if (field.unescaped_key().get(key_sv) != simdjson::SUCCESS)
+                {
+                    return message::ptr();
+                }
+                string key(key_sv.data(), key_sv.length());
+                fields->append(std::move(key), from_ondemand(field.value(), buffers));
+            }
+            // Same binary placeholder rules as from_json.
+            message::ptr const &placeholder = fields->at(kBIN_PLACE_HOLDER);
+            if (placeholder && placeholder->get_flag() == message::flag_boolean && placeholder->get_bool())
+            {
+                message::ptr const &num = fields->at("num");
+                if (num && num->get_flag() == message::flag_integer)
+                {
+                    int64_t index = num->get_int();
+                    if (index >= 0 && index < static_cast<int64_t>(buffers.size()))
+                    {
+                        return binary_message::create(buffers[index]);
+                    }
+                }
+                return message::ptr();
+            }
+            return ptr;
+        }
+        default:
+            break;
+        }
+        return message::ptr();
+    }
+
+    message::ptr find_json_pointer(message::ptr const &root, string_view pointer)
+    {
+        message::ptr current = root;
+        while (current && !pointer.empty())
+        {
+            if (pointer[0] != '/')
+            {
+                return message::ptr();
+            }
+            size_t end = pointer.find('/', 1);
+            string_view token = pointer.substr(1, end == string_view::npos ? string_view::npos : end - 1);
+            pointer = end == string_view::npos ? string_view() : pointer.substr(end);
+            if (current->get_flag() == message::flag_array)
+            {
+                unsigned index = 0;
+                auto const &vec = current->get_vector();
+                if ((token.size() > 1 && token[0] == '0') ||
+                    !parse_unsigned_decimal(token.data(), token.size(), index) || index >= vec.size())
+                {
+                    return message::ptr();
+                }
+                current = vec[index];
+            }
+            else if (current->get_flag() == message::flag_object)
+            {
+                string key;
+                key.reserve(token.size());
+                for (size_t i = 0; i < token.size(); ++i)
+                {
+                    if (token[i] == '~' && i + 1 < token.size() && (token[i + 1] == '0' || token[i + 1] == '1'))
+                    {
+                        key.push_back(token[++i] == '0' ? '~' : '/');
+                    }
+                    else
+                    {
+                        key.push_back(token[i]);
+                    }
+                }
+                message::ptr const &value = static_cast<object_message const *>(current.get())->at(key);
+                if (!value)
+                {
+                    return message::ptr();
+                }
+                current = value;
+            }
+            else
+            {
+                return message::ptr();
+            }
+        }
+        return current;
+    }
+
+    bool packet::parse_buffer(const string &buf_payload)
+    {
+        if (_pending_buffers > 0)
+        {
+            return parse_buffer(std::make_shared<const string>(buf_payload.data(), buf_payload.size()));
+        }
+        return false;
+    }
+
+    bool packet::parse_buffer(shared_ptr<const string> const &buf_payload)
+    {
+        if (_pending_buffers > 0)
+        {
+            assert(is_binary_message(*buf_payload)); // this is ensured by outside.
+            _buffers.push_back(buf_payload);
+            _pending_buffers--;
+            if (_pending_buffers == 0)
+            {
+                if (_options.lazy && _type == type_binary_event)
+                {
+                    return false; // decoded on first get_message()
+                }
+                _message = decode_json(*_payload, _json_pos, _buffers, _options);
+                _payload.reset();
+                _buffers.clear();
+                return false;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    bool packet::parse(const string &payload_ptr, decode_options const &options)
+    {
+        _options = options;
+        return parse_impl(payload_ptr, shared_ptr<const string>());
+    }
+
+    bool packet::parse(shared_ptr<const string> const &payload_ptr, decode_options const &options)
+    {
+        _options = options;
+        return parse_impl(*payload_ptr, payload_ptr);
+    }
+
+    bool packet::parse_impl(const string &payload_ptr, shared_ptr<const string> const &owner)
+    {
+        assert(!is_binary_message(payload_ptr)); // this is ensured by outside
+        _frame = (packet::frame_type)(payload_ptr[0] - '0');
+        _message.reset();
+        _pack_id = -1;
+        _buffers.clear();
+        _payload.reset();
+        _json_pos = 0;
+        _pending_buffers = 0;
+        _nsp = "/";
+
+        // One left-to-right pass over the header, which stops at the first JSON byte:
+        //   <frame>[<type>[<attachments>-][<nsp>,][<ack id>]]<json>
+        // Nothing past the header is scanned, however large the JSON is.
+        const char *data = payload_ptr.data();
+        size_t size = payload_ptr.size();
+        size_t pos = 1;
+        if (_frame == frame_message)
+        {
+            _type = (packet::type)(pos < size ? data[pos] - '0' : -1);
+            if (_type < type_min || _type > type_max)
+            {
+                return false;
+            }
+            pos++;
+            if (_type == type_binary_event || _type == type_binary_ack)
+            {
+                size_t count_pos = pos;
+                pos = skip_digits(data, pos, size);
+                unsigned pending = 0;
+                if (pos == size || data[pos] != '-' || !parse_unsigned_decimal(data + count_pos, pos - count_pos, pending))
+                {
+                    return false;
+                }
+                _pending_buffers = pending;
+                pos++;
+            }
+            if (pos < size && data[pos] == '/')
+            {
+                const char *comma = static_cast<const char *>(memchr(data + pos, ',', size - pos));
+                if (comma == nullptr)
+                { // packet ends with the namespace
+                    _nsp.assign(data + pos, size - pos);
+                    return false;
+                }
+                _nsp.assign(data + pos, comma - (data + pos));
+                pos = comma - data + 1;
+            }
+            size_t id_pos = pos;
+            pos = skip_digits(data, pos, size);
+            unsigned pid = 0;
+            if (pos > id_pos && parse_unsigned_decimal(data + id_pos, pos - id_pos, pid))
+            {
+                _pack_id = static_cast<int>(pid);
+            }
+        }
+
+        if (pos == size || (data[pos] != '[' && data[pos] != '{' && data[pos] != '"'))
+        {
+            // no message, the end.
+            return false;
+        }
+        size_t json_pos = pos;
+
+        bool binary = _frame == frame_message && (_type == type_binary_event || _type == type_binary_ack);
+        bool deferred = _options.lazy && _frame == frame_message && (_type == type_event || _type == type_binary_event);
+        if (binary || deferred)
+        {
+            if (owner)
+            {
+                // Keep the frame alive instead of copying its JSON part.
+                _payload = owner;
+                _json_pos = json_pos;
+            }
+            else
+            {
+                _payload = copy_json(payload_ptr, json_pos);
+            }
+            if (!binary)
+            {
+                return false; // decoded on first get_message()
+            }
+            // parse later when all buffers are arrived.
+            _buffers.reserve(_pending_buffers);
+            return true;
+        }
+        else
+        {
+            _message = decode_json(payload_ptr, json_pos, vector<shared_ptr<const string>>(), _options);
+            return false;
+        }
+    }
+
+    bool packet::accept(string &payload_ptr, vector<shared_ptr<const string>> &buffers)
+    {
+        char frame_char = _frame + '0';
+        payload_ptr.append(&frame_char, 1);
+
+        if (_frame != frame_message)
+        {
+            return false;
+        }
+
+        // Header and JSON are written in one pass straight into payload_ptr. Whether
+        // the packet is binary is only known once the message has been walked, so the
+        // type digit is patched and the attachment count inserted afterwards.
+        size_t type_pos = payload_ptr.size();
+        payload_ptr += '0';
+
+        bool hasMessage = _message || _encoded;
+        if (_nsp.size() > 0 && _nsp != "/")
+        {
+            payload_ptr.append(_nsp);
+            if (hasMessage || _pack_id >= 0)
+            {
+                payload_ptr += ',';
+            }
+        }
+
+        if (_pack_id >= 0)
+        {
+            append_number(payload_ptr, _pack_id);
+        }
+
+        if (_message)
+        {
+            accept_message(*_message, payload_ptr, buffers, true);
+        }
+        else if (_encoded)
+        {
+            payload_ptr.append(_encoded->get_json());
+            buffers.insert(buffers.end(), _encoded->get_buffers().begin(), _encoded->get_buffers().end());
+        }
+
+        bool hasBinary = buffers.size() > 0;
+        _type = _type & (~type_undetermined);
+
+        if (_type == type_event)
+        {
+            _type = hasBinary ? type_binary_event : type_event;
+        }
+        else if (_type == type_ack)
+        {
+            _type = hasBinary ? type_binary_ack : type_ack;
+        }
+
+        payload_ptr[type_pos] = static_cast<char>('0' + _type);
+
+        if (hasBinary)
+        {
+            char count[24];
+            to_chars_result res = to_chars(count, count + sizeof(count) - 1, buffers.size());
+            *res.ptr++ = '-';
+            payload_ptr.insert(type_pos + 1, count, res.ptr - count);
+        }
+
+        return hasBinary;
+    }
+
+    void packet::accept_msgpack(string &payload)
+    {
+        // {type, nsp, data, id}; binary types don't exist, attachments travel inline.
+        _type = _type & (~type_undetermined);
+        if (_type == type_binary_event)
+        {
+            _type = type_event;
+        }
+        else if (_type == type_binary_ack)
+        {
+            _type = type_ack;
+        }
+        message::ptr data = _message;
+        if (!data && _encoded)
+        {
+            // Pre-encoded events hold JSON; this format has to rebuild the tree on every send.
+            data = decode_json(_encoded->get_json(), 0, _encoded->get_buffers(), decode_options());
+        }
+        msgpack::write_map_header(payload, 2 + (data ? 1 : 0) + (_pack_id >= 0 ? 1 : 0));
+        msgpack::write_string(payload, "type");
+        msgpack::write_int(payload, _type);
+        msgpack::write_string(payload, "nsp");
+        msgpack::write_string(payload, _nsp.empty() ? string_view("/") : string_view(_nsp));
+        if (data)
+        {
+            msgpack::write_string(payload, "data");
+            msgpack::write_message(*data, payload);
+        }
+        if (_pack_id >= 0)
+        {
+            msgpack::write_string(payload, "id");
+            msgpack::write_int(payload, _pack_id);
+        }
+    }
+
+    bool packet::parse_msgpack(shared_ptr<const string> const &payload, decode_options const &options)
+    {
+        _frame = frame_message;
+        _type = type_undetermined;
+        _nsp = "/";
+        _message.reset();
+        _pack_id = -1;
+        _buffers.clear();
+        _payload.reset();
+        _json_pos = 0;
+        _pending_buffers = 0;
+        _options = options;
+
+        bool owned = payload.use_count() > 0;
+        shared_ptr<const void> view_owner;
+        if (options.zero_copy && owned)
+        {
+            view_owner = payload;
+        }
+        msgpack::reader in(payload->data(), payload->size(), view_owner);
+        size_t fields;
+        if (!in.read_map_header(fields))
+        {
+            return false;
+        }
+        int64_t type = -1;
+        for (size_t i = 0; i < fields; ++i)
+        {
+            string_view key;
+            if (!in.read_string(key))
+            {
+                return false;
+            }
+            if (key == "type")
+            {
+                if (!in.read_int(type))
+                {
+                    return false;
+                }
+            }
+            else if (key == "nsp")
+            {
+                string_view nsp;
+                if (!in.read_string(nsp))
+                {
+                    return false;
+                }
+                _nsp.assign(nsp.data(), nsp.size());
+            }
+            else if (key == "id")
+            {
+                int64_t id = -1;
+                if (!in.read_int(id) || id < 0 || id > INT_MAX)
+                {
+                    return false;
+                }
+                _pack_id = static_cast<int>(id);
+            }
+            else
+            {
+                message::ptr value = in.read_message(0);
+                if (!value)
+                {
+                    return false;
+                }
+                if (key == "data")
+                {
+                    _message = std::move(value);
+                }
+            }
+        }
+        if (!in.at_end() || type < type_min || type > type_max)
+        {
+            return false;
+        }
+        _type = static_cast<int>(type);
+        // Events and acks carry an argument array, errors a reason.
+        switch (_type)
+        {
+        case type_event:
+        case type_binary_event:
+        case type_ack:
+        case type_binary_ack:
+            return _message && _message->get_flag() == message::flag_array;
+        case type_error:
+            return static_cast<bool>(_message);
+        default:
+            return true;
+        }
+    }
+
+    packet::frame_type packet::get_frame() const
+    {
+        return _frame;
+    }
+
+    packet::type packet::get_type() const
+    {
+        assert((_type & type_undetermined) == 0);
+        return (type)_type;
+    }
+
+    string const &packet::get_nsp() const
+    {
+        return _nsp;
+    }
+
+    message::ptr const &packet::get_message() const
+    {
+        if (!_message && _payload && _options.lazy && _pending_buffers == 0)
+        {
+            _message = decode_json(*_payload, _json_pos, _buffers, _options);
+        }
+        return _message;
+    }
+
+    string_view packet::get_raw_json() const
+    {
+        if (!_payload || _pending_buffers > 0)
+        {
+            return string_view();
+        }
+        return string_view(_payload->data() + _json_pos, _payload->size() - _json_pos);
+    }
+
+    bool packet::get_event_name(string &name) const
+    {
+        if (!_message && _payload && _pending_buffers == 0)
+        {
+            // Only the leading string is iterated; the arguments are skipped.
+            simdjson::padded_string scratch;
+            simdjson::ondemand::document doc;
+            simdjson::ondemand::array arr;
+            if (iterate_json(*_payload, _json_pos, scratch, doc) != simdjson::SUCCESS ||
+                doc.get_array().get(arr) != simdjson::SUCCESS)
+            {
+                return false;
+            }
+            for (auto first : arr)
+            {
+                string_view sv;
+                if (first.get_string().get(sv) != simdjson::SUCCESS)
+                {
+                    return false;
+                }
+                name.assign(sv.data(), sv.length());
+                return true;
+            }
+            return false;
+        }
+        message::ptr const &msg = get_message();
+        if (msg && msg->get_flag() == message::flag_array && msg->get_vector().size() >= 1 &&
+            msg->get_vector()[0] && msg->get_vector()[0]->get_flag() == message::flag_string)
+        {
+            name = msg->get_vector()[0]->get_string();
+            return true;
+        }
+        return false;
+    }
+
+    bool packet::get_trailing_string(string &value) const
+    {
+        if (!_message && _payload && _pending_buffers == 0)
+        {
+            simdjson::padded_string scratch;
+            simdjson::ondemand::document doc;
+            simdjson::ondemand::array arr;
+            if (iterate_json(*_payload, _json_pos, scratch, doc) != simdjson::SUCCESS ||
+                doc.get_array().get(arr) != simdjson::SUCCESS)
+            {
+                return false;
+            }
+            // Views stay valid in the document's string buffer until it is dropped.
+            string_view last;
+            bool is_string = false;
+            size_t i = 0;
+            for (auto element : arr)
+            {
+                simdjson::ondemand::json_type type;
+                if (element.type().get(type) != simdjson::SUCCESS)
+                {
+                    return false;
+                }
+                is_string = i++ > 0 && type == simdjson::ondemand::json_type::string && element.get_string().get(last) == simdjson::SUCCESS;
+            }
+            if (is_string)
+            {
+                value.assign(last.data(), last.length());
+            }
+            return is_string;
+        }
+        message::ptr const &msg = get_message();
+        if (!msg || msg->get_flag() != message::flag_array || msg->get_vector().size() < 2)
+        {
+            return false;
+        }
+        message::ptr const &last = msg->get_vector().back();
+        if (!last || last->get_flag() != message::flag_string)
+        {
+            return false;
+        }
+        value = last->get_string();
+        return true;
+    }
+
+    message::ptr packet::get_field(string_view pointer) const
+    {
+        if (!_message && _payload && _pending_buffers == 0)
+        {
+            simdjson::padded_string scratch;
+            simdjson::ondemand::document doc;
+            simdjson::ondemand::value value;
+            if (iterate_json(*_payload, _json_pos, scratch, doc) != simdjson::SUCCESS ||
+                doc.at_pointer(pointer).get(value) != simdjson::SUCCESS)
+            {
+                return message::ptr();
+            }
+            return from_ondemand(value, _buffers);
+        }
+        return find_json_pointer(get_message(), pointer);
+    }
+
+    bool packet::read_element(size_t index, bool (*read)(json_value &value, void *ctx), void *ctx) const
+    {
+        if (!_message && _payload && _pending_buffers == 0)
+        {
+            simdjson::padded_string scratch;
+            simdjson::ondemand::document doc;
+            simdjson::ondemand::array arr;
+            if (iterate_json(*_payload, _json_pos, scratch, doc) != simdjson::SUCCESS ||
+                doc.get_array().get(arr) != simdjson::SUCCESS)
+            {
+                return false;
+            }
+            size_t i = 0;
+            for (auto element : arr)
+            {
+                if (i++ != index)
+                {
+                    continue;
+                }
+                simdjson::ondemand::value value;
+                if (element.get(value) != simdjson::SUCCESS)
+                {
+                    return false;
+                }
+                json_value in(static_cast<void *>(&value));
+                return read(in, ctx);
+            }
+            return false;
+        }
+        message::ptr const &msg = get_message();
+        if (!msg || msg->get_flag() != message::flag_array || index >= msg->get_vector().size())
+        {
+            return false;
+        }
+        json_value in(msg->get_vector()[index].get());
+        return read(in, ctx);
+    }
 
-    void packet_manager::put_payload(string const &payload)
+    unsigned packet::get_pack_id() const
     {
-        unique_ptr<packet> p;
-        do
+        return _pack_id;
+    }
+
+    size_t packet::get_estimated_size() const
+    {
+        size_t size = _nsp.size() + 16 + (_encoded ? _encoded->get_size() : 0);
+        if (_message)
+        {
+            size += estimate_message_size(*_message);
+        }
+        return size;
+    }
+
+    encoded_packet::ptr encoded_packet::create(string const &event_name, message::list const &msglist)
+    {
+        shared_ptr<encoded_packet> encoded(new encoded_packet());
+        encoded->m_event_name = event_name;
+        accept_message(*msglist.to_array_message(event_name), encoded->m_json, encoded->m_buffers, true);
+        return encoded;
+    }
+
+    encoded_packet::ptr encoded_packet::from_json(string const &event_name, string &&event_array)
+    {
+        shared_ptr<encoded_packet> encoded(new encoded_packet());
+        encoded->m_event_name = event_name;
+        encoded->m_json = std::move(event_array);
+        return encoded;
+    }
+
+    void json_writer::key(string_view name)
+    {
+        separate();
+        m_out += '"';
+        append_escaped(m_out, name);
+        m_out += "\":";
+        m_first = true;
+    }
+
+    void json_writer::null()
+    {
+        separate();
+        m_out += "null";
+    }
+
+    void json_writer::value(bool b)
+    {
+        separate();
+        m_out += b ? "true" : "false";
+    }
+
+    void json_writer::value(long long i)
+    {
+        separate();
+        append_number(m_out, i);
+    }
+
+    void json_writer::value(unsigned long long u)
+    {
+        separate();
+        append_number(m_out, u);
+    }
+
+    void json_writer::value(double d)
+    {
+        // Same text as double_message.
+        separate();
+        append_double(m_out, d);
+    }
+
+    void json_writer::value(string_view s)
+    {
+        separate();
+        m_out += '"';
+        append_escaped(m_out, s);
+        m_out += '"';
+    }
+
+    // On-Demand reads below consume the value; the message tree branch mirrors
+    // the same rules (integers read as doubles, but not the reverse).
+    inline simdjson::ondemand::value &ondemand_of(void *value)
+    {
+        return *static_cast<simdjson::ondemand::value *>(value);
+    }
+
+    bool json_value::is_null()
+    {
+        if (m_ondemand)
+        {
+            bool null = false;
+            return ondemand_of(m_ondemand).is_null().get(null) == simdjson::SUCCESS && null;
+        }
+        return !m_message || m_message->get_flag() == message::flag_null;
+    }
+
+    bool json_value::get(bool &out)
+    {
+        if (m_ondemand)
+        {
+            return ondemand_of(m_ondemand).get_bool().get(out) == simdjson::SUCCESS;
+        }
+        if (!m_message || m_message->get_flag() != message::flag_boolean)
+        {
+            return false;
+        }
+        out = m_message->get_bool();
+        return true;
+    }
+
+    bool json_value::get(long long &out)
+    {
+        if (m_ondemand)
+        {
+            int64_t v;
+            if (ondemand_of(m_ondemand).get_int64().get(v) != simdjson::SUCCESS)
+            {
+                return false;
+            }
+            out = v;
+            return true;
+        }
+        if (!m_message || m_message->get_flag() != message::flag_integer)
+        {
+            return false;
+        }
+        out = m_message->get_int();
+        return true;
+    }
+
+    bool json_value::get(unsigned long long &out)
+    {
+        if (m_ondemand)
+        {
+            uint64_t v;
+            if (ondemand_of(m_ondemand).get_uint64().get(v) != simdjson::SUCCESS)
+            {
+                return false;
+            }
+            out = v;
+            return true;
+        }
+        if (!m_message || m_message->get_flag() != message::flag_integer || m_message->get_int() < 0)
+        {
+            return false;
+        }
+        out = static_cast<unsigned long long>(m_message->get_int());
+        return true;
+    }
+
+    bool json_value::get(double &out)
+    {
+        if (m_ondemand)
+        {
+            return ondemand_of(m_ondemand).get_double().get(out) == simdjson::SUCCESS;
+        }
+        if (!m_message || (m_message->get_flag() != message::flag_double && m_message->get_flag() != message::flag_integer))
+        {
+            return false;
+        }
+        out = m_message->get_double();
+        return true;
+    }
+
+    bool json_value::get(string &out)
+    {
+        if (m_ondemand)
+        {
+            string_view sv;
+            if (ondemand_of(m_ondemand).get_string().get(sv) != simdjson::SUCCESS)
+            {
+                return false;
+            }
+            out.assign(sv.data(), sv.size());
+            return true;
+        }
+        if (!m_message || m_message->get_flag() != message::flag_string)
+        {
+            return false;
+        }
+        string_view sv = m_message->get_string_view();
+        out.assign(sv.data(), sv.size());
+        return true;
+    }
+
+    bool json_value::visit_fields(field_visitor visit, void *ctx)
+    {
+        if (m_ondemand)
+        {
+            simdjson::ondemand::object obj;
+            if (ondemand_of(m_ondemand).get_object().get(obj) != simdjson::SUCCESS)
+            {
+                return false;
+            }
+            for (auto field : obj)
+            {
+                string_view key;
+                simdjson::ondemand::value child;
+                if (field.unescaped_key().get(key) != simdjson::SUCCESS || field.value().get(child) != simdjson::SUCCESS)
+                {
+                    return false;
+                }
+                json_value member(static_cast<void *>(&child));
+                if (!visit(ctx, key, member))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        if (!m_message || m_message->get_flag() != message::flag_object)
+        {
+            return false;
+        }
+        object_message const &obj = static_cast<object_message const &>(*m_message);
+        if (obj.is_ordered())
+        {
+            for (auto const &field : obj.get_fields())
+            {
+                json_value member(field.second.get());
+                if (!visit(ctx, field.first, member))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        for (auto const &field : obj.get_map())
+        {
+            json_value member(field.second.get());
+            if (!visit(ctx, field.first, member))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool json_value::visit_elements(element_visitor visit, void *ctx)
+    {
+        if (m_ondemand)
         {
-            if (packet::is_text_message(payload))
+            simdjson::ondemand::array arr;
+            if (ondemand_of(m_ondemand).get_array().get(arr) != simdjson::SUCCESS)
+            {
+                return false;
+            }
+            for (auto element : arr)
             {
-                p.reset(new packet());
-                if (p->parse(payload))
+                simdjson::ondemand::value child;
+                if (element.get(child) != simdjson::SUCCESS)
                 {
-                    m_partial_packet = std::move(p);
+                    return false;
                 }
-                else
+                json_value item(static_cast<void *>(&child));
+                if (!visit(ctx, item))
                 {
-                    break;
+                    return false;
                 }
             }
-            else if (packet::is_binary_message(payload))
+            return true;
+        }
+        if (!m_message || m_message->get_flag() != message::flag_array)
+        {
+            return false;
+        }
+        for (message::ptr const &element : m_message->get_vector())
+        {
+            json_value item(element.get());
+            if (!visit(ctx, item))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void json_packet_parser::encode(packet &pack, frame_callback const &callback) const
+    {
+        // Start from the size of the last payload encoded on this thread, so steady
+        // traffic usually encodes without regrowing the buffer.
+        static thread_local size_t s_last_payload_size = 512;
+        shared_ptr<string> ptr = make_shared<string>();
+        ptr->reserve(s_last_payload_size);
+        vector<shared_ptr<const string>> buffers;
+        buffers.reserve(4);
+
+        bool hasBinary = pack.accept(*ptr, buffers);
+        s_last_payload_size = std::max<size_t>(512, std::min<size_t>(ptr->size() + ptr->size() / 4, 64 * 1024));
+        if (callback)
+        {
+            callback(false, ptr);
+            if (hasBinary)
             {
-                if (m_partial_packet)
+                for (auto it = buffers.begin(); it != buffers.end(); ++it)
                 {
-                    if (!m_partial_packet->parse_buffer(payload))
-                    {
-                        p = std::move(m_partial_packet);
-                        break;
-                    }
+                    callback(true, *it);
                 }
             }
-            else
+        }
+    }
+
+    unique_ptr<packet> json_packet_parser::decode(shared_ptr<const string> const &payload_ptr, decode_options const &options)
+    {
+        string const &payload = *payload_ptr;
+        // An aliasing pointer with no owner only borrows the payload.
+        bool owned = payload_ptr.use_count() > 0;
+        unique_ptr<packet> p;
+        if (packet::is_text_message(payload))
+        {
+            p.reset(new packet());
+            if (owned ? p->parse(payload_ptr, options) : p->parse(payload, options))
             {
-                p.reset(new packet());
-                p->parse(payload);
-                break;
+                m_partial_packet = std::move(p);
+            }
+        }
+        else if (packet::is_binary_message(payload))
+        {
+            if (m_partial_packet)
+            {
+                if (!(owned ? m_partial_packet->parse_buffer(payload_ptr) : m_partial_packet->parse_buffer(payload)))
+                {
+                    p = std::move(m_partial_packet);
+                }
             }
+        }
+        else
+        {
+            p.reset(new packet());
+            p->parse(payload, options);
+        }
+        return p;
+    }
+
+    void json_packet_parser::reset()
+    {
+        m_partial_packet.reset();
+    }
+
+    void msgpack_packet_parser::encode(packet &pack, frame_callback const &callback) const
+    {
+        if (pack.get_frame() != packet::frame_message)
+        {
+            json_packet_parser::encode(pack, callback);
             return;
-        } while (0);
+        }
+        static thread_local size_t s_last_payload_size = 512;
+        shared_ptr<string> ptr = make_shared<string>();
+        ptr->reserve(s_last_payload_size);
+        pack.accept_msgpack(*ptr);
+        s_last_payload_size = std::max<size_t>(512, std::min<size_t>(ptr->size() + ptr->size() / 4, 64 * 1024));
+        if (callback)
+        {
+            callback(true, ptr);
+        }
+    }
+
+    unique_ptr<packet> msgpack_packet_parser::decode(shared_ptr<const string> const &payload_ptr, decode_options const &options)
+    {
+        if (!packet::is_msgpack_message(*payload_ptr))
+        {
+            return json_packet_parser::decode(payload_ptr, options);
+        }
+        unique_ptr<packet> p(new packet());
+        if (!p->parse_msgpack(payload_ptr, options))
+        {
+            return unique_ptr<packet>();
+        }
+        return p;
+    }
+
+    packet_manager::packet_manager() : m_parser(new json_packet_parser())
+    {
+    }
+
+    void packet_manager::set_parser(unique_ptr<packet_parser> &&parser)
+    {
+        m_parser = std::move(parser);
+    }
 
-        if (m_decode_callback)
+    void packet_manager::set_decode_callback(function<void(packet const &)> const &decode_callback)
+    {
+        m_decode_callback = decode_callback;
+    }
+
+    void packet_manager::set_encode_callback(function<void(bool, shared_ptr<const string> const &)> const &encode_callback)
+    {
+        m_encode_callback = encode_callback;
+    }
+
+    void packet_manager::set_decode_options(decode_options const &options)
+    {
+        m_decode_options = options;
+    }
+
+    void packet_manager::set_tracer(trace_listener const &tracer)
+    {
+        m_tracer = tracer;
+    }
+
+    void packet_manager::reset()
+    {
+        m_parser->reset();
+    }
+
+    void packet_manager::encode(packet &pack, encode_callback_function const &override_encode_callback) const
+    {
+        SIO_TRACE_SCOPE(m_tracer, trace_point::encode, pack.get_nsp(), std::string_view(), pack.get_pack_id(), 0);
+        m_parser->encode(pack, override_encode_callback ? override_encode_callback : m_encode_callback);
+    }
+
+    void packet_manager::put_payload(string const &payload)
+    {
+        // Non-owning: the packet copies whatever it needs to keep past this call.
+        put_payload(shared_ptr<const string>(shared_ptr<const string>(), &payload));
+    }
+
+    void packet_manager::put_payload(shared_ptr<const string> const &payload_ptr)
+    {
+        unique_ptr<packet> p;
+        {
+            // Closed before the decode callback, which runs the handlers.
+            SIO_TRACE_SCOPE(m_tracer, trace_point::decode, std::string_view(), std::string_view(), -1, payload_ptr->size());
+            p = m_parser->decode(payload_ptr, m_decode_options);
+        }
+        if (p && m_decode_callback)
         {
             m_decode_callback(*p);
         }
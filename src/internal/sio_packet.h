@@ -8,11 +8,22 @@
 #define SIO_PACKET_H
 #include <sstream>
 #include "../sio_message.h"
+#include "../sio_codec.h"
+#include "../sio_encoded_packet.h"
+#include "../sio_trace.h"
 #include <functional>
 
 namespace sio
 {
     using namespace std;
+
+    struct decode_options
+    {
+        // Decode string values as views into a per-packet arena instead of owned copies.
+        bool zero_copy = false;
+        // Keep event arguments as raw JSON; build the message tree on first get_message().
+        bool lazy = false;
+    };
     
     class packet
     {
@@ -46,12 +57,24 @@ namespace sio
         int _type;
         string _nsp;
         int _pack_id;
-        message::ptr _message;
+        mutable message::ptr _message;
+        // Sent in place of _message when the event was encoded beforehand.
+        encoded_packet::ptr _encoded;
         unsigned _pending_buffers;
         vector<shared_ptr<const string> > _buffers;
+        // Inbound payload kept alive until pending buffers arrive (or for the packet's
+        // lifetime in lazy mode), and where its JSON starts.
+        shared_ptr<const string> _payload;
+        size_t _json_pos;
+        decode_options _options;
+
+        bool parse_impl(string const& payload_ptr, shared_ptr<const string> const& owner);
     public:
         packet(string const& nsp,message::ptr const& msg,int pack_id = -1,bool isAck = false);//message type constructor.
         
+        //event constructor for a pre-encoded event; only the header is written per send.
+        packet(string const& nsp,encoded_packet::ptr const& encoded,int pack_id = -1);
+
         packet(frame_type frame);
         
         packet(type type,string const& nsp= string(),message::ptr const& msg = message::ptr());//other message types constructor.
@@ -62,28 +85,112 @@ namespace sio
         
         type get_type() const;
         
-        bool parse(string const& payload_ptr);//return true if need to parse buffer.
+        bool parse(string const& payload_ptr, decode_options const& options = decode_options());//return true if need to parse buffer.
+
+        //zero-copy variant: payload (e.g. aliasing the websocket frame) is retained instead of copied.
+        bool parse(shared_ptr<const string> const& payload_ptr, decode_options const& options = decode_options());
         
         bool parse_buffer(string const& buf_payload);
+
+        //zero-copy variant: the attachment shares ownership of buf_payload (e.g. the websocket frame).
+        bool parse_buffer(shared_ptr<const string> const& buf_payload);
         
         bool accept(string& payload_ptr, vector<shared_ptr<const string> >&buffers); //return true if has binary buffers.
+
+        //socket.io-msgpack-parser form of a message packet: one MessagePack map, attachments inline.
+        void accept_msgpack(string& payload);
+
+        //parse a MessagePack packet; false if malformed. Strings are views into payload with zero_copy.
+        bool parse_msgpack(shared_ptr<const string> const& payload, decode_options const& options = decode_options());
         
         string const& get_nsp() const;
         
         message::ptr const& get_message() const;
+
+        //raw JSON of a lazily decoded packet, empty otherwise.
+        std::string_view get_raw_json() const;
+
+        //first element of an event array, read without building the message tree.
+        bool get_event_name(string& name) const;
+
+        //last element of an event array when it is a string argument (the server's
+        //connection state recovery offset), without building the message tree.
+        bool get_trailing_string(string& value) const;
+
+        //decode only the value at a JSON pointer (RFC 6901) into the packet's JSON.
+        message::ptr get_field(std::string_view pointer) const;
+
+        //run read on element index of the event array, straight from the raw JSON
+        //with On-Demand when lazily decoded. False if absent or read fails.
+        bool read_element(size_t index, bool (*read)(json_value& value, void* ctx), void* ctx) const;
         
         unsigned get_pack_id() const;
+
+        //approximate encoded size (header, JSON and attachments) without encoding.
+        size_t get_estimated_size() const;
         
         static bool is_message(string const& payload_ptr);
         static bool is_text_message(string const& payload_ptr);
         static bool is_binary_message(string const& payload_ptr);
+        static bool is_msgpack_message(string const& payload_ptr);
     };
     
+    //resolve a JSON pointer (RFC 6901) against an already decoded message tree.
+    message::ptr find_json_pointer(message::ptr const& root, std::string_view pointer);
+    
+    //wire format of socket.io packets, see packet_manager::set_parser.
+    class packet_parser
+    {
+    public:
+        typedef function<void (bool,shared_ptr<const string> const&)> frame_callback;
+
+        virtual ~packet_parser() {}
+
+        //write pack as websocket frames; the bool is true for binary frames.
+        virtual void encode(packet& pack, frame_callback const& callback) const = 0;
+
+        //take one inbound frame; returns the packet it completes, or null while
+        //attachments are pending. payload may be an aliasing pointer without owner.
+        virtual unique_ptr<packet> decode(shared_ptr<const string> const& payload, decode_options const& options) = 0;
+
+        //drop a partially received packet.
+        virtual void reset() {}
+    };
+
+    //socket.io-parser: JSON text frames, each attachment in a binary frame of its own.
+    class json_packet_parser : public packet_parser
+    {
+    public:
+        void encode(packet& pack, frame_callback const& callback) const override;
+
+        unique_ptr<packet> decode(shared_ptr<const string> const& payload, decode_options const& options) override;
+
+        void reset() override;
+
+    private:
+        unique_ptr<packet> m_partial_packet;
+    };
+
+    //socket.io-msgpack-parser: each packet one binary MessagePack frame, attachments
+    //inline. engine.io frames (open, ping, pong, close) stay text and take the JSON path.
+    class msgpack_packet_parser : public json_packet_parser
+    {
+    public:
+        void encode(packet& pack, frame_callback const& callback) const override;
+
+        unique_ptr<packet> decode(shared_ptr<const string> const& payload, decode_options const& options) override;
+    };
+
     class packet_manager
     {
     public:
         typedef function<void (bool,shared_ptr<const string> const&)> encode_callback_function;
         typedef  function<void (packet const&)> decode_callback_function;
+
+        packet_manager();
+
+        //json_packet_parser unless set; set before use.
+        void set_parser(unique_ptr<packet_parser>&& parser);
         
         void set_decode_callback(decode_callback_function const& decode_callback);
 
@@ -92,15 +199,26 @@ namespace sio
         void encode(packet& pack,encode_callback_function const& override_encode_callback = encode_callback_function()) const;
         
         void put_payload(string const& payload);
+
+        void put_payload(shared_ptr<const string> const& payload);
+
+        void set_decode_options(decode_options const& options);
+
+        // Reports encode and decode spans; set before use, not while encoding.
+        void set_tracer(trace_listener const& tracer);
         
         void reset();
         
     private:
+        decode_options m_decode_options;
+
+        trace_listener m_tracer;
+
         decode_callback_function m_decode_callback;
         
         encode_callback_function m_encode_callback;
         
-        std::unique_ptr<packet> m_partial_packet;
+        unique_ptr<packet_parser> m_parser;
     };
 }
 #endif
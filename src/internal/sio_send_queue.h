@@ -0,0 +1,181 @@
+//
+//  sio_send_queue.h
+//
+//  Encoded frames waiting for the io thread, and when to write them.
+//
+
+#ifndef SIO_SEND_QUEUE_H
+#define SIO_SEND_QUEUE_H
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace sio
+{
+    // Frames from any thread are pushed here and written by the io thread in
+    // batches of up to batch_max_bytes. With a linger, the first frame of a
+    // batch waits up to that long for more unless the batch fills first. The
+    // queue only decides; the client owns the timer and posts the flushes.
+    // Not synchronized: the client guards it with its send mutex.
+    class send_queue
+    {
+    public:
+        struct frame
+        {
+            std::shared_ptr<const std::string> payload;
+            bool binary;
+            // Non-empty for emit_latest: a newer frame with the same key replaces this one.
+            std::string coalesce_key;
+            // Set by the client with client_options::record_timings.
+            std::chrono::steady_clock::time_point enqueued_at;
+        };
+
+        // What the caller has to arrange after pushing.
+        enum class kick
+        {
+            none,      // A flush or the linger timer is already on its way
+            flush,     // Post a flush
+            linger,    // Start the linger timer, which flushes
+            flush_now  // The batch filled while lingering: cancel the timer and post a flush
+        };
+
+        send_queue(std::size_t batch_max_bytes, std::chrono::microseconds linger)
+            : m_batch_max_bytes(batch_max_bytes), m_linger(linger)
+        {
+        }
+
+        void push(frame &&f)
+        {
+            m_pushed += f.payload->size();
+            if (!f.coalesce_key.empty())
+            {
+                auto keyed = m_keyed.find(f.coalesce_key);
+                if (keyed != m_keyed.end())
+                {
+                    // Still unsent: the newer value takes its place in the queue.
+                    frame &queued = m_frames[keyed->second - m_front_seq];
+                    m_bytes = m_bytes - queued.payload->size() + f.payload->size();
+                    queued.payload = std::move(f.payload);
+                    return;
+                }
+                m_keyed.emplace(f.coalesce_key, m_front_seq + m_frames.size());
+            }
+            m_bytes += f.payload->size();
+            m_frames.push_back(std::move(f));
+            m_peak = std::max(m_peak, m_frames.size());
+        }
+
+        // After one or more pushes.
+        kick schedule()
+        {
+            if (!m_scheduled)
+            {
+                m_scheduled = true;
+                if (m_linger.count() > 0 && m_bytes < m_batch_max_bytes)
+                {
+                    m_lingering = true;
+                    return kick::linger;
+                }
+                return kick::flush;
+            }
+            if (m_lingering && m_bytes >= m_batch_max_bytes)
+            {
+                m_lingering = false;
+                return kick::flush_now;
+            }
+            return kick::none;
+        }
+
+        // For the flush: moves the next batch into out, at least one frame and
+        // then frames up to batch_max_bytes. True if frames are left, for which
+        // the caller posts another flush; otherwise the next push schedules again.
+        bool take_batch(std::deque<frame> &out)
+        {
+            m_lingering = false;
+            std::size_t bytes = 0;
+            std::size_t count = 0;
+            while (count < m_frames.size() && (count == 0 || bytes < m_batch_max_bytes))
+            {
+                bytes += m_frames[count++].payload->size();
+            }
+            m_front_seq += count;
+            if (count == m_frames.size())
+            {
+                out.swap(m_frames);
+                m_frames.clear();
+                m_keyed.clear();
+                m_bytes = 0;
+                m_scheduled = false;
+                return false;
+            }
+            out.assign(std::make_move_iterator(m_frames.begin()), std::make_move_iterator(m_frames.begin() + count));
+            m_frames.erase(m_frames.begin(), m_frames.begin() + count);
+            for (frame const &sent : out)
+            {
+                if (!sent.coalesce_key.empty())
+                {
+                    m_keyed.erase(sent.coalesce_key);
+                }
+            }
+            m_bytes -= bytes;
+            return true;
+        }
+
+        // A flush was scheduled without the linger timer, e.g. one the
+        // transport backlog held back.
+        bool flush_pending() const
+        {
+            return m_scheduled && !m_lingering;
+        }
+
+        std::size_t size() const
+        {
+            return m_frames.size();
+        }
+
+        std::size_t bytes() const
+        {
+            return m_bytes;
+        }
+
+        // Bytes ever pushed, replaced frames included. Less bytes() and what the
+        // transport still buffers, that's how much has been written.
+        std::uint64_t pushed() const
+        {
+            return m_pushed;
+        }
+
+        std::size_t batch_max_bytes() const
+        {
+            return m_batch_max_bytes;
+        }
+
+        // Deepest the queue has been, in frames.
+        std::size_t peak() const
+        {
+            return m_peak;
+        }
+
+    private:
+        const std::size_t m_batch_max_bytes;
+        const std::chrono::microseconds m_linger;
+
+        std::deque<frame> m_frames;
+        // Queued frames with a coalesce key, by sequence number; m_front_seq
+        // is that of m_frames.front().
+        std::unordered_map<std::string, std::uint64_t> m_keyed;
+        std::uint64_t m_front_seq = 0;
+        std::size_t m_bytes = 0;
+        std::uint64_t m_pushed = 0;
+        std::size_t m_peak = 0;
+        bool m_scheduled = false;
+        bool m_lingering = false;
+    };
+}
+#endif // SIO_SEND_QUEUE_H
@@ -0,0 +1,184 @@
+//
+//  sio_timer_wheel.h
+//
+//  Hashed timing wheel for ack timeouts.
+//
+
+#ifndef SIO_TIMER_WHEEL_H
+#define SIO_TIMER_WHEEL_H
+#include <chrono>
+#include <cstdint>
+#include <new>
+#include <vector>
+#include "../sio_message_pool.h"
+
+namespace sio
+{
+    // Timers hash into a slot by their expiry tick, so scheduling and cancelling
+    // are O(1) however many are pending; one periodic timer drives advance().
+    // Slots are scanned as the wheel turns, and a timer further out than one
+    // revolution stays in its slot until its deadline comes round.
+    // Not synchronized: the owner serializes every call.
+    class timer_wheel
+    {
+    private:
+        struct node
+        {
+            node *prev;
+            node *next;
+            std::uint64_t deadline;
+            unsigned id;
+        };
+
+    public:
+        typedef std::chrono::steady_clock clock;
+        typedef node *handle;
+
+        timer_wheel(std::chrono::milliseconds tick, std::size_t slot_count) : m_tick(tick),
+                                                                              m_slots(slot_count, nullptr),
+                                                                              m_start(clock::now()),
+                                                                              m_current(0),
+                                                                              m_size(0)
+        {
+        }
+
+        ~timer_wheel()
+        {
+            for (node *&head : m_slots)
+            {
+                while (node *n = head)
+                {
+                    head = n->next;
+                    release(n);
+                }
+            }
+        }
+
+        timer_wheel(timer_wheel const &) = delete;
+        timer_wheel &operator=(timer_wheel const &) = delete;
+
+        // The timer expires on the first advance() at least delay after now.
+        handle schedule(unsigned id, std::chrono::milliseconds delay, clock::time_point now = clock::now())
+        {
+            std::uint64_t now_tick = tick_of(now);
+            if (m_size == 0 && now_tick > m_current)
+            {
+                // Nothing pending: skip the empty slots instead of scanning them.
+                m_current = now_tick;
+            }
+            std::uint64_t deadline = ceil_tick_of(now + delay);
+            node *n = new (message_pool::allocate(sizeof(node))) node;
+            n->deadline = deadline > m_current ? deadline : m_current + 1;
+            n->id = id;
+            node *&head = m_slots[n->deadline % m_slots.size()];
+            n->prev = nullptr;
+            n->next = head;
+            if (head)
+            {
+                head->prev = n;
+            }
+            head = n;
+            ++m_size;
+            return n;
+        }
+
+        // h must be pending: neither cancelled nor expired yet.
+        void cancel(handle h)
+        {
+            unlink(h);
+            release(h);
+        }
+
+        // Expire every timer due by now, calling on_expired(id) for each; the
+        // callback must not schedule or cancel on this wheel.
+        template <typename F>
+        void advance(clock::time_point now, F &&on_expired)
+        {
+            std::uint64_t target = tick_of(now);
+            while (m_current < target && m_size > 0)
+            {
+                ++m_current;
+                node *n = m_slots[m_current % m_slots.size()];
+                while (n)
+                {
+                    node *next = n->next;
+                    if (n->deadline <= m_current)
+                    {
+                        unsigned id = n->id;
+                        cancel(n);
+                        on_expired(id);
+                    }
+                    n = next;
+                }
+            }
+            if (m_current < target)
+            {
+                m_current = target;
+            }
+        }
+
+        bool empty() const
+        {
+            return m_size == 0;
+        }
+
+        std::size_t size() const
+        {
+            return m_size;
+        }
+
+        std::chrono::milliseconds tick() const
+        {
+            return m_tick;
+        }
+
+    private:
+        std::uint64_t tick_of(clock::time_point t) const
+        {
+            if (t <= m_start)
+            {
+                return 0;
+            }
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(t - m_start).count() / m_tick.count());
+        }
+
+        std::uint64_t ceil_tick_of(clock::time_point t) const
+        {
+            if (t <= m_start)
+            {
+                return 0;
+            }
+            std::uint64_t ms = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(t - m_start).count());
+            return (ms + m_tick.count() - 1) / m_tick.count();
+        }
+
+        void unlink(node *n)
+        {
+            if (n->prev)
+            {
+                n->prev->next = n->next;
+            }
+            else
+            {
+                m_slots[n->deadline % m_slots.size()] = n->next;
+            }
+            if (n->next)
+            {
+                n->next->prev = n->prev;
+            }
+            --m_size;
+        }
+
+        static void release(node *n)
+        {
+            message_pool::deallocate(n, sizeof(node));
+        }
+
+        std::chrono::milliseconds m_tick;
+        std::vector<node *> m_slots;
+        clock::time_point m_start;
+        std::uint64_t m_current;
+        std::size_t m_size;
+    };
+}
+#endif // SIO_TIMER_WHEEL_H
@@ -0,0 +1,61 @@
+//
+//  sio_trace_scope.h
+//
+//  SIO_TRACE_SCOPE: reports a span to a trace_listener from construction to
+//  the end of the enclosing block.
+//
+
+#ifndef SIO_TRACE_SCOPE_H
+#define SIO_TRACE_SCOPE_H
+#include "../sio_trace.h"
+
+#ifndef SIO_DISABLE_TRACING
+namespace sio
+{
+    class trace_scope
+    {
+    public:
+        // Costs one branch when no listener is set.
+        trace_scope(trace_listener const &listener, trace_point point, std::string_view nsp,
+                    std::string_view event_name, int pack_id, std::size_t bytes) : m_listener(listener ? &listener : nullptr)
+        {
+            if (m_listener)
+            {
+                m_record.point = point;
+                m_record.begin = true;
+                m_record.nsp = nsp;
+                m_record.event_name = event_name;
+                m_record.pack_id = pack_id;
+                m_record.bytes = bytes;
+                m_record.time = std::chrono::steady_clock::now();
+                (*m_listener)(m_record);
+            }
+        }
+
+        ~trace_scope()
+        {
+            if (m_listener)
+            {
+                m_record.begin = false;
+                m_record.time = std::chrono::steady_clock::now();
+                (*m_listener)(m_record);
+            }
+        }
+
+        trace_scope(trace_scope const &) = delete;
+        trace_scope &operator=(trace_scope const &) = delete;
+
+    private:
+        trace_listener const *m_listener;
+        trace_record m_record;
+    };
+}
+
+// listener must outlive the enclosing block; the views passed are captured as is.
+#define SIO_TRACE_SCOPE(listener, point, nsp, event_name, pack_id, bytes) \
+    ::sio::trace_scope sio_trace_scope_((listener), (point), (nsp), (event_name), (pack_id), (bytes))
+#else
+#define SIO_TRACE_SCOPE(listener, point, nsp, event_name, pack_id, bytes) ((void)0)
+#endif // SIO_DISABLE_TRACING
+
+#endif // SIO_TRACE_SCOPE_H
@@ -0,0 +1,85 @@
+//
+//  sio_worker_pool.h
+//
+//  Worker threads for event handlers, with per-key ordering.
+//
+
+#ifndef SIO_WORKER_POOL_H
+#define SIO_WORKER_POOL_H
+#include <asio/post.hpp>
+#include <asio/strand.hpp>
+#include <asio/thread_pool.hpp>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace sio
+{
+    // Work posted with the same key runs in posting order, one item at a time;
+    // work with different keys may run in parallel. Keys hash onto a fixed set
+    // of strands, so memory doesn't grow with the number of distinct keys.
+    class worker_pool
+    {
+    public:
+        explicit worker_pool(unsigned threads) : m_pool(threads)
+        {
+            std::size_t strand_count = static_cast<std::size_t>(threads) * 4;
+            m_strands.reserve(strand_count);
+            for (std::size_t i = 0; i < strand_count; ++i)
+            {
+                m_strands.emplace_back(asio::make_strand(m_pool.get_executor()));
+            }
+        }
+
+        ~worker_pool()
+        {
+            join();
+        }
+
+        // Finishes the work already posted.
+        void join()
+        {
+            m_pool.join();
+        }
+
+        worker_pool(worker_pool const &) = delete;
+        worker_pool &operator=(worker_pool const &) = delete;
+
+        template <typename F>
+        void post(std::size_t key, F &&f)
+        {
+            asio::post(m_strands[key % m_strands.size()], std::forward<F>(f));
+        }
+
+        // Runs f once the work already posted under every key has run. Strands
+        // don't wait for it: work posted after it may run first.
+        void post_after_all(std::function<void()> f)
+        {
+            struct barrier
+            {
+                std::atomic<std::size_t> left;
+                std::function<void()> f;
+            };
+            std::shared_ptr<barrier> b = std::make_shared<barrier>();
+            b->left.store(m_strands.size(), std::memory_order_relaxed);
+            b->f = std::move(f);
+            for (auto &strand : m_strands)
+            {
+                asio::post(strand, [b]() {
+                    if (b->left.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    {
+                        b->f();
+                    }
+                });
+            }
+        }
+
+    private:
+        asio::thread_pool m_pool;
+        std::vector<asio::strand<asio::thread_pool::executor_type>> m_strands;
+    };
+}
+#endif // SIO_WORKER_POOL_H
@@ -0,0 +1,114 @@
+//
+//  sio_asio.h
+//
+//  sio::async_emit: emit with ack as an asio asynchronous operation, for
+//  asio::use_awaitable, callbacks, futures or any other completion token.
+//  Include it only where asio is on the include path; no other header needs it.
+//
+
+#ifndef SIO_ASIO_H
+#define SIO_ASIO_H
+#include "sio_socket.h"
+#include "sio_message_pool.h"
+#include <asio/associated_executor.hpp>
+#include <asio/async_result.hpp>
+#include <asio/dispatch.hpp>
+#include <asio/error.hpp>
+#include <asio/executor_work_guard.hpp>
+#include <asio/post.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+namespace sio
+{
+    // One pending async_emit: the handler, and work on its executor so the
+    // executor stays busy until the ack or timeout comes.
+    template <typename Handler>
+    class async_emit_op
+    {
+    public:
+        typedef asio::associated_executor_t<Handler> executor_type;
+
+        explicit async_emit_op(Handler &&handler)
+            : m_handler(std::move(handler)), m_work(asio::get_associated_executor(m_handler))
+        {
+        }
+
+        // On the thread the ack or timeout arrives on, normally the io thread.
+        void complete(asio::error_code const &ec, message::list &&result)
+        {
+            executor_type ex = m_work.get_executor();
+            asio::dispatch(ex, bound(ec, std::move(result)));
+        }
+
+        // Before async_emit returns: never call the handler from inside it.
+        void fail(asio::error_code const &ec)
+        {
+            executor_type ex = m_work.get_executor();
+            asio::post(ex, bound(ec, message::list()));
+        }
+
+    private:
+        auto bound(asio::error_code const &ec, message::list &&result)
+        {
+            return [handler = std::move(m_handler), work = std::move(m_work), ec, result = std::move(result)]() mutable {
+                work.reset();
+                std::move(handler)(ec, std::move(result));
+            };
+        }
+
+        Handler m_handler;
+        asio::executor_work_guard<executor_type> m_work;
+    };
+
+    struct initiate_async_emit
+    {
+        template <typename Handler>
+        void operator()(Handler &&handler, socket::ptr const &s, std::string const &event_name,
+                        message::list const &msglist, unsigned timeout_ms) const
+        {
+            typedef async_emit_op<typename std::decay<Handler>::type> op_type;
+            // Pooled: with the op and the two callbacks holding just a pointer
+            // to it, an emit allocates nothing else up to the send.
+            std::shared_ptr<op_type> op = std::allocate_shared<op_type>(message_allocator<op_type>(), std::forward<Handler>(handler));
+            std::function<void()> on_timeout;
+            if (timeout_ms)
+            {
+                on_timeout = [op]() { op->complete(asio::error::timed_out, message::list()); };
+            }
+            emit_status status = s->emit_with_ack_move(event_name, msglist,
+                [op](message::list &&result) { op->complete(asio::error_code(), std::move(result)); },
+                timeout_ms, std::move(on_timeout));
+            if (status == emit_status::dropped || status == emit_status::would_block)
+            {
+                op->fail(asio::error::no_buffer_space);
+            }
+        }
+    };
+
+    // Emits event_name and completes with the server's ack arguments, moved
+    // out of the decoded packet: asio::error::timed_out after timeout_ms (0
+    // waits without one), asio::error::no_buffer_space if the offline buffer
+    // rejects it. The handler runs on its associated executor, so
+    // co_await async_emit(s, "get", args, 0, asio::use_awaitable) resumes on
+    // the coroutine's executor rather than the io thread; a callback without
+    // one (see asio::bind_executor) runs on the thread the ack arrives on.
+    // Signature: void(asio::error_code, message::list).
+    template <typename CompletionToken>
+    auto async_emit(socket::ptr const &s, std::string const &event_name, message::list const &msglist,
+                    unsigned timeout_ms, CompletionToken &&token)
+    {
+        return asio::async_initiate<CompletionToken, void(asio::error_code, message::list)>(
+            initiate_async_emit(), token, s, event_name, msglist, timeout_ms);
+    }
+
+    template <typename CompletionToken>
+    auto async_emit(socket::ptr const &s, std::string const &event_name, message::list const &msglist,
+                    CompletionToken &&token)
+    {
+        return async_emit(s, event_name, msglist, 0, std::forward<CompletionToken>(token));
+    }
+}
+#endif // SIO_ASIO_H
@@ -2,9 +2,15 @@
 #define SIO_AWAITABLE_H
 
 #include "sio_message.h"
+#include "sio_message_pool.h"
+#include <atomic>
+#include <condition_variable>
 #include <coroutine>
+#include <cstdint>
 #include <exception>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
 
 namespace sio
 {
@@ -15,20 +21,34 @@ namespace sio
         timeout_exception() : std::runtime_error("Socket.IO emit timeout") {}
     };
 
-    // Awaitable for emit_async operations
+    // Exception thrown when emit_async is rejected by the offline buffer
+    class buffer_full_exception : public std::runtime_error
+    {
+    public:
+        buffer_full_exception() : std::runtime_error("Socket.IO offline buffer full") {}
+    };
+
+    // Awaitable for emit_async operations. The result may be set before the
+    // coroutine suspends, on any thread; whichever of the two comes second
+    // resumes the coroutine, on its own thread.
     class emit_awaiter
     {
     public:
         emit_awaiter() = default;
 
+        emit_awaiter(emit_awaiter const &) = delete;
+        emit_awaiter &operator=(emit_awaiter const &) = delete;
+
         bool await_ready() const noexcept
         {
-            return false; // Always suspend
+            return ready_.load(std::memory_order_acquire);
         }
 
-        void await_suspend(std::coroutine_handle<> handle) noexcept
+        bool await_suspend(std::coroutine_handle<> handle) noexcept
         {
             continuation_ = handle;
+            // Already set: carry on without suspending.
+            return !ready_.exchange(true, std::memory_order_acq_rel);
         }
 
         message::list await_resume()
@@ -37,36 +57,43 @@ namespace sio
             {
                 std::rethrow_exception(exception_);
             }
-            return result_;
+            return std::move(result_);
         }
 
         // Called by callback when response arrives
-        void set_result(message::list const &result)
+        void set_result(message::list &&result)
         {
-            result_ = std::move(const_cast<message::list&>(result));
-            if (continuation_)
-            {
-                continuation_.resume();
-            }
+            result_ = std::move(result);
+            complete();
         }
 
         // Called by callback when timeout occurs
         void set_exception(std::exception_ptr ex)
         {
             exception_ = ex;
-            if (continuation_)
+            complete();
+        }
+
+    private:
+        void complete()
+        {
+            // The coroutine may finish and free this awaiter during resume().
+            if (ready_.exchange(true, std::memory_order_acq_rel))
             {
                 continuation_.resume();
             }
         }
 
-    private:
         std::coroutine_handle<> continuation_;
         message::list result_;
         std::exception_ptr exception_;
+        std::atomic<bool> ready_{false};
     };
 
-    // Task type for coroutine functions
+    // Task type for coroutine functions. It starts running at once; co_await
+    // it from another coroutine, which resumes where the task finishes, or
+    // block on get_result. Dropping the task before it finishes detaches it:
+    // it runs to the end and frees itself. Frames come from message_pool.
     class emit_task
     {
     public:
@@ -74,6 +101,19 @@ namespace sio
         {
             message::list result_value;
             std::exception_ptr exception_ptr;
+            // running, done, detached, or who resumes on completion: a
+            // coroutine address, or a sync_waiter address tagged with waiter_bit.
+            std::atomic<std::uintptr_t> state{running};
+
+            static void *operator new(std::size_t bytes)
+            {
+                return message_pool::allocate(bytes);
+            }
+
+            static void operator delete(void *p, std::size_t bytes) noexcept
+            {
+                message_pool::deallocate(p, bytes);
+            }
 
             emit_task get_return_object()
             {
@@ -81,11 +121,44 @@ namespace sio
             }
 
             std::suspend_never initial_suspend() noexcept { return {}; }
-            std::suspend_always final_suspend() noexcept { return {}; }
+
+            struct final_awaiter
+            {
+                bool await_ready() const noexcept { return false; }
+
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+                {
+                    // Nothing in the frame may be touched once state is done:
+                    // the owner can destroy it from then on.
+                    std::uintptr_t prev = h.promise().state.exchange(done, std::memory_order_acq_rel);
+                    if (prev == detached)
+                    {
+                        h.destroy();
+                    }
+                    else if (prev & waiter_bit)
+                    {
+                        reinterpret_cast<sync_waiter *>(prev & ~waiter_bit)->wake();
+                    }
+                    else if (prev != running)
+                    {
+                        return std::coroutine_handle<>::from_address(reinterpret_cast<void *>(prev));
+                    }
+                    return std::noop_coroutine();
+                }
+
+                void await_resume() const noexcept {}
+            };
+
+            final_awaiter final_suspend() noexcept { return {}; }
+
+            void return_value(message::list &&value)
+            {
+                result_value = std::move(value);
+            }
 
             void return_value(message::list const &value)
             {
-                result_value = std::move(const_cast<message::list&>(value));
+                result_value = value;
             }
 
             void unhandled_exception()
@@ -105,8 +178,7 @@ namespace sio
         {
             if (this != &other)
             {
-                if (handle_)
-                    handle_.destroy();
+                release();
                 handle_ = other.handle_;
                 other.handle_ = nullptr;
             }
@@ -115,20 +187,21 @@ namespace sio
 
         ~emit_task()
         {
-            if (handle_)
-                handle_.destroy();
+            release();
         }
 
         // Make task awaitable
         bool await_ready() const noexcept
         {
-            return false;
+            return handle_.promise().state.load(std::memory_order_acquire) == done;
         }
 
-        void await_suspend(std::coroutine_handle<> continuation) noexcept
+        bool await_suspend(std::coroutine_handle<> continuation) noexcept
         {
-            continuation_ = continuation;
-            handle_.resume();
+            std::uintptr_t expected = running;
+            // Fails only if the task finished meanwhile: carry on without suspending.
+            return handle_.promise().state.compare_exchange_strong(expected, reinterpret_cast<std::uintptr_t>(continuation.address()),
+                                                                   std::memory_order_acq_rel, std::memory_order_acquire);
         }
 
         message::list await_resume()
@@ -137,21 +210,64 @@ namespace sio
             {
                 std::rethrow_exception(handle_.promise().exception_ptr);
             }
-            return handle_.promise().result_value;
+            return std::move(handle_.promise().result_value);
         }
 
+        // Blocks until the task finishes, so never call it on the io thread or
+        // from a listener: the ack it waits for would never be read.
         message::list get_result()
         {
-            if (!handle_.done())
+            std::atomic<std::uintptr_t> &state = handle_.promise().state;
+            if (state.load(std::memory_order_acquire) != done)
             {
-                handle_.resume();
+                sync_waiter waiter;
+                std::uintptr_t expected = running;
+                if (state.compare_exchange_strong(expected, reinterpret_cast<std::uintptr_t>(&waiter) | waiter_bit,
+                                                  std::memory_order_acq_rel, std::memory_order_acquire))
+                {
+                    waiter.wait();
+                }
             }
             return await_resume();
         }
 
     private:
+        static constexpr std::uintptr_t running = 0;
+        static constexpr std::uintptr_t done = 1;
+        static constexpr std::uintptr_t detached = 2;
+        static constexpr std::uintptr_t waiter_bit = 1;
+
+        struct sync_waiter
+        {
+            void wait()
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [this] { return woken; });
+            }
+
+            // Notifies under the lock so the waiter can't return, and go out
+            // of scope, before this is done with it.
+            void wake()
+            {
+                std::lock_guard<std::mutex> guard(mutex);
+                woken = true;
+                cond.notify_one();
+            }
+
+            std::mutex mutex;
+            std::condition_variable cond;
+            bool woken = false;
+        };
+
+        void release()
+        {
+            if (handle_ && handle_.promise().state.exchange(detached, std::memory_order_acq_rel) == done)
+            {
+                handle_.destroy();
+            }
+        }
+
         std::coroutine_handle<promise_type> handle_;
-        std::coroutine_handle<> continuation_;
     };
 
 } // namespace sio
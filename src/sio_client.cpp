@@ -166,6 +166,7 @@ namespace sio
             m_impl->set_reconnect_attempts(config.attempts);
             m_impl->set_reconnect_delay(config.delay);
             m_impl->set_reconnect_delay_max(config.delay_max);
+            m_impl->set_reconnect_randomization(config.randomization_factor);
         } else {
             // Disable reconnection by setting attempts to 0
             m_impl->set_reconnect_attempts(0);
@@ -11,6 +11,7 @@
 #include <memory>
 #include "sio_message.h"
 #include "sio_socket.h"
+#include "sio_trace.h"
 
 namespace asio
 {
@@ -20,10 +21,88 @@ namespace asio
 namespace sio
 {
     class client_impl;
+    class client_hub;
 
     struct client_options
     {
         asio::io_context *io_context = nullptr;
+        // Start a network thread running io_context on connect. Set to false when the
+        // caller already runs io_context (client_hub does): sync_close() and the
+        // destructor then wait for the connection to close instead of joining a
+        // thread, and must not be called from a thread running io_context.
+        bool run_io_thread = true;
+
+        // Decode inbound string values as views into a per-packet buffer instead of
+        // copying each one. Use message::get_string_view() to read them without copies;
+        // a decoded message keeps its packet's buffer alive while referenced.
+        bool zero_copy_decode = false;
+        // Keep event arguments as raw JSON and decode them on first access. Handlers
+        // that read a few fields via event::get_field() skip building the message tree.
+        bool lazy_decode = false;
+
+        // Outbound frames are queued and written by the io thread in batches, so a
+        // burst of emits reaches the transport as one gathered write. A batch stops
+        // once it reaches this many bytes; the rest follow in the next pass.
+        size_t send_batch_max_bytes = 64 * 1024;
+        // Wait up to this long for more frames before writing a batch. 0 writes as
+        // soon as the io thread gets to the queue.
+        unsigned send_linger_us = 0;
+        // While the transport holds this many unwritten bytes, queued frames wait for
+        // it to drain (emit_latest values keep being replaced meanwhile) and
+        // socket::emit_volatile drops. 0, the default, disables the check.
+        size_t send_backlog_max_bytes = 0;
+
+        enum class handler_ordering
+        {
+            per_namespace, // Events and acks of one namespace run in order
+            per_event      // Only events of the same name (and namespace) are ordered
+        };
+
+        // Run event and ack handlers on this many worker threads instead of the io
+        // thread, so a slow handler doesn't hold up pings or other namespaces.
+        // A namespace's connect, disconnect and error still run on the io thread,
+        // in order with its events. 0 runs them on the io thread.
+        unsigned event_worker_threads = 0;
+        handler_ordering worker_ordering = handler_ordering::per_namespace;
+
+        // Compress outbound frames of at least compress_min_bytes with permessage-deflate
+        // (RFC 7692), once the server's handshake response accepted the extension.
+        // Needs a build with ENABLE_PERMESSAGE_DEFLATE, which offers the extension on
+        // every connection, so the server may compress inbound frames even with this
+        // off. Each connection keeps one deflate and one inflate stream throughout.
+        bool permessage_deflate = false;
+        size_t compress_min_bytes = 1024;
+
+        // Opt in to caching the server's address and reusing it on reconnects,
+        // looking the host up again in the background once the entry is this old.
+        // Each lookup that races TCP connections to the host's IPv6 and IPv4
+        // addresses, started connect_attempt_delay_ms apart (RFC 8305), keeps the
+        // first to connect and closes it, so the server sees one extra connection.
+        // The transport then connects to the address, naming the host in the Host
+        // header and SNI. A failed connect drops the entry. 0, the default, leaves
+        // resolving to the transport on every attempt; it always does through a proxy.
+        unsigned dns_refresh_ms = 0;
+        unsigned connect_attempt_delay_ms = 250;
+
+        enum class wire_format
+        {
+            json,   // socket.io-parser, the server default
+            msgpack // socket.io-msgpack-parser; the server must use it too
+        };
+
+        // Packet encoding. msgpack sends each packet as one binary frame with
+        // attachments inline and numbers in binary; lazy_decode doesn't apply to it.
+        wire_format parser = wire_format::json;
+
+        // Time encoding, decoding, send queue waits and io-thread handlers into the
+        // histograms of transport_metrics. Each costs a clock read or two per packet;
+        // counters and ack round trips are kept either way.
+        bool record_timings = true;
+
+        // Called at the start and end of each stage of every packet (see
+        // trace_point), from whichever thread runs it. Ignored in builds with
+        // DISABLE_TRACING.
+        trace_listener tracer;
     };
 
     struct reconnect_config
@@ -31,6 +110,10 @@ namespace sio
         unsigned attempts = static_cast<unsigned>(-1); // Infinite by default
         unsigned delay = 5000;                       // 5 seconds
         unsigned delay_max = 25000;                  // 25 seconds
+        // Each delay is drawn from delay * (1 +- randomization_factor), capped at
+        // delay_max, so clients dropped together don't come back in lock-step.
+        // 0 keeps delays exact; at most 1.
+        double randomization_factor = 0.5;
         bool enabled = true;
 
         reconnect_config() = default;
@@ -174,6 +257,8 @@ namespace sio
             void operator()(client_impl *p) const;
         };
         std::unique_ptr<client_impl, impl_deleter> m_impl;
+
+        friend class client_hub;
     };
 
 }
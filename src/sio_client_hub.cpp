@@ -0,0 +1,103 @@
+//
+//  sio_client_hub.cpp
+//
+
+#include "sio_client_hub.h"
+#include "internal/sio_client_impl.h"
+#include <asio/executor_work_guard.hpp>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace sio
+{
+    class client_hub::impl
+    {
+    public:
+        explicit impl(unsigned io_threads) : m_next(0)
+        {
+            if (io_threads == 0)
+            {
+                io_threads = std::thread::hardware_concurrency();
+            }
+            if (io_threads == 0)
+            {
+                io_threads = 1;
+            }
+            m_shards.reserve(io_threads);
+            for (unsigned i = 0; i < io_threads; ++i)
+            {
+                // One thread per context keeps each client's handlers serialized.
+                std::unique_ptr<shard> s(new shard());
+                s->thread = std::thread([ctx = &s->io]() { ctx->run(); });
+                m_shards.push_back(std::move(s));
+            }
+#if SIO_TLS
+            m_tls_context = client_impl::make_tls_context();
+#endif
+        }
+
+        ~impl()
+        {
+            for (auto &s : m_shards)
+            {
+                s->work.reset();
+            }
+            for (auto &s : m_shards)
+            {
+                s->thread.join();
+            }
+        }
+
+        std::unique_ptr<client> make_client(client_options options)
+        {
+            shard &s = *m_shards[m_next.fetch_add(1, std::memory_order_relaxed) % m_shards.size()];
+            options.io_context = &s.io;
+            options.run_io_thread = false;
+            std::unique_ptr<client> c(new client(options));
+#if SIO_TLS
+            c->m_impl->m_tls_context = m_tls_context;
+#endif
+            return c;
+        }
+
+        unsigned get_thread_count() const
+        {
+            return static_cast<unsigned>(m_shards.size());
+        }
+
+    private:
+        struct shard
+        {
+            shard() : work(io.get_executor()) {}
+
+            asio::io_context io;
+            asio::executor_work_guard<asio::io_context::executor_type> work;
+            std::thread thread;
+        };
+
+        std::vector<std::unique_ptr<shard>> m_shards;
+        std::atomic<unsigned> m_next;
+#if SIO_TLS
+        client_impl::context_ptr m_tls_context;
+#endif
+    };
+
+    client_hub::client_hub(unsigned io_threads) : m_impl(new impl(io_threads))
+    {
+    }
+
+    client_hub::~client_hub()
+    {
+    }
+
+    std::unique_ptr<client> client_hub::make_client(client_options options)
+    {
+        return m_impl->make_client(options);
+    }
+
+    unsigned client_hub::get_thread_count() const
+    {
+        return m_impl->get_thread_count();
+    }
+}
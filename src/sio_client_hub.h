@@ -0,0 +1,41 @@
+//
+//  sio_client_hub.h
+//
+//  Runs many clients on a fixed set of io threads.
+//
+
+#ifndef SIO_CLIENT_HUB_H
+#define SIO_CLIENT_HUB_H
+#include <memory>
+#include "sio_client.h"
+
+namespace sio
+{
+    // Shards clients across io threads, one io_context per thread, instead of
+    // each client running a thread of its own. With TLS, every client of a hub
+    // shares one TLS context. Threads grow with io_threads, not with clients.
+    class client_hub
+    {
+    public:
+        // 0 uses one io thread per hardware thread.
+        explicit client_hub(unsigned io_threads = 0);
+
+        // Clients made by the hub must be destroyed first.
+        ~client_hub();
+
+        // A client whose connection runs on the next io thread, round robin.
+        // options.io_context and options.run_io_thread are set by the hub. Don't
+        // destroy the client, or call its sync_close(), from one of its handlers.
+        std::unique_ptr<client> make_client(client_options options = client_options());
+
+        unsigned get_thread_count() const;
+
+    private:
+        client_hub(client_hub const &) = delete;
+        client_hub &operator=(client_hub const &) = delete;
+
+        class impl;
+        std::unique_ptr<impl> m_impl;
+    };
+}
+#endif // SIO_CLIENT_HUB_H
@@ -0,0 +1,411 @@
+//
+//  sio_codec.h
+//
+//  Typed payloads: C++ values written straight to JSON and read back from
+//  it, without building a message tree.
+//
+
+#ifndef SIO_CODEC_H
+#define SIO_CODEC_H
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace sio
+{
+    class message;
+    class packet;
+
+    // Appends JSON text to a string. Commas are inserted automatically; inside
+    // an object, key() comes before each value.
+    class json_writer
+    {
+    public:
+        explicit json_writer(std::string &out) : m_out(out), m_first(true)
+        {
+        }
+
+        void begin_object()
+        {
+            separate();
+            m_out += '{';
+            m_first = true;
+        }
+
+        void end_object()
+        {
+            m_out += '}';
+            m_first = false;
+        }
+
+        void begin_array()
+        {
+            separate();
+            m_out += '[';
+            m_first = true;
+        }
+
+        void end_array()
+        {
+            m_out += ']';
+            m_first = false;
+        }
+
+        void key(std::string_view name);
+
+        void null();
+
+        void value(bool b);
+
+        void value(long long i);
+
+        void value(unsigned long long u);
+
+        void value(double d);
+
+        void value(std::string_view s);
+
+        std::string &str()
+        {
+            return m_out;
+        }
+
+    private:
+        void separate()
+        {
+            if (!m_first)
+            {
+                m_out += ',';
+            }
+            m_first = false;
+        }
+
+        std::string &m_out;
+        bool m_first;
+    };
+
+    // A JSON value being read: either an On-Demand cursor into raw JSON, or a
+    // node of an already decoded message tree. On-Demand values are read once,
+    // front to back; reading a value again or out of order fails.
+    class json_value
+    {
+    public:
+        explicit json_value(message const *msg) : m_ondemand(nullptr), m_message(msg)
+        {
+        }
+
+        bool is_null();
+
+        // Each get() returns false when the value has another type.
+        bool get(bool &out);
+
+        bool get(long long &out);
+
+        bool get(unsigned long long &out);
+
+        bool get(double &out);
+
+        bool get(std::string &out);
+
+        // f(std::string_view key, json_value &value) is called per member and
+        // returns false to fail the read. False if this isn't an object.
+        template <typename F>
+        bool for_each_field(F &&f)
+        {
+            return visit_fields([](void *ctx, std::string_view key, json_value &value)
+                                { return (*static_cast<std::remove_reference_t<F> *>(ctx))(key, value); },
+                                const_cast<void *>(static_cast<void const *>(&f)));
+        }
+
+        // f(json_value &element) per element, as above. False if this isn't an array.
+        template <typename F>
+        bool for_each_element(F &&f)
+        {
+            return visit_elements([](void *ctx, json_value &value)
+                                  { return (*static_cast<std::remove_reference_t<F> *>(ctx))(value); },
+                                  const_cast<void *>(static_cast<void const *>(&f)));
+        }
+
+    private:
+        typedef bool (*field_visitor)(void *ctx, std::string_view key, json_value &value);
+        typedef bool (*element_visitor)(void *ctx, json_value &value);
+
+        // ondemand is a simdjson::ondemand::value.
+        explicit json_value(void *ondemand) : m_ondemand(ondemand), m_message(nullptr)
+        {
+        }
+
+        bool visit_fields(field_visitor visit, void *ctx);
+
+        bool visit_elements(element_visitor visit, void *ctx);
+
+        void *m_ondemand;
+        message const *m_message;
+
+        friend class packet;
+    };
+
+    // codec<T> describes how T maps to JSON:
+    //   static void write(json_writer &w, T const &value);
+    //   static bool read(json_value &in, T &value);
+    // It is provided for bool, arithmetic types, std::string, std::optional,
+    // std::vector, std::map with string keys, and types declared with
+    // SIO_DEFINE_FIELDS; specialize it for anything else.
+    template <typename T, typename = void>
+    struct codec;
+
+    template <typename T>
+    concept has_codec = requires(json_writer &w, json_value &in, T const &cv, T &v) {
+        codec<T>::write(w, cv);
+        { codec<T>::read(in, v) } -> std::same_as<bool>;
+    };
+
+    template <>
+    struct codec<bool>
+    {
+        static void write(json_writer &w, bool value)
+        {
+            w.value(value);
+        }
+
+        static bool read(json_value &in, bool &value)
+        {
+            return in.get(value);
+        }
+    };
+
+    template <typename T>
+    struct codec<T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>>
+    {
+        static void write(json_writer &w, T value)
+        {
+            if constexpr (std::is_signed_v<T>)
+            {
+                w.value(static_cast<long long>(value));
+            }
+            else
+            {
+                w.value(static_cast<unsigned long long>(value));
+            }
+        }
+
+        // Out-of-range numbers fail the read rather than wrap.
+        static bool read(json_value &in, T &value)
+        {
+            if constexpr (std::is_signed_v<T>)
+            {
+                long long v;
+                if (!in.get(v) || v < static_cast<long long>(std::numeric_limits<T>::min()) ||
+                    v > static_cast<long long>(std::numeric_limits<T>::max()))
+                {
+                    return false;
+                }
+                value = static_cast<T>(v);
+            }
+            else
+            {
+                unsigned long long v;
+                if (!in.get(v) || v > static_cast<unsigned long long>(std::numeric_limits<T>::max()))
+                {
+                    return false;
+                }
+                value = static_cast<T>(v);
+            }
+            return true;
+        }
+    };
+
+    template <typename T>
+    struct codec<T, std::enable_if_t<std::is_floating_point_v<T>>>
+    {
+        static void write(json_writer &w, T value)
+        {
+            w.value(static_cast<double>(value));
+        }
+
+        static bool read(json_value &in, T &value)
+        {
+            double v;
+            if (!in.get(v))
+            {
+                return false;
+            }
+            value = static_cast<T>(v);
+            return true;
+        }
+    };
+
+    template <>
+    struct codec<std::string>
+    {
+        static void write(json_writer &w, std::string const &value)
+        {
+            w.value(std::string_view(value));
+        }
+
+        static bool read(json_value &in, std::string &value)
+        {
+            return in.get(value);
+        }
+    };
+
+    // Empty optionals are written as null, and null reads as an empty optional.
+    template <typename T>
+    struct codec<std::optional<T>>
+    {
+        static void write(json_writer &w, std::optional<T> const &value)
+        {
+            if (value)
+            {
+                codec<T>::write(w, *value);
+            }
+            else
+            {
+                w.null();
+            }
+        }
+
+        static bool read(json_value &in, std::optional<T> &value)
+        {
+            if (in.is_null())
+            {
+                value.reset();
+                return true;
+            }
+            value.emplace();
+            return codec<T>::read(in, *value);
+        }
+    };
+
+    template <typename T, typename A>
+    struct codec<std::vector<T, A>>
+    {
+        static void write(json_writer &w, std::vector<T, A> const &value)
+        {
+            w.begin_array();
+            for (T const &element : value)
+            {
+                codec<T>::write(w, element);
+            }
+            w.end_array();
+        }
+
+        static bool read(json_value &in, std::vector<T, A> &value)
+        {
+            value.clear();
+            return in.for_each_element([&value](json_value &element)
+                                       {
+                                           value.emplace_back();
+                                           return codec<T>::read(element, value.back());
+                                       });
+        }
+    };
+
+    template <typename T, typename C, typename A>
+    struct codec<std::map<std::string, T, C, A>>
+    {
+        static void write(json_writer &w, std::map<std::string, T, C, A> const &value)
+        {
+            w.begin_object();
+            for (auto const &member : value)
+            {
+                w.key(member.first);
+                codec<T>::write(w, member.second);
+            }
+            w.end_object();
+        }
+
+        static bool read(json_value &in, std::map<std::string, T, C, A> &value)
+        {
+            value.clear();
+            return in.for_each_field([&value](std::string_view key, json_value &member)
+                                     { return codec<T>::read(member, value[std::string(key)]); });
+        }
+    };
+
+    namespace detail
+    {
+        struct ignore_fields
+        {
+            template <typename M>
+            void operator()(char const *, M &&) const
+            {
+            }
+        };
+
+        // Found by argument-dependent lookup on the functions SIO_DEFINE_FIELDS declares.
+        template <typename T>
+        concept has_fields = requires(T &v, T const &cv) {
+            sio_visit_fields(v, ignore_fields());
+            sio_visit_fields(cv, ignore_fields());
+        };
+    }
+
+    // Declared fields are written as a JSON object in declaration order. On
+    // read, members are matched by name: unknown keys are skipped and missing
+    // ones keep their current value.
+    template <typename T>
+    struct codec<T, std::enable_if_t<detail::has_fields<T>>>
+    {
+        static void write(json_writer &w, T const &value)
+        {
+            w.begin_object();
+            sio_visit_fields(value, [&w](char const *name, auto const &field)
+                             {
+                                 w.key(name);
+                                 codec<std::decay_t<decltype(field)>>::write(w, field);
+                             });
+            w.end_object();
+        }
+
+        static bool read(json_value &in, T &value)
+        {
+            return in.for_each_field([&value](std::string_view key, json_value &member)
+                                     {
+                                         bool ok = true;
+                                         bool found = false;
+                                         sio_visit_fields(value, [&](char const *name, auto &field)
+                                                          {
+                                                              if (!found && key == name)
+                                                              {
+                                                                  found = true;
+                                                                  ok = codec<std::decay_t<decltype(field)>>::read(member, field);
+                                                              }
+                                                          });
+                                         return ok;
+                                     });
+        }
+    };
+}
+
+#define SIO_PP_PARENS ()
+#define SIO_PP_EXPAND(...) SIO_PP_EXPAND3(SIO_PP_EXPAND3(SIO_PP_EXPAND3(SIO_PP_EXPAND3(__VA_ARGS__))))
+#define SIO_PP_EXPAND3(...) SIO_PP_EXPAND2(SIO_PP_EXPAND2(SIO_PP_EXPAND2(SIO_PP_EXPAND2(__VA_ARGS__))))
+#define SIO_PP_EXPAND2(...) SIO_PP_EXPAND1(SIO_PP_EXPAND1(SIO_PP_EXPAND1(SIO_PP_EXPAND1(__VA_ARGS__))))
+#define SIO_PP_EXPAND1(...) __VA_ARGS__
+#define SIO_PP_FOR_EACH(macro, ...) __VA_OPT__(SIO_PP_EXPAND(SIO_PP_FOR_EACH_STEP(macro, __VA_ARGS__)))
+#define SIO_PP_FOR_EACH_STEP(macro, first, ...) macro(first) __VA_OPT__(SIO_PP_FOR_EACH_AGAIN SIO_PP_PARENS(macro, __VA_ARGS__))
+#define SIO_PP_FOR_EACH_AGAIN() SIO_PP_FOR_EACH_STEP
+#define SIO_PP_VISIT_FIELD(field) sio_visit_(#field, sio_self_.field);
+
+// Declares the members of T that make up its JSON object, e.g.
+//     struct telemetry { std::string id; double value; };
+//     SIO_DEFINE_FIELDS(telemetry, id, value)
+// Use it at namespace scope in T's own namespace (up to 64 fields).
+#define SIO_DEFINE_FIELDS(T, ...)                                                         \
+    template <typename sio_self_type_, typename sio_visitor_type_>                        \
+        requires std::is_same_v<std::remove_const_t<sio_self_type_>, T>                   \
+    inline void sio_visit_fields(sio_self_type_ &sio_self_, sio_visitor_type_ &&sio_visit_) \
+    {                                                                                     \
+        SIO_PP_FOR_EACH(SIO_PP_VISIT_FIELD, __VA_ARGS__)                                  \
+    }
+
+#endif // SIO_CODEC_H
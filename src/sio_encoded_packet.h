@@ -0,0 +1,64 @@
+//
+//  sio_encoded_packet.h
+//
+//  An event serialized once, for sending many times.
+//
+
+#ifndef SIO_ENCODED_PACKET_H
+#define SIO_ENCODED_PACKET_H
+#include "sio_message.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace sio
+{
+    // The JSON and binary attachments of an event, encoded once and immutable
+    // afterwards. It can be emitted any number of times, on any socket of any
+    // client; each send only writes the packet header (namespace, ack id) in
+    // front of the stored JSON.
+    class encoded_packet
+    {
+    public:
+        typedef std::shared_ptr<const encoded_packet> ptr;
+
+        static ptr create(std::string const &event_name, message::list const &msglist = nullptr);
+
+        // event_array is a complete JSON event array, name first, sent as is.
+        static ptr from_json(std::string const &event_name, std::string &&event_array);
+
+        std::string const &get_event_name() const
+        {
+            return m_event_name;
+        }
+
+        // The event array, with placeholders for the attachments.
+        std::string const &get_json() const
+        {
+            return m_json;
+        }
+
+        std::vector<std::shared_ptr<const std::string>> const &get_buffers() const
+        {
+            return m_buffers;
+        }
+
+        size_t get_size() const
+        {
+            size_t size = m_json.size();
+            for (auto const &buffer : m_buffers)
+            {
+                size += buffer->size();
+            }
+            return size;
+        }
+
+    private:
+        encoded_packet() = default;
+
+        std::string m_event_name;
+        std::string m_json;
+        std::vector<std::shared_ptr<const std::string>> m_buffers;
+    };
+}
+#endif // SIO_ENCODED_PACKET_H
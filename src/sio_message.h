@@ -7,11 +7,16 @@
 #ifndef __SIO_MESSAGE_H__
 #define __SIO_MESSAGE_H__
 #include <string>
+#include <string_view>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
 #include <vector>
 #include <map>
 #include <cassert>
 #include <type_traits>
+#include "sio_message_pool.h"
 namespace sio
 {
     class message
@@ -65,6 +70,14 @@ namespace sio
             return s_empty_string;
         }
 
+        // View of a string value; valid while the message is alive.
+        // Unlike get_string(), never materializes a std::string copy.
+        virtual std::string_view get_string_view() const
+        {
+            assert(false);
+            return std::string_view();
+        }
+
         virtual std::shared_ptr<const std::string> const &get_binary() const
         {
             assert(false);
@@ -107,6 +120,21 @@ namespace sio
 
     protected:
         message(flag f) : _flag(f) {}
+
+        // Node and reference count share one allocation from the thread-local message pool.
+        template <typename T, typename... Args>
+        static ptr make(Args &&...args)
+        {
+            struct node : T
+            {
+                node(Args &&...a) : T(std::forward<Args>(a)...) {}
+            };
+#ifdef SIO_DISABLE_MESSAGE_POOL
+            return std::make_shared<node>(std::forward<Args>(args)...);
+#else
+            return std::allocate_shared<node>(message_allocator<node>(), std::forward<Args>(args)...);
+#endif
+        }
     };
 
     class null_message : public message
@@ -120,7 +148,7 @@ namespace sio
     public:
         static message::ptr create()
         {
-            return ptr(new null_message());
+            return make<null_message>();
         }
     };
 
@@ -137,7 +165,7 @@ namespace sio
     public:
         static message::ptr create(bool v)
         {
-            return ptr(new bool_message(v));
+            return make<bool_message>(v);
         }
 
         bool get_bool() const override
@@ -159,7 +187,7 @@ namespace sio
     public:
         static message::ptr create(int64_t v)
         {
-            return ptr(new int_message(v));
+            return make<int_message>(v);
         }
 
         int64_t get_int() const override
@@ -176,6 +204,8 @@ namespace sio
     class double_message : public message
     {
         double _v;
+
+    protected:
         double_message(double v)
             : message(flag_double), _v(v)
         {
@@ -184,7 +214,7 @@ namespace sio
     public:
         static message::ptr create(double v)
         {
-            return ptr(new double_message(v));
+            return make<double_message>(v);
         }
 
         double get_double() const override
@@ -195,32 +225,59 @@ namespace sio
 
     class string_message : public message
     {
-        std::string _v;
+        mutable std::string _v;
+        std::string_view _view;
+        std::shared_ptr<const void> _owner;
+        mutable std::once_flag _materialized;
+
+    protected:
         string_message(std::string const &v)
-            : message(flag_string), _v(v)
+            : message(flag_string), _v(v), _view(_v)
         {
         }
 
         string_message(std::string &&v)
-            : message(flag_string), _v(std::move(v))
+            : message(flag_string), _v(std::move(v)), _view(_v)
+        {
+        }
+
+        string_message(std::string_view v, std::shared_ptr<const void> const &owner)
+            : message(flag_string), _view(v), _owner(owner)
         {
         }
 
     public:
         static message::ptr create(std::string const &v)
         {
-            return ptr(new string_message(v));
+            return make<string_message>(v);
         }
 
         static message::ptr create(std::string &&v)
         {
-            return ptr(new string_message(std::move(v)));
+            return make<string_message>(std::move(v));
+        }
+
+        // Zero-copy creation: references storage kept alive by owner
+        // (e.g. the decoded packet's arena) instead of copying it.
+        static message::ptr create_view(std::string_view v, std::shared_ptr<const void> const &owner)
+        {
+            return make<string_message>(v, owner);
         }
 
         std::string const &get_string() const override
         {
+            // Lazy conversion: only copy a borrowed view when a std::string is asked for
+            if (_owner)
+            {
+                std::call_once(_materialized, [this]() { _v.assign(_view.data(), _view.size()); });
+            }
             return _v;
         }
+
+        std::string_view get_string_view() const override
+        {
+            return _view;
+        }
     };
 
     class binary_message : public message
@@ -229,6 +286,7 @@ namespace sio
         std::shared_ptr<const std::vector<uint8_t>> _vec;
         mutable std::shared_ptr<const std::string> _cached_str;
 
+    protected:
         binary_message(std::shared_ptr<const std::string> const &v)
             : message(flag_binary), _v(v)
         {
@@ -242,21 +300,20 @@ namespace sio
     public:
         static message::ptr create(std::shared_ptr<const std::string> const &v)
         {
-            return ptr(new binary_message(v));
+            return make<binary_message>(v);
         }
 
         // Zero-copy creation from vector<uint8_t> shared_ptr
         static message::ptr create(std::shared_ptr<const std::vector<uint8_t>> const &v)
         {
-            return ptr(new binary_message(v));
+            return make<binary_message>(v);
         }
 
         // Convenience: move vector into shared_ptr (single allocation, no copy)
         static message::ptr create(std::vector<uint8_t> &&v)
         {
-            return ptr(new binary_message(
-                std::make_shared<const std::vector<uint8_t>>(std::move(v))
-            ));
+            return make<binary_message>(
+                std::make_shared<const std::vector<uint8_t>>(std::move(v)));
         }
 
         std::shared_ptr<const std::string> const &get_binary() const override
@@ -276,6 +333,8 @@ namespace sio
     class array_message : public message
     {
         std::vector<message::ptr> _v;
+
+    protected:
         array_message() : message(flag_array)
         {
         }
@@ -283,7 +342,7 @@ namespace sio
     public:
         static message::ptr create()
         {
-            return ptr(new array_message());
+            return make<array_message>();
         }
 
         void push(message::ptr const &msg)
@@ -369,76 +428,207 @@ namespace sio
 
     class object_message : public message
     {
-        std::map<std::string, message::ptr> _v;
-        object_message() : message(flag_object)
+    public:
+        typedef std::pair<std::string, message::ptr> field;
+
+    private:
+        // Fields in insertion (wire) order. get_map() moves the object to map
+        // storage for good, since callers may modify the returned map directly.
+        mutable std::vector<field> _fields;
+        // Open-addressed index into _fields (slot holds position + 1), built once
+        // an object grows past k_index_threshold fields.
+        mutable std::vector<uint32_t> _index;
+        mutable std::map<std::string, message::ptr> _v;
+        mutable std::atomic<bool> _mapped;
+        mutable std::once_flag _map_once;
+
+        static const size_t k_index_threshold = 16;
+
+        const message::ptr *find(std::string_view key) const
+        {
+            if (_mapped.load(std::memory_order_acquire))
+            {
+                auto it = _v.find(std::string(key));
+                return it != _v.end() ? &it->second : nullptr;
+            }
+            if (!_index.empty())
+            {
+                size_t mask = _index.size() - 1;
+                for (size_t slot = std::hash<std::string_view>()(key) & mask; _index[slot] != 0; slot = (slot + 1) & mask)
+                {
+                    field const &f = _fields[_index[slot] - 1];
+                    if (f.first == key)
+                        return &f.second;
+                }
+                return nullptr;
+            }
+            for (field const &f : _fields)
+            {
+                if (f.first == key)
+                    return &f.second;
+            }
+            return nullptr;
+        }
+
+        void index_slot(size_t pos)
+        {
+            size_t mask = _index.size() - 1;
+            std::string const &key = _fields[pos].first;
+            size_t slot = std::hash<std::string_view>()(key) & mask;
+            for (; _index[slot] != 0; slot = (slot + 1) & mask)
+            {
+                if (_fields[_index[slot] - 1].first == key)
+                    return; // first occurrence wins, as with the map
+            }
+            _index[slot] = static_cast<uint32_t>(pos + 1);
+        }
+
+        void index_field(size_t pos)
+        {
+            if (_fields.size() < k_index_threshold)
+                return;
+            if (_fields.size() * 2 > _index.size())
+            {
+                size_t slots = 64;
+                while (slots < _fields.size() * 4)
+                    slots <<= 1;
+                _index.assign(slots, 0);
+                for (size_t i = 0; i < _fields.size(); ++i)
+                    index_slot(i);
+                return;
+            }
+            index_slot(pos);
+        }
+
+        void to_map() const
+        {
+            std::call_once(_map_once, [this]() {
+                for (field &f : _fields)
+                    _v.emplace(std::move(f.first), std::move(f.second));
+                _mapped.store(true, std::memory_order_release);
+                // Only the map is kept from here on, so reading once doesn't double the object.
+                std::vector<field>().swap(_fields);
+                std::vector<uint32_t>().swap(_index);
+            });
+        }
+
+        void assign(const std::string &key, message::ptr const &msg)
+        {
+            if (_mapped.load(std::memory_order_acquire))
+            {
+                _v[key] = msg;
+                return;
+            }
+            if (const message::ptr *existing = find(key))
+            {
+                *const_cast<message::ptr *>(existing) = msg;
+                return;
+            }
+            _fields.emplace_back(key, msg);
+            index_field(_fields.size() - 1);
+        }
+
+    protected:
+        object_message() : message(flag_object), _mapped(false)
         {
         }
 
     public:
         static message::ptr create()
         {
-            return ptr(new object_message());
+            return make<object_message>();
         }
 
         void insert(const std::string &key, message::ptr const &msg)
         {
-            _v[key] = msg;
+            assign(key, msg);
         }
 
         void insert(const std::string &key, const std::string &text)
         {
-            _v[key] = string_message::create(text);
+            assign(key, string_message::create(text));
         }
 
         void insert(const std::string &key, std::string &&text)
         {
-            _v[key] = string_message::create(std::move(text));
+            assign(key, string_message::create(std::move(text)));
         }
 
         void insert(const std::string &key, std::shared_ptr<std::string> const &binary)
         {
             if (binary)
-                _v[key] = binary_message::create(binary);
+                assign(key, binary_message::create(binary));
         }
 
         void insert(const std::string &key, std::shared_ptr<const std::string> const &binary)
         {
             if (binary)
-                _v[key] = binary_message::create(binary);
+                assign(key, binary_message::create(binary));
         }
 
-        bool has(const std::string &key)
+        // Append without looking for an existing key, keeping wire order; used by decoders.
+        // On a repeated key, lookups and get_map() see the first value.
+        void append(std::string &&key, message::ptr const &msg)
         {
-            return _v.find(key) != _v.end();
+            if (_mapped.load(std::memory_order_acquire))
+            {
+                _v.emplace(std::move(key), msg);
+                return;
+            }
+            _fields.emplace_back(std::move(key), msg);
+            index_field(_fields.size() - 1);
         }
 
-        const message::ptr &at(const std::string &key) const
+        bool has(const std::string &key)
         {
-            static std::shared_ptr<message> not_found;
+            return find(key) != nullptr;
+        }
 
-            std::map<std::string, message::ptr>::const_iterator it = _v.find(key);
-            if (it != _v.cend())
-                return it->second;
-            return not_found;
+        // By value: a reference into the fields would not survive the next insert.
+        message::ptr at(const std::string &key) const
+        {
+            const message::ptr *value = find(key);
+            return value ? *value : message::ptr();
         }
 
-        const message::ptr &operator[](const std::string &key) const
+        message::ptr operator[](const std::string &key) const
         {
             return at(key);
         }
 
         bool has(const std::string &key) const
         {
-            return _v.find(key) != _v.end();
+            return find(key) != nullptr;
+        }
+
+        size_t size() const
+        {
+            return _mapped.load(std::memory_order_acquire) ? _v.size() : _fields.size();
+        }
+
+        // True while fields are kept in insertion order, i.e. until get_map() is called.
+        bool is_ordered() const
+        {
+            return !_mapped.load(std::memory_order_acquire);
+        }
+
+        // Fields in insertion (wire) order; only meaningful while is_ordered().
+        const std::vector<field> &get_fields() const
+        {
+            return _fields;
         }
 
+        // Both overloads switch the object to map storage and drop the ordered
+        // fields, so don't call them while another thread iterates get_fields().
         std::map<std::string, message::ptr> &get_map() override
         {
+            to_map();
             return _v;
         }
 
         const std::map<std::string, message::ptr> &get_map() const override
         {
+            to_map();
             return _v;
         }
     };
@@ -458,12 +648,18 @@ namespace sio
         {
         }
 
-        list &operator=(const message::list &&rhs)
+        list &operator=(message::list &&rhs)
         {
             m_vector = std::move(rhs.m_vector);
             return *this;
         }
 
+        list &operator=(message::list const &rhs)
+        {
+            m_vector = rhs.m_vector;
+            return *this;
+        }
+
         template <typename T>
         list(T &&content,
              typename std::enable_if<std::is_same<std::vector<message::ptr>, typename std::remove_reference<T>::type>::value>::type * = 0) : m_vector(std::forward<T>(content))
@@ -572,21 +768,41 @@ namespace sio
             return m_vector[i];
         }
 
-        message::ptr to_array_message(std::string const &event_name) const
+        message::ptr to_array_message(std::string const &event_name) const &
         {
             message::ptr arr = array_message::create();
+            arr->get_vector().reserve(m_vector.size() + 1);
             arr->get_vector().push_back(string_message::create(event_name));
             arr->get_vector().insert(arr->get_vector().end(), m_vector.begin(), m_vector.end());
             return arr;
         }
 
-        message::ptr to_array_message() const
+        message::ptr to_array_message() const &
         {
             message::ptr arr = array_message::create();
             arr->get_vector().insert(arr->get_vector().end(), m_vector.begin(), m_vector.end());
             return arr;
         }
 
+        // Rvalue variants hand the elements over instead of sharing them.
+        message::ptr to_array_message(std::string const &event_name) &&
+        {
+            message::ptr arr = array_message::create();
+            arr->get_vector().reserve(m_vector.size() + 1);
+            arr->get_vector().push_back(string_message::create(event_name));
+            arr->get_vector().insert(arr->get_vector().end(), std::make_move_iterator(m_vector.begin()), std::make_move_iterator(m_vector.end()));
+            m_vector.clear();
+            return arr;
+        }
+
+        message::ptr to_array_message() &&
+        {
+            message::ptr arr = array_message::create();
+            arr->get_vector() = std::move(m_vector);
+            m_vector.clear();
+            return arr;
+        }
+
     private:
         std::vector<message::ptr> m_vector;
     };
@@ -0,0 +1,250 @@
+//
+//  sio_message_pool.h
+//
+//  Thread-local pool backing sio::message node allocation.
+//
+
+#ifndef __SIO_MESSAGE_POOL_H__
+#define __SIO_MESSAGE_POOL_H__
+#include <atomic>
+#include <cstddef>
+#include <new>
+namespace sio
+{
+    // Free lists of fixed size classes, one set per thread, so decoding on
+    // several io threads doesn't contend on the global allocator. Each block
+    // remembers the thread pool it came from: freed on that thread it goes
+    // straight back on its list, freed anywhere else it is pushed on a
+    // lock-free stack the owner takes over the next time its list runs dry.
+    // Blocks built by a producer and released on the io thread are reused by
+    // the producer. Lists are capped; a thread's pool outlives it, and is
+    // adopted by the next thread to start.
+    class message_pool
+    {
+    public:
+        static const std::size_t granularity = 16;
+        static const std::size_t class_count = 16; // blocks up to 256 bytes
+        static const std::size_t max_cached = 4096; // per size class and thread
+
+        static void *allocate(std::size_t bytes)
+        {
+            std::size_t idx = (bytes - 1) / granularity;
+            if (bytes == 0 || idx >= class_count)
+            {
+                return ::operator new(bytes);
+            }
+            heap *h = s_released ? nullptr : local();
+            if (h)
+            {
+                if (header *b = h->pop(idx))
+                {
+                    return b + 1;
+                }
+            }
+            header *b = static_cast<header *>(::operator new(sizeof(header) + (idx + 1) * granularity));
+            b->owner = h;
+            return b + 1;
+        }
+
+        static void deallocate(void *p, std::size_t bytes) noexcept
+        {
+            std::size_t idx = (bytes - 1) / granularity;
+            if (bytes == 0 || idx >= class_count)
+            {
+                ::operator delete(p);
+                return;
+            }
+            header *b = static_cast<header *>(p) - 1;
+            heap *owner = b->owner;
+            if (!owner)
+            {
+                ::operator delete(b);
+            }
+            else if (!s_released && owner == local())
+            {
+                owner->push(idx, b);
+            }
+            else
+            {
+                owner->push_remote(idx, b);
+            }
+        }
+
+    private:
+        struct heap;
+
+        // Precedes every pooled block, 16 bytes on 64-bit targets; keeps the
+        // block max_align_t aligned.
+        struct alignas(std::max_align_t) header
+        {
+            heap *owner;
+            header *next;
+        };
+
+        struct heap
+        {
+            header *pop(std::size_t idx)
+            {
+                if (!m_free[idx])
+                {
+                    take_remote(idx);
+                }
+                header *b = m_free[idx];
+                if (b)
+                {
+                    m_free[idx] = b->next;
+                    --m_count[idx];
+                }
+                return b;
+            }
+
+            void push(std::size_t idx, header *b)
+            {
+                if (m_count[idx] >= max_cached)
+                {
+                    ::operator delete(b);
+                    return;
+                }
+                b->next = m_free[idx];
+                m_free[idx] = b;
+                ++m_count[idx];
+            }
+
+            void push_remote(std::size_t idx, header *b)
+            {
+                header *top = m_remote[idx].load(std::memory_order_relaxed);
+                do
+                {
+                    b->next = top;
+                } while (!m_remote[idx].compare_exchange_weak(top, b, std::memory_order_release, std::memory_order_relaxed));
+            }
+
+            // Only the owner takes, and always the whole stack, so there is no ABA.
+            void take_remote(std::size_t idx)
+            {
+                header *b = m_remote[idx].exchange(nullptr, std::memory_order_acquire);
+                while (b)
+                {
+                    header *next = b->next;
+                    push(idx, b);
+                    b = next;
+                }
+            }
+
+            void release()
+            {
+                for (std::size_t i = 0; i < class_count; ++i)
+                {
+                    take_remote(i);
+                    while (header *b = m_free[i])
+                    {
+                        m_free[i] = b->next;
+                        ::operator delete(b);
+                    }
+                    m_count[i] = 0;
+                }
+            }
+
+            header *m_free[class_count] = {};
+            std::size_t m_count[class_count] = {};
+            std::atomic<header *> m_remote[class_count] = {};
+            heap *m_next_abandoned = nullptr;
+        };
+
+        // Remote frees may still reach a pool after its thread ends, so pools
+        // are never destroyed: an exiting thread empties its own and parks it
+        // for the next thread to start.
+        struct heap_owner
+        {
+            heap_owner() : h(adopt()) {}
+
+            ~heap_owner()
+            {
+                h->release();
+                lock();
+                h->m_next_abandoned = s_abandoned;
+                s_abandoned = h;
+                unlock();
+                // Blocks released later during thread teardown bypass the pool.
+                s_released = true;
+            }
+
+            static heap *adopt()
+            {
+                lock();
+                heap *h = s_abandoned;
+                if (h)
+                {
+                    s_abandoned = h->m_next_abandoned;
+                }
+                unlock();
+                return h ? h : new heap();
+            }
+
+            heap *h;
+        };
+
+        message_pool() = delete;
+
+        static heap *local()
+        {
+            static thread_local heap_owner s_owner;
+            return s_owner.h;
+        }
+
+        // A spin lock rather than a mutex: it is only taken at thread start and
+        // exit, and stays usable while static destructors run.
+        static void lock()
+        {
+            while (s_abandoned_lock.test_and_set(std::memory_order_acquire))
+            {
+            }
+        }
+
+        static void unlock()
+        {
+            s_abandoned_lock.clear(std::memory_order_release);
+        }
+
+        static inline thread_local bool s_released = false;
+        static inline std::atomic_flag s_abandoned_lock = ATOMIC_FLAG_INIT;
+        static inline heap *s_abandoned = nullptr;
+    };
+
+    // Standard allocator over message_pool, for std::allocate_shared.
+    template <typename T>
+    struct message_allocator
+    {
+        typedef T value_type;
+
+        static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned types are not pooled");
+
+        message_allocator() noexcept {}
+
+        template <typename U>
+        message_allocator(message_allocator<U> const &) noexcept {}
+
+        T *allocate(std::size_t n)
+        {
+            return static_cast<T *>(message_pool::allocate(n * sizeof(T)));
+        }
+
+        void deallocate(T *p, std::size_t n) noexcept
+        {
+            message_pool::deallocate(p, n * sizeof(T));
+        }
+
+        template <typename U>
+        bool operator==(message_allocator<U> const &) const noexcept
+        {
+            return true;
+        }
+
+        template <typename U>
+        bool operator!=(message_allocator<U> const &) const noexcept
+        {
+            return false;
+        }
+    };
+}
+#endif // __SIO_MESSAGE_POOL_H__
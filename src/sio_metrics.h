@@ -0,0 +1,103 @@
+//
+//  sio_metrics.h
+//
+//  Snapshots of the client's latency histograms and traffic counters.
+//
+
+#ifndef SIO_METRICS_H
+#define SIO_METRICS_H
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace sio
+{
+    // A copy of one latency distribution at the time it was taken. Samples are
+    // grouped HDR-style: 16 linear buckets per power of two, so any reported
+    // value is within 1/16 (6.25%) of the recorded one.
+    struct latency_histogram
+    {
+        struct bucket
+        {
+            // Largest value counted in the bucket.
+            std::chrono::nanoseconds upper_bound;
+            std::uint64_t count;
+        };
+
+        std::uint64_t count = 0;
+        std::chrono::nanoseconds sum{0};
+        std::chrono::nanoseconds min{0};
+        std::chrono::nanoseconds max{0};
+        // Non-empty buckets, in increasing order.
+        std::vector<bucket> buckets;
+
+        std::chrono::nanoseconds mean() const
+        {
+            return count > 0 ? sum / static_cast<std::int64_t>(count) : std::chrono::nanoseconds(0);
+        }
+
+        // Upper bound of the bucket holding quantile q (0..1), clamped to max.
+        std::chrono::nanoseconds percentile(double q) const
+        {
+            if (count == 0)
+            {
+                return std::chrono::nanoseconds(0);
+            }
+            std::uint64_t rank = static_cast<std::uint64_t>(q * static_cast<double>(count) + 0.5);
+            rank = rank < 1 ? 1 : (rank > count ? count : rank);
+            std::uint64_t seen = 0;
+            for (bucket const &b : buckets)
+            {
+                seen += b.count;
+                if (seen >= rank)
+                {
+                    return b.upper_bound < max ? b.upper_bound : max;
+                }
+            }
+            return max;
+        }
+
+        // Samples no larger than bound; Prometheus' cumulative "le" buckets.
+        std::uint64_t count_at_most(std::chrono::nanoseconds bound) const
+        {
+            std::uint64_t total = 0;
+            for (bucket const &b : buckets)
+            {
+                if (b.upper_bound > bound)
+                {
+                    break;
+                }
+                total += b.count;
+            }
+            return total;
+        }
+    };
+
+    // Client-wide counters, shared by every socket of the client. Times are
+    // only recorded with client_options::record_timings.
+    struct transport_metrics
+    {
+        // Websocket frames and payload bytes written and read.
+        std::uint64_t frames_sent = 0;
+        std::uint64_t frames_received = 0;
+        std::uint64_t bytes_sent = 0;
+        std::uint64_t bytes_received = 0;
+
+        // Encoded frames waiting for the io thread to write them, now and at most.
+        std::size_t send_queue_frames = 0;
+        std::size_t send_queue_bytes = 0;
+        std::size_t send_queue_peak_frames = 0;
+
+        // Encoding one outbound packet into frames.
+        latency_histogram encode_time;
+        // Decoding one inbound frame, handlers excluded.
+        latency_histogram decode_time;
+        // From a frame entering the send queue to its websocket write.
+        latency_histogram send_queue_wait;
+        // Handling one decoded packet on the io thread: the handlers themselves, or
+        // the hand-off with client_options::event_worker_threads.
+        latency_histogram handler_time;
+    };
+}
+#endif // SIO_METRICS_H
@@ -1,13 +1,20 @@
 #include "sio_socket.h"
 #include "internal/sio_packet.h"
 #include "internal/sio_client_impl.h"
+#include "internal/sio_mpsc_queue.h"
+#include "internal/sio_offline_buffer.h"
+#include "internal/sio_timer_wheel.h"
+#include "internal/sio_ack_slab.h"
+#include "internal/sio_histogram.h"
+#include "internal/sio_trace_scope.h"
 #include <asio/steady_timer.hpp>
 #include <asio/error_code.hpp>
-#include <queue>
 #include <vector>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <cstdarg>
+#include <deque>
 #include <functional>
 #include <unordered_map>
 
@@ -36,9 +43,19 @@ namespace sio
             return [func](event &ev) { adapt_func(func, ev); };
         }
 
-        static inline event create_event(std::string const &nsp, std::string const &name, message::list &&message, bool need_ack)
+        static inline event create_event(std::string const &nsp, std::string &&name, message::list &&message, bool need_ack)
         {
-            return event(nsp, name, message, need_ack);
+            return event(nsp, std::move(name), std::move(message), need_ack);
+        }
+
+        static inline event create_lazy_event(std::string const &nsp, std::string &&name, std::shared_ptr<const packet> const &p, bool need_ack)
+        {
+            return event(nsp, std::move(name), p, need_ack);
+        }
+
+        static inline message::list take_ack_message(event &ev)
+        {
+            return std::move(ev.get_ack_message_impl());
         }
     };
 
@@ -54,6 +71,7 @@ namespace sio
 
     const message::ptr &event::get_message() const
     {
+        get_messages();
         if (m_messages.size() > 0)
             return m_messages[0];
         else
@@ -65,9 +83,73 @@ namespace sio
 
     const message::list &event::get_messages() const
     {
+        if (!m_materialized)
+        {
+            m_materialized = true;
+            message::ptr const &msg = m_packet->get_message();
+            if (msg && msg->get_flag() == message::flag_array)
+            {
+                auto const &vec = msg->get_vector();
+                for (size_t i = 1; i < vec.size(); ++i)
+                {
+                    m_messages.push(vec[i]);
+                }
+            }
+        }
         return m_messages;
     }
 
+    std::string_view event::get_raw_json() const
+    {
+        return m_packet ? m_packet->get_raw_json() : std::string_view();
+    }
+
+    message::ptr event::get_field(std::string_view pointer) const
+    {
+        // The first token indexes the arguments, which follow the name in the event array.
+        if (pointer.size() < 2 || pointer[0] != '/')
+        {
+            return message::ptr();
+        }
+        size_t end = pointer.find('/', 1);
+        std::string_view token = pointer.substr(1, end == std::string_view::npos ? std::string_view::npos : end - 1);
+        std::string_view rest = end == std::string_view::npos ? std::string_view() : pointer.substr(end);
+        if (token.empty() || token.size() > 9)
+        {
+            return message::ptr();
+        }
+        size_t index = 0;
+        for (char c : token)
+        {
+            if (c < '0' || c > '9')
+            {
+                return message::ptr();
+            }
+            index = index * 10 + static_cast<size_t>(c - '0');
+        }
+        if (m_materialized)
+        {
+            return index < m_messages.size() ? find_json_pointer(m_messages[index], rest) : message::ptr();
+        }
+        std::string event_pointer = "/" + std::to_string(index + 1);
+        event_pointer.append(rest.data(), rest.size());
+        return m_packet->get_field(event_pointer);
+    }
+
+    bool event::read_argument(size_t index, bool (*read)(json_value &, void *), void *ctx) const
+    {
+        if (m_materialized)
+        {
+            if (index >= m_messages.size())
+            {
+                return false;
+            }
+            json_value in(m_messages[index].get());
+            return read(in, ctx);
+        }
+        return m_packet->read_element(index + 1, read, ctx);
+    }
+
     bool event::need_ack() const
     {
         return m_need_ack;
@@ -76,19 +158,29 @@ namespace sio
     void event::put_ack_message(message::list const &ack_message)
     {
         if (m_need_ack)
-            m_ack_message = std::move(ack_message);
+            m_ack_message = ack_message;
     }
 
-    inline event::event(std::string const &nsp, std::string const &name, message::list &&messages, bool need_ack) : m_nsp(nsp),
-                                                                                                                    m_name(name),
+    inline event::event(std::string const &nsp, std::string &&name, message::list &&messages, bool need_ack) : m_nsp(nsp),
+                                                                                                               m_name(std::move(name)),
                                                                                                                     m_messages(std::move(messages)),
+                                                                                                                    m_materialized(true),
                                                                                                                     m_need_ack(need_ack)
     {
     }
 
+    inline event::event(std::string const &nsp, std::string &&name, std::shared_ptr<const packet> const &lazy_packet, bool need_ack) : m_nsp(nsp),
+                                                                                                                                        m_name(std::move(name)),
+                                                                                                                                             m_materialized(false),
+                                                                                                                                             m_packet(lazy_packet),
+                                                                                                                                             m_need_ack(need_ack)
+    {
+    }
+
     inline event::event(std::string const &nsp, std::string const &name, message::list const &messages, bool need_ack) : m_nsp(nsp),
                                                                                                                          m_name(name),
                                                                                                                          m_messages(messages),
+                                                                                                                         m_materialized(true),
                                                                                                                          m_need_ack(need_ack)
     {
     }
@@ -103,7 +195,7 @@ namespace sio
         return m_ack_message;
     }
 
-    class socket::impl
+    class socket::impl : public std::enable_shared_from_this<socket::impl>
     {
     public:
         impl(client_impl *, std::string const &, message::ptr const &);
@@ -137,12 +229,34 @@ namespace sio
 
         void close();
 
-        void emit(std::string const &event_name, message::list const &msglist, std::function<void(message::list const &)> const &ack);
+        emit_status emit(std::string const &event_name, message::list const &msglist, std::function<void(message::list const &)> const &ack);
+
+        emit_status emit(std::string const &event_name, message::list const &msglist, std::function<void(message::list const &)> const &ack, unsigned timeout_ms, std::function<void()> const &timeout_callback);
+
+        emit_status emit_with_ack_move(std::string const &event_name, message::list const &msglist, std::function<void(message::list &&)> &&on_ack, unsigned timeout_ms, std::function<void()> &&on_timeout);
 
-        void emit(std::string const &event_name, message::list const &msglist, std::function<void(message::list const &)> const &ack, unsigned timeout_ms, std::function<void()> const &timeout_callback);
+        emit_status emit_encoded(encoded_packet::ptr const &encoded, std::function<void(message::list const &)> const &ack);
+
+        emit_status emit_volatile(std::string const &event_name, message::list const &msglist);
+
+        emit_status emit_batch(std::vector<batch_event> const &events);
+
+        emit_status emit_latest(std::string const &event_name, message::list const &msglist, std::string const &key);
+
+        unsigned emit_stream(std::string const &event_name, stream_producer const &producer, stream_done_listener const &done, size_t chunk_size);
+
+        void on_stream(std::string const &event_name, stream_listener const &listener);
+
+        void set_offline_buffer(offline_buffer_config const &config);
+
+        void set_buffer_listener(buffer_listener const &l);
+
+        size_t get_buffered_count() const;
 
         std::string const &get_namespace() const { return m_nsp; }
 
+        bool recovered() const { return m_recovered.load(std::memory_order_acquire); }
+
         connection_metrics get_metrics() const;
 
     protected:
@@ -154,55 +268,203 @@ namespace sio
 
         void on_message_packet(packet const &packet);
 
+        void take_offset(packet const &p);
+
         void on_disconnect();
 
     private:
         // Message Parsing callbacks.
-        void on_socketio_event(const std::string &nsp, int msgId, const std::string &name, message::list &&message);
-        void on_socketio_ack(int msgId, message::list const &message);
+        void on_socketio_event(const std::string &nsp, int msgId, std::string &&name, message::list &&message);
+        void on_socketio_event(const std::string &nsp, int msgId, std::string &&name, std::shared_ptr<const packet> const &lazy_packet);
+        void dispatch_event(int msgId, event &ev);
+        void on_socketio_ack(int msgId, message::list &&message);
         void on_socketio_error(message::ptr const &err_message);
 
-        event_listener get_bind_listener_locked(string const &event);
+        template <typename F>
+        void update_dispatch(F &&change);
 
-        void ack(int msgId, string const &name, message::list const &ack_message);
+        void ack(int msgId, string const &name, message::list &&ack_message);
 
         void timeout_connection(const asio::error_code &ec);
 
         void send_connect();
 
-        void send_packet(packet &p);
+        emit_status send_packet(packet &p, std::string const &event_name = std::string(), std::string const &coalesce_key = std::string());
 
-        static event_listener s_null_event_listener;
+        emit_status buffer_packet(std::unique_lock<std::mutex> &lock, packet &p, std::string const &event_name, std::string const &coalesce_key);
+
+        // Registers a pending ack, called with the arguments either as const&
+        // (ack) or as an rvalue (take); its id, or -1 if too many are pending.
+        int add_ack(std::function<void(message::list const &)> const &ack,
+                    std::function<void(message::list &&)> &&take,
+                    std::function<void()> const &timeout_callback = nullptr,
+                    unsigned const *timeout_ms = nullptr);
+
+        void forget_ack(int pack_id);
 
-        static std::atomic<unsigned int> s_global_event_id;
+        void start_ack_ticker_locked();
+
+        void on_ack_tick(const asio::error_code &ec);
+
+        void schedule_drain();
+
+        void drain_packets();
+
+        void discard_packets();
+
+        void lock_drain();
+
+        void unlock_drain();
+
+        struct outbound_stream
+        {
+            std::string event_name;
+            unsigned id;
+            size_t seq;
+            size_t chunk_size;
+            stream_producer producer;
+            stream_done_listener done;
+            // client_impl::bytes_queued() after each chunk still unwritten.
+            std::deque<uint64_t> in_flight;
+        };
+
+        // Chunks of one stream the transport may hold unwritten at a time,
+        // whatever client_options::send_backlog_max_bytes is.
+        static const size_t stream_window = 2;
+
+        void pump_stream(std::shared_ptr<outbound_stream> const &stream);
+
+        static event_listener s_null_event_listener;
 
         sio::client_impl *m_client;
 
+        // The client's tracer, copied so workers still dispatching after on_close can use it.
+        trace_listener m_tracer;
+
         std::atomic<bool> m_connected;
         std::string m_nsp;
         message::ptr m_auth;
 
-        std::unordered_map<unsigned int, std::function<void(message::list const &)>> m_acks;
+        // Connection state recovery, io thread only: the session id the server
+        // handed out on connect and the offset of the last event it tagged. Both
+        // survive reconnects and go back in the CONNECT auth. The offset is taken
+        // as events are decoded, before any hand-off to worker threads.
+        std::string m_pid;
+        std::string m_last_offset;
+        std::atomic<bool> m_recovered{false};
 
-        std::unordered_map<unsigned int, std::shared_ptr<asio::steady_timer>> m_ack_timers;
+        struct pending_ack
+        {
+            std::function<void(message::list const &)> ack;
+            // Set instead of ack by emit_with_ack_move.
+            std::function<void(message::list &&)> take;
+            std::function<void()> timeout_callback;
+            // Pending entry in m_ack_timeouts, null without a timeout.
+            timer_wheel::handle timeout = nullptr;
+            std::chrono::steady_clock::time_point sent_at;
+        };
 
-        std::unordered_map<std::string, event_listener> m_event_binding;
+        // Indexed by ack id, guarded by m_event_mutex. The server only acks in the
+        // namespace it was asked in, so ids are per socket.
+        ack_slab<pending_ack> m_acks;
 
-        event_listener m_event_listener;
+        // Ack timeouts, guarded by m_event_mutex. m_ack_ticker advances the wheel
+        // once per tick while any timeout is pending.
+        timer_wheel m_ack_timeouts{std::chrono::milliseconds(10), 1024};
+        std::unique_ptr<asio::steady_timer> m_ack_ticker;
+        bool m_ack_ticking = false;
+
+        struct name_hash
+        {
+            typedef void is_transparent;
+
+            size_t operator()(std::string_view name) const
+            {
+                return std::hash<std::string_view>()(name);
+            }
+        };
+
+        struct dispatch_table
+        {
+            std::unordered_map<std::string, event_listener, name_hash, std::equal_to<>> bindings;
+            event_listener any_listener;
+        };
+
+        // Copy-on-write: every on()/off() publishes a new table under m_event_mutex,
+        // and dispatch reads the current one without taking it. Listeners are
+        // registered rarely and looked up for every event.
+#if defined(__cpp_lib_atomic_shared_ptr)
+        std::atomic<std::shared_ptr<const dispatch_table>> m_dispatch{std::make_shared<const dispatch_table>()};
+
+        std::shared_ptr<const dispatch_table> load_dispatch() const
+        {
+            return m_dispatch.load(std::memory_order_acquire);
+        }
+
+        void store_dispatch(std::shared_ptr<const dispatch_table> &&table)
+        {
+            m_dispatch.store(std::move(table), std::memory_order_release);
+        }
+#else
+        // No std::atomic<std::shared_ptr> (libc++): a lock of the table's own,
+        // held only to copy the pointer.
+        std::shared_ptr<const dispatch_table> m_dispatch = std::make_shared<const dispatch_table>();
+        mutable std::mutex m_dispatch_mutex;
+
+        std::shared_ptr<const dispatch_table> load_dispatch() const
+        {
+            std::lock_guard<std::mutex> guard(m_dispatch_mutex);
+            return m_dispatch;
+        }
+
+        void store_dispatch(std::shared_ptr<const dispatch_table> &&table)
+        {
+            std::lock_guard<std::mutex> guard(m_dispatch_mutex);
+            m_dispatch.swap(table);
+        }
+#endif
 
         error_listener m_error_listener;
 
         std::unique_ptr<asio::steady_timer> m_connection_timer;
 
-        std::queue<packet> m_packet_queue;
+        // Outgoing packets, moved in by any thread and sent by the io thread. While
+        // the namespace isn't connected they stay queued (pre-connect buffering).
+        struct queued_packet
+        {
+            packet pack;
+            // Set by emit_latest, see client_impl::send.
+            std::string coalesce_key;
+        };
+        mpsc_queue<queued_packet> m_packet_queue;
 
-        std::mutex m_event_mutex;
+        // Set while a drain is posted, or while packets wait for the connection.
+        std::atomic<bool> m_drain_scheduled{false};
+
+        // Serializes consumers of m_packet_queue: the io thread and teardown.
+        // Waiters sleep on it rather than spin, see lock_drain.
+        std::atomic_flag m_draining = ATOMIC_FLAG_INIT;
 
-        std::mutex m_packet_mutex;
+        // Frames of one drain, handed to the client together (guarded by m_draining).
+        std::vector<client_impl::outbound_frame> m_drain_frames;
+
+        std::atomic<unsigned> m_next_stream_id{1};
+
+        // Packets emitted while the namespace isn't connected. m_connected only
+        // becomes true under m_offline_mutex, so a producer never buffers a
+        // packet after on_connected flushed.
+        offline_buffer m_offline;
+        buffer_listener m_buffer_listener;
+        bool m_offline_closed = false;
+        mutable std::mutex m_offline_mutex;
+        std::condition_variable m_offline_cv;
+
+        std::mutex m_event_mutex;
 
         // Metrics tracking
         std::atomic<size_t> m_packets_sent{0};
         std::atomic<size_t> m_packets_received{0};
+        histogram_recorder m_ack_rtt;
         std::chrono::system_clock::time_point m_connected_at;
         std::mutex m_metrics_mutex;
 
@@ -214,38 +476,39 @@ namespace sio
         this->on(event_name, event_adapter::do_adapt(func));
     }
 
-    void socket::impl::on(std::string const &event_name, event_listener const &func)
+    template <typename F>
+    void socket::impl::update_dispatch(F &&change)
     {
         std::lock_guard<std::mutex> guard(m_event_mutex);
-        m_event_binding[event_name] = func;
+        std::shared_ptr<dispatch_table> next = std::make_shared<dispatch_table>(*load_dispatch());
+        change(*next);
+        store_dispatch(std::move(next));
+    }
+
+    void socket::impl::on(std::string const &event_name, event_listener const &func)
+    {
+        update_dispatch([&](dispatch_table &table) { table.bindings[event_name] = func; });
     }
 
     void socket::impl::on_any(event_listener_aux const &func)
     {
-        std::lock_guard<std::mutex> guard(m_event_mutex);
-        m_event_listener = event_adapter::do_adapt(func);
+        event_listener listener = event_adapter::do_adapt(func);
+        update_dispatch([&](dispatch_table &table) { table.any_listener = listener; });
     }
 
     void socket::impl::on_any(event_listener const &func)
     {
-        std::lock_guard<std::mutex> guard(m_event_mutex);
-        m_event_listener = func;
+        update_dispatch([&](dispatch_table &table) { table.any_listener = func; });
     }
 
     void socket::impl::off(std::string const &event_name)
     {
-        std::lock_guard<std::mutex> guard(m_event_mutex);
-        auto it = m_event_binding.find(event_name);
-        if (it != m_event_binding.end())
-        {
-            m_event_binding.erase(it);
-        }
+        update_dispatch([&](dispatch_table &table) { table.bindings.erase(event_name); });
     }
 
     void socket::impl::off_all()
     {
-        std::lock_guard<std::mutex> guard(m_event_mutex);
-        m_event_binding.clear();
+        update_dispatch([](dispatch_table &table) { table.bindings.clear(); });
     }
 
     void socket::impl::on_error(error_listener const &l)
@@ -264,6 +527,9 @@ namespace sio
                                                                                                 m_auth(auth)
     {
         NULL_GUARD(client);
+#ifndef SIO_DISABLE_TRACING
+        m_tracer = client->m_tracer;
+#endif
         // Only send connect if client is opened
         // This ensures namespace connections happen after the transport is ready
         if (m_client->opened())
@@ -276,90 +542,323 @@ namespace sio
     {
     }
 
-    std::atomic<unsigned int> socket::impl::s_global_event_id{1};
-
-    void socket::impl::emit(std::string const &event_name, message::list const &msglist, std::function<void(message::list const &)> const &ack)
+    emit_status socket::impl::emit(std::string const &event_name, message::list const &msglist, std::function<void(message::list const &)> const &ack)
     {
-        NULL_GUARD(m_client);
-        message::ptr msg_ptr = msglist.to_array_message(event_name);
-        int pack_id;
-        if (ack)
+        if (!m_client)
         {
-            pack_id = s_global_event_id.fetch_add(1, std::memory_order_relaxed);
-            std::lock_guard<std::mutex> guard(m_event_mutex);
-            m_acks[pack_id] = ack;
+            return emit_status::dropped;
         }
-        else
+        int pack_id = ack ? add_ack(ack, nullptr) : -1;
+        if (ack && pack_id < 0)
         {
-            pack_id = -1;
+            return emit_status::dropped;
         }
+        SIO_TRACE_SCOPE(m_tracer, trace_point::emit, m_nsp, event_name, pack_id, 0);
+        message::ptr msg_ptr = msglist.to_array_message(event_name);
         packet p(m_nsp, msg_ptr, pack_id);
-        send_packet(p);
+        emit_status status = send_packet(p, event_name);
+        if (status == emit_status::dropped || status == emit_status::would_block)
+        {
+            forget_ack(pack_id);
+        }
+        return status;
     }
 
-    void socket::impl::emit(std::string const &event_name,
-                            message::list const &msglist,
-                            std::function<void(message::list const &)> const &ack,
-                            unsigned timeout_ms,
-                            std::function<void()> const &timeout_callback)
+    emit_status socket::impl::emit_encoded(encoded_packet::ptr const &encoded, std::function<void(message::list const &)> const &ack)
     {
-        NULL_GUARD(m_client);
-        message::ptr msg_ptr = msglist.to_array_message(event_name);
-        int pack_id;
-        if (ack)
+        if (!m_client || !encoded)
         {
-            pack_id = s_global_event_id.fetch_add(1, std::memory_order_relaxed);
+            return emit_status::dropped;
+        }
+        int pack_id = ack ? add_ack(ack, nullptr) : -1;
+        if (ack && pack_id < 0)
+        {
+            return emit_status::dropped;
+        }
+        SIO_TRACE_SCOPE(m_tracer, trace_point::emit, m_nsp, encoded->get_event_name(), pack_id, 0);
+        packet p(m_nsp, encoded, pack_id);
+        emit_status status = send_packet(p, encoded->get_event_name());
+        if (status == emit_status::dropped || status == emit_status::would_block)
+        {
+            forget_ack(pack_id);
+        }
+        return status;
+    }
 
-            // Create timeout timer
-            auto timer = std::make_shared<asio::steady_timer>(m_client->get_io_service());
-            timer->expires_after(std::chrono::milliseconds(timeout_ms));
+    emit_status socket::impl::emit_volatile(std::string const &event_name, message::list const &msglist)
+    {
+        // Never buffered: dropped unless it can go out now.
+        if (!m_client || !m_connected.load(std::memory_order_acquire) || !m_client->is_writable())
+        {
+            return emit_status::dropped;
+        }
+        SIO_TRACE_SCOPE(m_tracer, trace_point::emit, m_nsp, event_name, -1, 0);
+        packet p(m_nsp, msglist.to_array_message(event_name));
+        m_packet_queue.push(queued_packet{std::move(p), std::string()});
+        schedule_drain();
+        return emit_status::queued;
+    }
 
-            // Capture pack_id for the timeout handler
-            timer->async_wait([this, pack_id, timeout_callback](const asio::error_code &ec)
-                              {
-                if (!ec) // Timer expired (not cancelled)
+    emit_status socket::impl::emit_batch(std::vector<batch_event> const &events)
+    {
+        if (!m_client)
+        {
+            return emit_status::dropped;
+        }
+        std::vector<queued_packet> packets;
+        packets.reserve(events.size());
+        for (batch_event const &ev : events)
+        {
+            SIO_TRACE_SCOPE(m_tracer, trace_point::emit, m_nsp, ev.name, -1, 0);
+            packets.push_back(queued_packet{packet(m_nsp, ev.args.to_array_message(ev.name)), std::string()});
+        }
+        if (!m_connected.load(std::memory_order_acquire))
+        {
+            std::unique_lock<std::mutex> lock(m_offline_mutex);
+            if (!m_connected.load(std::memory_order_relaxed))
+            {
+                // Each packet goes through the offline policy on its own; report the
+                // first one it didn't take.
+                emit_status status = emit_status::buffered;
+                for (size_t i = 0; i < packets.size(); ++i)
                 {
-                    std::function<void(message::list const &)> removed_ack;
+                    if (!lock.owns_lock())
                     {
-                        std::lock_guard<std::mutex> guard(m_event_mutex);
-                        auto ack_it = m_acks.find(pack_id);
-                        if (ack_it != m_acks.end())
-                        {
-                            removed_ack = ack_it->second;
-                            m_acks.erase(ack_it);
-                        }
-                        auto timer_it = m_ack_timers.find(pack_id);
-                        if (timer_it != m_ack_timers.end())
-                        {
-                            m_ack_timers.erase(timer_it);
-                        }
+                        lock.lock();
+                    }
+                    if (m_connected.load(std::memory_order_relaxed))
+                    {
+                        // Connected while a block policy waited: the rest goes out directly.
+                        m_packet_queue.push_chain(std::make_move_iterator(packets.begin() + i), std::make_move_iterator(packets.end()));
+                        schedule_drain();
+                        break;
+                    }
+                    emit_status one = buffer_packet(lock, packets[i].pack, events[i].name, std::string());
+                    if (status == emit_status::buffered && (one == emit_status::dropped || one == emit_status::would_block))
+                    {
+                        status = one;
                     }
+                }
+                return status;
+            }
+        }
+        m_packet_queue.push_chain(std::make_move_iterator(packets.begin()), std::make_move_iterator(packets.end()));
+        schedule_drain();
+        return emit_status::queued;
+    }
+
+    emit_status socket::impl::emit_latest(std::string const &event_name, message::list const &msglist, std::string const &key)
+    {
+        if (!m_client)
+        {
+            return emit_status::dropped;
+        }
+        SIO_TRACE_SCOPE(m_tracer, trace_point::emit, m_nsp, event_name, -1, 0);
+        // Unique per namespace, event and key in the client's shared send queue.
+        std::string coalesce_key;
+        coalesce_key.reserve(m_nsp.size() + event_name.size() + key.size() + 2);
+        coalesce_key.append(m_nsp).append(1, '\0').append(event_name).append(1, '\0').append(key);
+        packet p(m_nsp, msglist.to_array_message(event_name));
+        return send_packet(p, event_name, coalesce_key);
+    }
+
+    unsigned socket::impl::emit_stream(std::string const &event_name, stream_producer const &producer, stream_done_listener const &done, size_t chunk_size)
+    {
+        if (!m_client || !producer || !m_connected.load(std::memory_order_acquire))
+        {
+            return 0;
+        }
+        std::shared_ptr<outbound_stream> stream = std::make_shared<outbound_stream>();
+        stream->event_name = event_name;
+        stream->id = m_next_stream_id.fetch_add(1, std::memory_order_relaxed);
+        stream->seq = 0;
+        stream->chunk_size = chunk_size > 0 ? chunk_size : 64 * 1024;
+        stream->producer = producer;
+        stream->done = done;
+        // Posted handlers hold impl for as long as they run, and find it expired
+        // if the socket went away before they did.
+        std::weak_ptr<impl> weak = weak_from_this();
+        asio::post(m_client->get_io_service(), [weak, stream]() {
+            if (std::shared_ptr<impl> self = weak.lock())
+            {
+                self->pump_stream(stream);
+            }
+        });
+        return stream->id;
+    }
 
-                    // Call timeout callback if ack was still pending
-                    if (removed_ack && timeout_callback)
+    void socket::impl::pump_stream(std::shared_ptr<outbound_stream> const &stream)
+    {
+        // io thread. Each chunk is encoded straight into the client's send queue,
+        // so is_writable() sees it before the next one is pulled.
+        NULL_GUARD(m_client);
+        for (;;)
+        {
+            if (!m_connected.load(std::memory_order_acquire))
+            {
+                if (stream->done)
+                {
+                    stream->done(false);
+                }
+                return;
+            }
+            if (!stream->in_flight.empty())
+            {
+                uint64_t written = m_client->bytes_written();
+                while (!stream->in_flight.empty() && stream->in_flight.front() <= written)
+                {
+                    stream->in_flight.pop_front();
+                }
+            }
+            bool window_full = stream->in_flight.size() >= stream_window;
+            if (window_full || !m_client->is_writable())
+            {
+                // Until the oldest chunk in flight is written.
+                uint64_t written = window_full ? stream->in_flight.front() : 0;
+                std::weak_ptr<impl> weak = weak_from_this();
+                m_client->when_writable([weak, stream](bool writable) {
+                    std::shared_ptr<impl> self = weak.lock();
+                    if (!self)
                     {
-                        timeout_callback();
+                        return;
                     }
-                } });
+                    if (writable)
+                    {
+                        self->pump_stream(stream);
+                    }
+                    else if (stream->done)
+                    {
+                        stream->done(false);
+                    }
+                }, written);
+                return;
+            }
+            std::shared_ptr<std::string> chunk = std::make_shared<std::string>();
+            chunk->reserve(stream->chunk_size);
+            bool more = stream->producer(*chunk, stream->chunk_size);
+            message::list args(int_message::create(stream->id));
+            args.push(int_message::create(static_cast<int64_t>(stream->seq++)));
+            args.push(std::shared_ptr<const std::string>(std::move(chunk)));
+            args.push(bool_message::create(!more));
+            packet p(m_nsp, std::move(args).to_array_message(stream->event_name));
+            send_packet(p, stream->event_name);
+            drain_packets();
+            stream->in_flight.push_back(m_client->bytes_queued());
+            if (!more)
+            {
+                if (stream->done)
+                {
+                    stream->done(true);
+                }
+                return;
+            }
+        }
+    }
 
+    void socket::impl::on_stream(std::string const &event_name, stream_listener const &listener)
+    {
+        on(event_name, event_listener([this, listener](event &ev) {
+            message::list const &args = ev.get_messages();
+            if (args.size() < 4 || !args[0] || args[0]->get_flag() != message::flag_integer ||
+                !args[1] || args[1]->get_flag() != message::flag_integer ||
+                !args[2] || args[2]->get_flag() != message::flag_binary ||
+                !args[3] || args[3]->get_flag() != message::flag_boolean)
             {
-                std::lock_guard<std::mutex> guard(m_event_mutex);
-                m_acks[pack_id] = ack;
-                m_ack_timers[pack_id] = timer;
+                on_socketio_error(string_message::create("Malformed stream chunk for event: " + ev.get_name()));
+                return;
             }
+            stream_chunk chunk;
+            chunk.stream_id = static_cast<unsigned>(args[0]->get_int());
+            chunk.seq = static_cast<size_t>(args[1]->get_int());
+            chunk.data = args[2]->get_binary();
+            chunk.last = args[3]->get_bool();
+            listener(chunk);
+        }));
+    }
+
+    emit_status socket::impl::emit(std::string const &event_name,
+                                   message::list const &msglist,
+                                   std::function<void(message::list const &)> const &ack,
+                                   unsigned timeout_ms,
+                                   std::function<void()> const &timeout_callback)
+    {
+        if (!m_client)
+        {
+            return emit_status::dropped;
         }
-        else
+        int pack_id = ack ? add_ack(ack, nullptr, timeout_callback, &timeout_ms) : -1;
+        if (ack && pack_id < 0)
         {
-            pack_id = -1;
+            return emit_status::dropped;
         }
+        SIO_TRACE_SCOPE(m_tracer, trace_point::emit, m_nsp, event_name, pack_id, 0);
+        message::ptr msg_ptr = msglist.to_array_message(event_name);
         packet p(m_nsp, msg_ptr, pack_id);
-        send_packet(p);
+        emit_status status = send_packet(p, event_name);
+        if (status == emit_status::dropped || status == emit_status::would_block)
+        {
+            forget_ack(pack_id);
+        }
+        return status;
+    }
+
+    emit_status socket::impl::emit_with_ack_move(std::string const &event_name,
+                                                 message::list const &msglist,
+                                                 std::function<void(message::list &&)> &&on_ack,
+                                                 unsigned timeout_ms,
+                                                 std::function<void()> &&on_timeout)
+    {
+        if (!m_client)
+        {
+            return emit_status::dropped;
+        }
+        int pack_id = add_ack(nullptr, std::move(on_ack), on_timeout, timeout_ms ? &timeout_ms : nullptr);
+        if (pack_id < 0)
+        {
+            return emit_status::dropped;
+        }
+        SIO_TRACE_SCOPE(m_tracer, trace_point::emit, m_nsp, event_name, pack_id, 0);
+        message::ptr msg_ptr = msglist.to_array_message(event_name);
+        packet p(m_nsp, msg_ptr, pack_id);
+        emit_status status = send_packet(p, event_name);
+        if (status == emit_status::dropped || status == emit_status::would_block)
+        {
+            forget_ack(pack_id);
+        }
+        return status;
     }
 
     void socket::impl::send_connect()
     {
         NULL_GUARD(m_client);
-        packet p(packet::type_connect, m_nsp, m_auth);
+        message::ptr auth = m_auth;
+        if (!m_pid.empty())
+        {
+            // Ask the server to restore the session. Fields of the app's auth win,
+            // as with the JS client.
+            message::ptr merged = object_message::create();
+            object_message &fields = static_cast<object_message &>(*merged);
+            if (m_auth && m_auth->get_flag() == message::flag_object)
+            {
+                object_message const &app = static_cast<object_message const &>(*m_auth);
+                if (app.is_ordered())
+                {
+                    for (object_message::field const &f : app.get_fields())
+                        fields.insert(f.first, f.second);
+                }
+                else
+                {
+                    for (auto const &f : app.get_map())
+                        fields.insert(f.first, f.second);
+                }
+            }
+            if (!fields.has("pid"))
+                fields.insert("pid", m_pid);
+            if (!m_last_offset.empty() && !fields.has("offset"))
+                fields.insert("offset", m_last_offset);
+            auth = merged;
+        }
+        packet p(packet::type_connect, m_nsp, auth);
         m_client->send(p);
         m_connection_timer.reset(new asio::steady_timer(m_client->get_io_service()));
         m_connection_timer->expires_after(std::chrono::milliseconds(20000));
@@ -392,24 +891,40 @@ namespace sio
         }
         if (!m_connected)
         {
-            m_connected = true;
+            std::deque<offline_buffer::entry> backlog;
+            buffer_listener listener;
+            {
+                std::lock_guard<std::mutex> guard(m_offline_mutex);
+                m_connected = true;
+                if (m_offline.take_all(backlog))
+                {
+                    listener = m_buffer_listener;
+                }
+            }
+            m_offline_cv.notify_all();
             m_connected_at = std::chrono::system_clock::now();
             m_client->on_socket_opened(m_nsp);
 
-            // Extract all queued packets under lock, then send without holding lock
-            std::vector<sio::packet> packets_to_send;
+            // Send whatever was buffered before the namespace connected, then
+            // anything queued since.
+            std::vector<client_impl::outbound_frame> frames;
+            size_t bytes = 0;
+            size_t batch_max = m_client->batch_max_bytes();
+            for (offline_buffer::entry &entry : backlog)
             {
-                std::lock_guard<std::mutex> guard(m_packet_mutex);
-                while (!m_packet_queue.empty())
+                bytes += m_client->encode_frames(entry.pack, entry.coalesce_key, frames);
+                if (bytes >= batch_max)
                 {
-                    packets_to_send.push_back(std::move(m_packet_queue.front()));
-                    m_packet_queue.pop();
+                    m_client->enqueue_frames(frames);
+                    bytes = 0;
                 }
             }
-            // Send packets without holding the lock
-            for (auto &packet : packets_to_send)
+            m_client->enqueue_frames(frames);
+            m_packets_sent.fetch_add(backlog.size(), std::memory_order_relaxed);
+            drain_packets();
+            if (listener)
             {
-                m_client->send(packet);
+                listener(false);
             }
         }
     }
@@ -424,13 +939,13 @@ namespace sio
             m_connection_timer.reset();
         }
         m_connected = false;
+        discard_packets();
         {
-            std::lock_guard<std::mutex> guard(m_packet_mutex);
-            while (!m_packet_queue.empty())
-            {
-                m_packet_queue.pop();
-            }
+            std::lock_guard<std::mutex> guard(m_offline_mutex);
+            m_offline_closed = true;
+            m_offline.clear();
         }
+        m_offline_cv.notify_all();
 
         // Save client pointer and namespace before clearing to prevent use-after-free
         sio::client_impl *client = m_client;
@@ -455,11 +970,17 @@ namespace sio
         if (m_connected)
         {
             m_connected = false;
-            std::lock_guard<std::mutex> guard(m_packet_mutex);
-            while (!m_packet_queue.empty())
-            {
-                m_packet_queue.pop();
-            }
+            discard_packets();
+        }
+    }
+
+    void socket::impl::take_offset(packet const &p)
+    {
+        if (!m_pid.empty() && p.get_nsp() == m_nsp &&
+            (p.get_type() == packet::type_event || p.get_type() == packet::type_binary_event))
+        {
+            // The server appends the event's offset as a last string argument.
+            p.get_trailing_string(m_last_offset);
         }
     }
 
@@ -475,6 +996,22 @@ namespace sio
             case packet::type_connect:
             {
                 LOG("Received Message type (Connect)" << std::endl);
+                // {"sid", "pid"}: pid is only there when the server has connection
+                // state recovery enabled. The same pid back means missed packets are
+                // replayed and rooms were kept.
+                std::string pid;
+                message::ptr const &data = p.get_message();
+                if (data && data->get_flag() == message::flag_object)
+                {
+                    message::ptr const &value = static_cast<object_message const &>(*data).at("pid");
+                    if (value && value->get_flag() == message::flag_string)
+                        pid = value->get_string();
+                }
+                bool recovered = !pid.empty() && pid == m_pid;
+                if (!recovered)
+                    m_last_offset.clear();
+                m_pid = std::move(pid);
+                m_recovered.store(recovered, std::memory_order_release);
 
                 this->on_connected();
                 break;
@@ -489,19 +1026,36 @@ namespace sio
             case packet::type_binary_event:
             {
                 LOG("Received Message type (Event)" << std::endl);
-                const message::ptr ptr = p.get_message();
+                if (!p.get_raw_json().empty())
+                {
+                    // Lazily decoded: route on the name, arguments stay raw JSON.
+                    std::string name;
+                    if (p.get_event_name(name))
+                    {
+                        this->on_socketio_event(p.get_nsp(), p.get_pack_id(), std::move(name), std::make_shared<packet>(p));
+                    }
+                    break;
+                }
+                message::ptr const &ptr = p.get_message();
                 if (ptr->get_flag() == message::flag_array)
                 {
-                    const array_message *array_ptr = static_cast<const array_message *>(ptr.get());
-                    if (array_ptr->get_vector().size() >= 1 && array_ptr->get_vector()[0]->get_flag() == message::flag_string)
+                    std::vector<message::ptr> &vec = ptr->get_vector();
+                    if (vec.size() >= 1 && vec[0]->get_flag() == message::flag_string)
                     {
-                        const string_message *name_ptr = static_cast<const string_message *>(array_ptr->get_vector()[0].get());
-                        message::list mlist;
-                        for (size_t i = 1; i < array_ptr->get_vector().size(); ++i)
+                        std::string name = vec[0]->get_string();
+                        std::vector<message::ptr> args;
+                        if (ptr.use_count() == 1)
+                        {
+                            // Only this packet holds the tree and it is dropped after
+                            // dispatch: hand the arguments over without touching refcounts.
+                            vec.erase(vec.begin());
+                            args = std::move(vec);
+                        }
+                        else
                         {
-                            mlist.push(array_ptr->get_vector()[i]);
+                            args.assign(vec.begin() + 1, vec.end());
                         }
-                        this->on_socketio_event(p.get_nsp(), p.get_pack_id(), name_ptr->get_string(), std::move(mlist));
+                        this->on_socketio_event(p.get_nsp(), p.get_pack_id(), std::move(name), message::list(std::move(args)));
                     }
                 }
 
@@ -512,11 +1066,13 @@ namespace sio
             case packet::type_binary_ack:
             {
                 LOG("Received Message type (ACK)" << std::endl);
-                const message::ptr ptr = p.get_message();
+                message::ptr const &ptr = p.get_message();
                 if (ptr->get_flag() == message::flag_array)
                 {
-                    message::list msglist(ptr->get_vector());
-                    this->on_socketio_ack(p.get_pack_id(), msglist);
+                    std::vector<message::ptr> &vec = ptr->get_vector();
+                    // As for events: move the arguments out when nothing else holds the tree.
+                    message::list msglist = ptr.use_count() == 1 ? message::list(std::move(vec)) : message::list(vec);
+                    this->on_socketio_ack(p.get_pack_id(), std::move(msglist));
                 }
                 else
                 {
@@ -537,61 +1093,119 @@ namespace sio
         }
     }
 
-    void socket::impl::on_socketio_event(const std::string &nsp, int msgId, const std::string &name, message::list &&message)
+    void socket::impl::on_socketio_event(const std::string &nsp, int msgId, std::string &&name, message::list &&message)
+    {
+        event ev = event_adapter::create_event(nsp, std::move(name), std::move(message), msgId >= 0);
+        dispatch_event(msgId, ev);
+    }
+
+    void socket::impl::on_socketio_event(const std::string &nsp, int msgId, std::string &&name, std::shared_ptr<const packet> const &lazy_packet)
+    {
+        event ev = event_adapter::create_lazy_event(nsp, std::move(name), lazy_packet, msgId >= 0);
+        dispatch_event(msgId, ev);
+    }
+
+    void socket::impl::dispatch_event(int msgId, event &ev)
     {
         bool needAck = msgId >= 0;
-        event ev = event_adapter::create_event(nsp, name, std::move(message), needAck);
-        event_listener func = this->get_bind_listener_locked(name);
-        if (func)
-            func(ev);
+        std::string const &name = ev.get_name();
+        SIO_TRACE_SCOPE(m_tracer, trace_point::dispatch, m_nsp, name, msgId, 0);
+        // The snapshot keeps its listeners alive even if they are replaced meanwhile.
+        std::shared_ptr<const dispatch_table> table = load_dispatch();
+        auto it = table->bindings.find(std::string_view(name));
+        if (it != table->bindings.end() && it->second)
+            it->second(ev);
 
-        event_listener any_listener;
-        {
-            std::lock_guard<std::mutex> guard(m_event_mutex);
-            any_listener = m_event_listener;
-        }
-        if (any_listener)
-            any_listener(ev);
+        if (table->any_listener)
+            table->any_listener(ev);
 
         if (needAck)
         {
-            this->ack(msgId, name, ev.get_ack_message());
+            this->ack(msgId, name, event_adapter::take_ack_message(ev));
         }
     }
 
-    void socket::impl::ack(int msgId, const string &, const message::list &ack_message)
+    void socket::impl::ack(int msgId, const string &, message::list &&ack_message)
     {
-        packet p(m_nsp, ack_message.to_array_message(), msgId, true);
+        packet p(m_nsp, std::move(ack_message).to_array_message(), msgId, true);
         send_packet(p);
     }
 
-    void socket::impl::on_socketio_ack(int msgId, message::list const &message)
+    void socket::impl::on_socketio_ack(int msgId, message::list &&message)
     {
         std::function<void(message::list const &)> l;
-        std::shared_ptr<asio::steady_timer> timer;
+        std::function<void(message::list &&)> take;
         {
             std::lock_guard<std::mutex> guard(m_event_mutex);
-            auto it = m_acks.find(msgId);
-            if (it != m_acks.end())
+            if (pending_ack *pending = m_acks.find(msgId))
+            {
+                m_ack_rtt.record(std::chrono::steady_clock::now() - pending->sent_at);
+                l = std::move(pending->ack);
+                take = std::move(pending->take);
+                if (pending->timeout)
+                {
+                    m_ack_timeouts.cancel(pending->timeout);
+                }
+                m_acks.erase(msgId);
+            }
+        }
+        if (take)
+            take(std::move(message));
+        else if (l)
+            l(message);
+    }
+
+    void socket::impl::start_ack_ticker_locked()
+    {
+        if (m_ack_ticking)
+        {
+            return;
+        }
+        if (!m_ack_ticker)
+        {
+            m_ack_ticker.reset(new asio::steady_timer(m_client->get_io_service()));
+        }
+        m_ack_ticking = true;
+        std::weak_ptr<impl> weak = weak_from_this();
+        m_ack_ticker->expires_after(m_ack_timeouts.tick());
+        m_ack_ticker->async_wait([weak](asio::error_code const &ec) {
+            if (std::shared_ptr<impl> self = weak.lock())
             {
-                l = it->second;
-                m_acks.erase(it);
+                self->on_ack_tick(ec);
             }
-            // Cancel and remove timeout timer if exists
-            auto timer_it = m_ack_timers.find(msgId);
-            if (timer_it != m_ack_timers.end())
+        });
+    }
+
+    void socket::impl::on_ack_tick(const asio::error_code &ec)
+    {
+        if (ec)
+        {
+            return;
+        }
+        std::vector<std::function<void()>> expired;
+        {
+            std::lock_guard<std::mutex> guard(m_event_mutex);
+            m_ack_ticking = false;
+            m_ack_timeouts.advance(timer_wheel::clock::now(), [&](unsigned pack_id) {
+                if (pending_ack *pending = m_acks.find(static_cast<int>(pack_id)))
+                {
+                    if (pending->timeout_callback)
+                    {
+                        expired.push_back(std::move(pending->timeout_callback));
+                    }
+                    m_acks.erase(static_cast<int>(pack_id));
+                }
+            });
+            if (!m_ack_timeouts.empty() && m_client)
             {
-                timer = timer_it->second;
-                m_ack_timers.erase(timer_it);
+                start_ack_ticker_locked();
             }
         }
-        // Cancel timer outside of lock
-        if (timer)
+        // Call timeout callbacks of acks that were still pending
+        for (auto const &timeout_callback : expired)
         {
-            timer->cancel();
+            timeout_callback();
         }
-        if (l)
-            l(message);
     }
 
     void socket::impl::on_socketio_error(message::ptr const &err_message)
@@ -613,47 +1227,226 @@ namespace sio
         this->on_close();
     }
 
-    void socket::impl::send_packet(sio::packet &p)
+    emit_status socket::impl::send_packet(sio::packet &p, std::string const &event_name, std::string const &coalesce_key)
     {
-        NULL_GUARD(m_client);
-        if (m_connected)
+        if (!m_client)
         {
-            // Extract all queued packets under lock, then send without holding lock
-            std::vector<sio::packet> packets_to_send;
+            return emit_status::dropped;
+        }
+        if (!m_connected.load(std::memory_order_acquire))
+        {
+            std::unique_lock<std::mutex> lock(m_offline_mutex);
+            if (!m_connected.load(std::memory_order_relaxed))
+            {
+                return buffer_packet(lock, p, event_name, coalesce_key);
+            }
+        }
+        m_packet_queue.push(queued_packet{std::move(p), coalesce_key});
+        schedule_drain();
+        return emit_status::queued;
+    }
+
+    emit_status socket::impl::buffer_packet(std::unique_lock<std::mutex> &lock, sio::packet &p, std::string const &event_name, std::string const &coalesce_key)
+    {
+        if (m_offline_closed)
+        {
+            return emit_status::dropped;
+        }
+        size_t bytes = p.get_estimated_size();
+        // Acks of evicted packets; erased once the buffer lock is released.
+        std::vector<int> evicted_acks;
+        emit_status status = emit_status::buffered;
+        for (;;)
+        {
+            offline_buffer::result stored = m_offline.store(p, bytes, event_name, coalesce_key, evicted_acks);
+            if (stored == offline_buffer::result::stored)
+            {
+                break;
+            }
+            if (stored == offline_buffer::result::dropped)
+            {
+                status = emit_status::dropped;
+                break;
+            }
+            // block policy. Waiting on the io thread would hold up the very
+            // connect that makes room, so it fails right away there.
+            if (m_client->get_io_service().get_executor().running_in_this_thread())
             {
-                std::lock_guard<std::mutex> guard(m_packet_mutex);
-                while (!m_packet_queue.empty())
+                status = emit_status::would_block;
+                break;
+            }
+            bool ready = m_offline_cv.wait_for(lock, m_offline.config().block_timeout, [&]() {
+                return m_connected.load(std::memory_order_relaxed) || m_offline_closed || !m_offline.full(bytes);
+            });
+            if (!ready)
+            {
+                status = emit_status::would_block;
+                break;
+            }
+            if (m_offline_closed)
+            {
+                status = emit_status::dropped;
+                break;
+            }
+            if (m_connected.load(std::memory_order_relaxed))
+            {
+                lock.unlock();
+                for (int pack_id : evicted_acks)
                 {
-                    packets_to_send.push_back(std::move(m_packet_queue.front()));
-                    m_packet_queue.pop();
+                    forget_ack(pack_id);
                 }
+                m_packet_queue.push(queued_packet{std::move(p), coalesce_key});
+                schedule_drain();
+                return emit_status::queued;
+            }
+        }
+
+        buffer_listener listener;
+        bool above = false;
+        if (m_offline.crossed_watermark(above))
+        {
+            listener = m_buffer_listener;
+        }
+        lock.unlock();
+
+        for (int pack_id : evicted_acks)
+        {
+            forget_ack(pack_id);
+        }
+        if (listener)
+        {
+            listener(above);
+        }
+        return status;
+    }
+
+    int socket::impl::add_ack(std::function<void(message::list const &)> const &ack,
+                              std::function<void(message::list &&)> &&take,
+                              std::function<void()> const &timeout_callback,
+                              unsigned const *timeout_ms)
+    {
+        std::lock_guard<std::mutex> guard(m_event_mutex);
+        int pack_id = m_acks.insert(pending_ack{ack, std::move(take), timeout_callback, nullptr, std::chrono::steady_clock::now()});
+        if (pack_id < 0)
+        {
+            LOG("Too many pending acks, emit dropped" << std::endl);
+            return -1;
+        }
+        if (timeout_ms)
+        {
+            m_acks.find(pack_id)->timeout = m_ack_timeouts.schedule(static_cast<unsigned>(pack_id), std::chrono::milliseconds(*timeout_ms));
+            start_ack_ticker_locked();
+        }
+        return pack_id;
+    }
+
+    void socket::impl::forget_ack(int pack_id)
+    {
+        if (pack_id < 0)
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> guard(m_event_mutex);
+        if (pending_ack *pending = m_acks.find(pack_id))
+        {
+            if (pending->timeout)
+            {
+                m_ack_timeouts.cancel(pending->timeout);
             }
-            // Send queued packets without holding the lock
-            for (auto &packet : packets_to_send)
+            m_acks.erase(pack_id);
+        }
+    }
+
+    void socket::impl::set_offline_buffer(offline_buffer_config const &config)
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_offline_mutex);
+            m_offline.configure(config);
+        }
+        m_offline_cv.notify_all();
+    }
+
+    void socket::impl::set_buffer_listener(buffer_listener const &l)
+    {
+        std::lock_guard<std::mutex> guard(m_offline_mutex);
+        m_buffer_listener = l;
+    }
+
+    size_t socket::impl::get_buffered_count() const
+    {
+        std::lock_guard<std::mutex> guard(m_offline_mutex);
+        return m_offline.size();
+    }
+
+    void socket::impl::schedule_drain()
+    {
+        // One posted drain covers every packet pushed before it runs.
+        if (!m_drain_scheduled.exchange(true, std::memory_order_acq_rel))
+        {
+            std::weak_ptr<impl> weak = weak_from_this();
+            asio::post(m_client->get_io_service(), [weak]() {
+                if (std::shared_ptr<impl> self = weak.lock())
+                {
+                    self->drain_packets();
+                }
+            });
+        }
+    }
+
+    void socket::impl::drain_packets()
+    {
+        NULL_GUARD(m_client);
+        if (!m_connected)
+        {
+            // Leave the drain flag set so producers don't post until on_connected drains.
+            return;
+        }
+        lock_drain();
+        // Cleared before popping: a packet pushed after this point schedules its own drain.
+        m_drain_scheduled.store(false, std::memory_order_seq_cst);
+        queued_packet p;
+        size_t sent = 0;
+        size_t bytes = 0;
+        size_t batch_max = m_client->batch_max_bytes();
+        while (m_packet_queue.pop(p))
+        {
+            bytes += m_client->encode_frames(p.pack, p.coalesce_key, m_drain_frames);
+            ++sent;
+            // One lock and one flush per batch, so a long run of producers
+            // doesn't pile up encoded frames here until the queue runs dry.
+            if (bytes >= batch_max)
             {
-                m_client->send(packet);
-                m_packets_sent.fetch_add(1, std::memory_order_relaxed);
+                m_client->enqueue_frames(m_drain_frames);
+                bytes = 0;
             }
-            // Send the new packet
-            m_client->send(p);
-            m_packets_sent.fetch_add(1, std::memory_order_relaxed);
         }
-        else
+        m_client->enqueue_frames(m_drain_frames);
+        m_packets_sent.fetch_add(sent, std::memory_order_relaxed);
+        unlock_drain();
+    }
+
+    void socket::impl::discard_packets()
+    {
+        lock_drain();
+        queued_packet p;
+        while (m_packet_queue.pop(p))
         {
-            std::lock_guard<std::mutex> guard(m_packet_mutex);
-            m_packet_queue.push(p);
         }
+        unlock_drain();
     }
 
-    socket::event_listener socket::impl::get_bind_listener_locked(const string &event)
+    void socket::impl::lock_drain()
     {
-        std::lock_guard<std::mutex> guard(m_event_mutex);
-        auto it = m_event_binding.find(event);
-        if (it != m_event_binding.end())
+        while (m_draining.test_and_set(std::memory_order_acquire))
         {
-            return it->second;
+            m_draining.wait(true, std::memory_order_relaxed);
         }
-        return socket::event_listener();
+    }
+
+    void socket::impl::unlock_drain()
+    {
+        m_draining.clear(std::memory_order_release);
+        m_draining.notify_one();
     }
 
     connection_metrics socket::impl::get_metrics() const
@@ -662,6 +1455,7 @@ namespace sio
         metrics.packets_sent = m_packets_sent.load(std::memory_order_relaxed);
         metrics.packets_received = m_packets_received.load(std::memory_order_relaxed);
         metrics.connected_at = m_connected_at;
+        metrics.ack_rtt = m_ack_rtt.snapshot();
 
         // Get client-level metrics
         if (m_client)
@@ -669,6 +1463,7 @@ namespace sio
             metrics.reconnection_count = m_client->m_reconn_made;
             auto latency_ms = m_client->m_last_ping_latency_ms.load(std::memory_order_relaxed);
             metrics.last_ping_latency = std::chrono::milliseconds(latency_ms);
+            metrics.transport = m_client->get_transport_metrics();
         }
         else
         {
@@ -679,11 +1474,6 @@ namespace sio
         return metrics;
     }
 
-    void socket::impl_deleter::operator()(impl *p) const
-    {
-        delete p;
-    }
-
     socket::socket(client_impl *client, std::string const &nsp, message::ptr const &auth) : m_impl(new impl(client, nsp, auth))
     {
     }
@@ -774,43 +1564,79 @@ namespace sio
         m_impl->off_error();
     }
 
-    void socket::emit(std::string const &event_name, message::list const &msglist)
+    emit_status socket::emit(std::string const &event_name, message::list const &msglist)
     {
-        m_impl->emit(event_name, msglist, nullptr);
+        return m_impl->emit(event_name, msglist, nullptr);
     }
 
-    void socket::emit_with_ack(std::string const &event_name, message::list const &msglist, std::function<void(message::list const &)> const &ack)
+    emit_status socket::emit_json(std::string const &event_name, std::string &&event_array)
     {
-        m_impl->emit(event_name, msglist, ack);
+        return m_impl->emit_encoded(encoded_packet::from_json(event_name, std::move(event_array)), nullptr);
     }
 
-    void socket::emit_with_ack(std::string const &event_name,
-                               message::list const &msglist,
-                               std::function<void(message::list const &)> const &ack,
-                               unsigned timeout_ms,
-                               std::function<void()> const &timeout_callback)
+    emit_status socket::emit_encoded(encoded_packet::ptr const &encoded)
     {
-        m_impl->emit(event_name, msglist, ack, timeout_ms, timeout_callback);
+        return m_impl->emit_encoded(encoded, nullptr);
     }
 
-    // C++20 Coroutine support - emit_async without timeout
-    emit_task socket::emit_async(std::string const &event_name,
-                                 message::list const &msglist)
+    emit_status socket::emit_encoded_with_ack(encoded_packet::ptr const &encoded, std::function<void(message::list const &)> const &ack)
+    {
+        return m_impl->emit_encoded(encoded, ack);
+    }
+
+    unsigned socket::emit_stream(std::string const &event_name, stream_producer const &producer, stream_done_listener const &done, size_t chunk_size)
     {
-        // Create awaiter object that will be suspended and resumed
-        auto awaiter = std::make_shared<emit_awaiter>();
+        return m_impl->emit_stream(event_name, producer, done, chunk_size);
+    }
 
-        // Create the callback that will resume the coroutine
-        auto ack_callback = [awaiter](message::list const &response)
-        {
-            awaiter->set_result(response);
-        };
+    void socket::on_stream(std::string const &event_name, stream_listener const &listener)
+    {
+        m_impl->on_stream(event_name, listener);
+    }
 
-        // Start the async operation
-        m_impl->emit(event_name, msglist, ack_callback);
+    emit_status socket::emit_volatile(std::string const &event_name, message::list const &msglist)
+    {
+        return m_impl->emit_volatile(event_name, msglist);
+    }
 
-        // Suspend until the callback resumes us and return the result
-        co_return co_await *awaiter;
+    emit_status socket::emit_batch(std::vector<batch_event> const &events)
+    {
+        return m_impl->emit_batch(events);
+    }
+
+    emit_status socket::emit_latest(std::string const &event_name, message::list const &msglist, std::string const &key)
+    {
+        return m_impl->emit_latest(event_name, msglist, key);
+    }
+
+    emit_status socket::emit_with_ack(std::string const &event_name, message::list const &msglist, std::function<void(message::list const &)> const &ack)
+    {
+        return m_impl->emit(event_name, msglist, ack);
+    }
+
+    emit_status socket::emit_with_ack(std::string const &event_name,
+                                      message::list const &msglist,
+                                      std::function<void(message::list const &)> const &ack,
+                                      unsigned timeout_ms,
+                                      std::function<void()> const &timeout_callback)
+    {
+        return m_impl->emit(event_name, msglist, ack, timeout_ms, timeout_callback);
+    }
+
+    emit_status socket::emit_with_ack_move(std::string const &event_name,
+                                           message::list const &msglist,
+                                           std::function<void(message::list &&)> &&on_ack,
+                                           unsigned timeout_ms,
+                                           std::function<void()> &&on_timeout)
+    {
+        return m_impl->emit_with_ack_move(event_name, msglist, std::move(on_ack), timeout_ms, std::move(on_timeout));
+    }
+
+    // C++20 Coroutine support - emit_async without timeout
+    emit_task socket::emit_async(std::string const &event_name,
+                                 message::list const &msglist)
+    {
+        return emit_async(event_name, msglist, 0);
     }
 
     // C++20 Coroutine support - emit_async with timeout
@@ -818,27 +1644,40 @@ namespace sio
                                  message::list const &msglist,
                                  unsigned timeout_ms)
     {
-        // Create awaiter object that will be suspended and resumed
-        auto awaiter = std::make_shared<emit_awaiter>();
-
-        // Create the ack callback that will resume with result
-        auto ack_callback = [awaiter](message::list const &response)
+        // Lives in the (pooled) frame, which stays until the awaiter has
+        // resumed it, even if the task is dropped: the callbacks can point at it.
+        emit_awaiter awaiter;
+        emit_awaiter *target = &awaiter;
+        std::function<void()> on_timeout;
+        if (timeout_ms)
         {
-            awaiter->set_result(response);
-        };
-
-        // Create the timeout callback that will resume with exception
-        auto timeout_callback = [awaiter]()
+            on_timeout = [target]() { target->set_exception(std::make_exception_ptr(timeout_exception())); };
+        }
+        emit_status status = m_impl->emit_with_ack_move(event_name, msglist,
+            [target](message::list &&response) { target->set_result(std::move(response)); },
+            timeout_ms, std::move(on_timeout));
+        if (status == emit_status::dropped || status == emit_status::would_block)
         {
-            auto ex = std::make_exception_ptr(timeout_exception());
-            awaiter->set_exception(ex);
-        };
-
-        // Start the async operation with timeout
-        m_impl->emit(event_name, msglist, ack_callback, timeout_ms, timeout_callback);
+            throw buffer_full_exception();
+        }
 
         // Suspend until one of the callbacks resumes us and return the result
-        co_return co_await *awaiter;
+        co_return co_await awaiter;
+    }
+
+    void socket::set_offline_buffer(offline_buffer_config const &config)
+    {
+        m_impl->set_offline_buffer(config);
+    }
+
+    void socket::set_buffer_listener(buffer_listener const &l)
+    {
+        m_impl->set_buffer_listener(l);
+    }
+
+    size_t socket::get_buffered_count() const
+    {
+        return m_impl->get_buffered_count();
     }
 
     std::string const &socket::get_namespace() const
@@ -846,6 +1685,11 @@ namespace sio
         return m_impl->get_namespace();
     }
 
+    bool socket::recovered() const
+    {
+        return m_impl->recovered();
+    }
+
     connection_metrics socket::get_metrics() const
     {
         return m_impl->get_metrics();
@@ -871,6 +1715,16 @@ namespace sio
         m_impl->on_message_packet(p);
     }
 
+    void socket::take_offset(packet const &p)
+    {
+        m_impl->take_offset(p);
+    }
+
+    void socket::on_argument_error(event const &ev)
+    {
+        m_impl->on_socketio_error(string_message::create("Unexpected arguments for event: " + ev.get_name()));
+    }
+
     void socket::on_disconnect()
     {
         m_impl->on_disconnect();
@@ -2,12 +2,16 @@
 #define SIO_SOCKET_H
 #include "sio_message.h"
 #include "sio_awaitable.h"
+#include "sio_codec.h"
+#include "sio_encoded_packet.h"
+#include "sio_metrics.h"
 #include <functional>
 #include <memory>
 #include <chrono>
 namespace sio
 {
     class event_adapter;
+    class packet;
 
     struct connection_metrics
     {
@@ -17,10 +21,67 @@ namespace sio
 
         // Connection health
         size_t reconnection_count;
+        // Interval between the last two server pings. The server drives the
+        // heartbeat, so this is not a round trip; see ack_rtt for that.
         std::chrono::milliseconds last_ping_latency;
 
         // Session info
         std::chrono::system_clock::time_point connected_at;
+
+        // Acked emits of this socket, from the emit to its ack arriving.
+        latency_histogram ack_rtt;
+
+        // Client-wide, the same for every socket of the client.
+        transport_metrics transport;
+    };
+
+    // Outcome of an emit.
+    enum class emit_status
+    {
+        queued,      // Namespace connected, handed to the send queue
+        buffered,    // Not connected, held in the offline buffer
+        dropped,     // Rejected by the offline buffer (drop_newest, or larger than the buffer)
+        would_block  // block policy: no room before block_timeout expired
+    };
+
+    // Bounds for packets emitted while the namespace is not connected (before the
+    // first connect and while reconnecting). They are sent in order on connect.
+    struct offline_buffer_config
+    {
+        enum class overflow_policy
+        {
+            drop_oldest,      // Evict the oldest buffered packet
+            drop_newest,      // Reject the packet being emitted
+            block,            // Wait up to block_timeout for room or the connection
+            coalesce_by_event // Replace a buffered packet of the same event, else drop the oldest
+        };
+
+        // Limits; 0 means unlimited. Bytes are an estimate of the encoded size, attachments included.
+        size_t max_packets = 0;
+        size_t max_bytes = 0;
+        overflow_policy policy = overflow_policy::drop_oldest;
+        std::chrono::milliseconds block_timeout{1000};
+
+        // The buffer listener is told when the buffered count reaches high_watermark,
+        // and again once it falls back to low_watermark. 0 disables notifications.
+        size_t high_watermark = 0;
+        size_t low_watermark = 0;
+    };
+
+    // One event of socket::emit_batch.
+    struct batch_event
+    {
+        std::string name;
+        message::list args;
+    };
+
+    // One piece of a binary stream sent with socket::emit_stream.
+    struct stream_chunk
+    {
+        unsigned stream_id;
+        size_t seq;
+        std::shared_ptr<const std::string> data;
+        bool last;
     };
 
     class event
@@ -34,6 +95,25 @@ namespace sio
 
         const message::list &get_messages() const;
 
+        // Raw JSON of the event array (name first) when lazily decoded, empty otherwise.
+        std::string_view get_raw_json() const;
+
+        // Decode one value addressed by a JSON pointer relative to the arguments,
+        // e.g. "/0/type" is the "type" key of the first argument. Null if absent.
+        // With lazy decoding this reads only that value, not the whole message tree.
+        message::ptr get_field(std::string_view pointer) const;
+
+        // Decode argument index into value through codec<T>, reading the raw JSON
+        // with On-Demand when lazily decoded. False if absent or of another shape.
+        template <typename T>
+            requires has_codec<T>
+        bool get_argument(size_t index, T &value) const
+        {
+            return read_argument(index, [](json_value &in, void *ctx)
+                                 { return codec<T>::read(in, *static_cast<T *>(ctx)); },
+                                 &value);
+        }
+
         bool need_ack() const;
 
         void put_ack_message(message::list const &ack_message);
@@ -42,14 +122,20 @@ namespace sio
 
     protected:
         event(std::string const &nsp, std::string const &name, message::list const &messages, bool need_ack);
-        event(std::string const &nsp, std::string const &name, message::list &&messages, bool need_ack);
+        event(std::string const &nsp, std::string &&name, message::list &&messages, bool need_ack);
+        event(std::string const &nsp, std::string &&name, std::shared_ptr<const packet> const &lazy_packet, bool need_ack);
 
         message::list &get_ack_message_impl();
 
+        bool read_argument(size_t index, bool (*read)(json_value &, void *), void *ctx) const;
+
     private:
         const std::string m_nsp;
         const std::string m_name;
-        const message::list m_messages;
+        // Built on first access when the event was decoded lazily from m_packet.
+        mutable message::list m_messages;
+        mutable bool m_materialized;
+        const std::shared_ptr<const packet> m_packet;
         const bool m_need_ack;
         message::list m_ack_message;
 
@@ -57,7 +143,6 @@ namespace sio
     };
 
     class client_impl;
-    class packet;
 
     // The name 'socket' is taken from concept of official socket.io.
     class socket
@@ -75,6 +160,17 @@ namespace sio
 
         typedef std::function<void(message::ptr const &message)> error_listener;
 
+        // Called with true when the offline buffer crosses its high watermark, false when it drains to the low one.
+        typedef std::function<void(bool above_high_watermark)> buffer_listener;
+
+        // Fills chunk with up to max_bytes; returns false when chunk is the last piece.
+        typedef std::function<bool(std::string &chunk, size_t max_bytes)> stream_producer;
+
+        // Called with true once the last chunk is queued, false if the connection went first.
+        typedef std::function<void(bool completed)> stream_done_listener;
+
+        typedef std::function<void(stream_chunk const &chunk)> stream_listener;
+
         typedef std::shared_ptr<socket> ptr;
 
         ~socket();
@@ -91,6 +187,31 @@ namespace sio
 
         void off(std::string const &event_name);
 
+        // Typed listener: the first argument is decoded into T and passed to
+        // handler(T const &) or handler(T const &, event &). Events whose argument
+        // doesn't decode are reported to the error listener.
+        template <typename T, typename F>
+            requires has_codec<T>
+        void on(std::string const &event_name, F &&handler)
+        {
+            on(event_name, event_listener([this, h = std::forward<F>(handler)](event &ev) mutable
+                                          {
+                                              T value{};
+                                              if (!ev.get_argument(0, value))
+                                              {
+                                                  on_argument_error(ev);
+                                              }
+                                              else if constexpr (std::is_invocable_v<F &, T const &, event &>)
+                                              {
+                                                  h(static_cast<T const &>(value), ev);
+                                              }
+                                              else
+                                              {
+                                                  h(static_cast<T const &>(value));
+                                              }
+                                          }));
+        }
+
         void on_any(event_listener const &func);
 
         void on_any(event_listener_aux const &func);
@@ -103,26 +224,107 @@ namespace sio
 
         void off_error();
 
-        void emit(std::string const &event_name, message::list const &msglist = nullptr);
+        emit_status emit(std::string const &event_name, message::list const &msglist = nullptr);
 
-        void emit_with_ack(std::string const &event_name, message::list const &msglist, std::function<void(message::list const &)> const &ack);
-
-        void emit_with_ack(std::string const &event_name,
+        // Typed emit: value is written straight to JSON through codec<T>, with no message tree.
+        template <typename T>
+            requires has_codec<T>
+        emit_status emit(std::string const &event_name, T const &value)
+        {
+            std::string json;
+            json_writer writer(json);
+            writer.begin_array();
+            writer.value(std::string_view(event_name));
+            codec<T>::write(writer, value);
+            writer.end_array();
+            return emit_json(event_name, std::move(json));
+        }
+
+        // Sent only if the namespace is connected and the transport isn't backlogged
+        // (client_options::send_backlog_max_bytes); otherwise dropped, never buffered.
+        emit_status emit_volatile(std::string const &event_name, message::list const &msglist = nullptr);
+
+        // Emit many events in one call, in order: they reach the io thread as one
+        // run, with one wake-up, and their frames join the send queue under one
+        // lock. Returns queued when connected; otherwise each event goes through
+        // the offline buffer and the result is buffered, or the first dropped or
+        // would_block. No acks.
+        emit_status emit_batch(std::vector<batch_event> const &events);
+
+        // Latest value wins: replaces a still unsent packet emitted this way with the
+        // same event name and key, in the offline buffer and in the send queue.
+        // Packets with binary attachments are queued without coalescing.
+        emit_status emit_latest(std::string const &event_name, message::list const &msglist = nullptr, std::string const &key = std::string());
+
+        // Send a large binary as a series of event_name events, each carrying
+        // (stream id, sequence number, chunk, last). The producer runs on the io
+        // thread and is only pulled while fewer than two of the stream's chunks
+        // are unwritten and the transport is under
+        // client_options::send_backlog_max_bytes, so memory is bounded by the
+        // chunk size rather than by the blob. Returns the stream id, 0 if not
+        // connected.
+        unsigned emit_stream(std::string const &event_name,
+                             stream_producer const &producer,
+                             stream_done_listener const &done = nullptr,
+                             size_t chunk_size = 64 * 1024);
+
+        // Receive the chunks of emit_stream streams as they arrive.
+        void on_stream(std::string const &event_name, stream_listener const &listener);
+
+        // Emit an event encoded beforehand with encoded_packet::create; the same
+        // packet can go to many sockets, or out again after a reconnect.
+        emit_status emit_encoded(encoded_packet::ptr const &encoded);
+
+        emit_status emit_encoded_with_ack(encoded_packet::ptr const &encoded, std::function<void(message::list const &)> const &ack);
+
+        // Emit a complete, pre-encoded JSON event array (name first). It is sent
+        // as is; the caller is responsible for it being valid.
+        emit_status emit_json(std::string const &event_name, std::string &&event_array);
+
+        emit_status emit_with_ack(std::string const &event_name, message::list const &msglist, std::function<void(message::list const &)> const &ack);
+
+        emit_status emit_with_ack(std::string const &event_name,
                           message::list const &msglist,
                           std::function<void(message::list const &)> const &ack,
                           unsigned timeout_ms,
                           std::function<void()> const &timeout_callback);
 
-        // C++20 Coroutine support - async emit with co_await
+        // Like emit_with_ack, but on_ack is handed the ack's arguments as an
+        // rvalue to keep without copying. timeout_ms 0 means no timeout;
+        // on_timeout may be null. Backs emit_async and sio::async_emit.
+        emit_status emit_with_ack_move(std::string const &event_name,
+                                       message::list const &msglist,
+                                       std::function<void(message::list &&)> &&on_ack,
+                                       unsigned timeout_ms = 0,
+                                       std::function<void()> &&on_timeout = nullptr);
+
+        // C++20 Coroutine support - async emit with co_await. The task resumes
+        // its awaiter on the thread the ack arrives on, normally the io
+        // thread; sio::async_emit (sio_asio.h) resumes on an executor instead.
         emit_task emit_async(std::string const &event_name,
                             message::list const &msglist = nullptr);
 
+        // timeout_ms 0 waits without a timeout.
         emit_task emit_async(std::string const &event_name,
                             message::list const &msglist,
                             unsigned timeout_ms);
 
+        // Applies to packets buffered from now on; the default is unbounded.
+        void set_offline_buffer(offline_buffer_config const &config);
+
+        void set_buffer_listener(buffer_listener const &l);
+
+        size_t get_buffered_count() const;
+
         std::string const &get_namespace() const;
 
+        // True if the last connect restored the previous session (server-side
+        // connectionStateRecovery): events missed while disconnected are replayed
+        // and rooms are kept, so there is nothing to resync. Check it in the
+        // socket open listener. Recovery-enabled servers append an offset string
+        // to every event; it is left in the arguments, as in the JS client.
+        bool recovered() const;
+
         connection_metrics get_metrics() const;
 
     protected:
@@ -138,6 +340,11 @@ namespace sio
 
         void on_message_packet(packet const &p);
 
+        // On the io thread, for each event in arrival order: notes its recovery offset.
+        void take_offset(packet const &p);
+
+        void on_argument_error(event const &ev);
+
         friend class client_impl;
 
     private:
@@ -146,11 +353,8 @@ namespace sio
         void operator=(socket const &) {}
 
         class impl;
-        struct impl_deleter
-        {
-            void operator()(impl *p) const;
-        };
-        std::unique_ptr<impl, impl_deleter> m_impl;
+        // Shared so handlers posted to the io thread can keep impl alive while they run.
+        std::shared_ptr<impl> m_impl;
     };
 }
 #endif // SIO_SOCKET_H
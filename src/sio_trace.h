@@ -0,0 +1,47 @@
+//
+//  sio_trace.h
+//
+//  Begin/end hooks around each stage a packet goes through.
+//
+
+#ifndef SIO_TRACE_H
+#define SIO_TRACE_H
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string_view>
+
+namespace sio
+{
+    enum class trace_point
+    {
+        emit,     // socket::emit*, on the emitting thread: building and queueing the packet
+        encode,   // One packet into its frames, on the io thread
+        write,    // One frame handed to websocketpp
+        receive,  // One inbound frame, decoding and handlers included
+        decode,   // Parsing one inbound frame, handlers excluded
+        dispatch  // The listeners of one event, on the io thread or a worker
+    };
+
+    struct trace_record
+    {
+        trace_point point;
+        // True at the start of the span, false at its end.
+        bool begin;
+        std::chrono::steady_clock::time_point time;
+        // Empty where unknown: frames carry no namespace until decoded.
+        std::string_view nsp;
+        // Event name for emit and dispatch.
+        std::string_view event_name;
+        // Ack id, or -1.
+        int pack_id;
+        // Frame size for write, receive and decode.
+        std::size_t bytes;
+    };
+
+    // Called at both ends of every span, on the thread doing the work, so it
+    // must be thread-safe and quick. Views in the record are only valid during
+    // the call. Builds with SIO_DISABLE_TRACING compile the hooks out.
+    typedef std::function<void(trace_record const &)> trace_listener;
+}
+#endif // SIO_TRACE_H
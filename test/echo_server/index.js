@@ -1,6 +1,9 @@
 var port = 3000;
 
-var io = require('socket.io')().listen(port);
+// Connection state recovery for test/echo_server_test.cpp; the server then
+// appends an offset to every event it emits. permessage-deflate is accepted
+// when a client offers it, and frames from 1024 bytes up are compressed.
+var io = require('socket.io')({ connectionStateRecovery: {}, perMessageDeflate: { threshold: 1024 } }).listen(port);
 console.log("Listening on port " + port);
 
 /* Socket.IO events */
@@ -34,4 +37,54 @@ io.on("connection", function(socket){
       }
     });
 
+    // benchmark/e2e_bench.cpp and test/echo_server_test.cpp: answer bench_ack
+    // with its own arguments.
+    socket.on('bench_ack', (...args) => {
+      var fn = args.pop();
+      if ('function' == typeof fn)
+      {
+        fn(...args);
+      }
+    });
+
+    socket.on('bench', () => {});
+
+    // test/echo_server_test.cpp: emit `count` burst events, then disconnect the namespace.
+    socket.on('burst_then_disconnect', (count) => {
+      for (var i = 0; i < count; i++)
+      {
+        socket.emit('burst', i);
+      }
+      socket.disconnect();
+    });
+
+    // test/echo_server_test.cpp: send the arguments straight back.
+    socket.on('echo', (...args) => {
+      socket.emit('echo', ...args);
+    });
+
+    // test/echo_server_test.cpp: ack with the bytes the TCP connection has
+    // read and written so far, and the websocket extensions in use.
+    socket.on('wire_bytes', (fn) => {
+      var ws = socket.conn.transport.socket;
+      fn(ws._socket.bytesRead, ws._socket.bytesWritten, ws.extensions);
+    });
+
+    // test/echo_server_test.cpp: send emit_stream chunks straight back.
+    socket.on('upload', (id, seq, chunk, last) => {
+      socket.emit('upload_echo', id, seq, chunk, last);
+    });
+
+    // test/echo_server_test.cpp: emit a tick, drop the transport, and emit
+    // 'missed' to the client's room while it is away. It only gets 'missed'
+    // back if it reconnects with the tick's offset.
+    socket.on('drop_and_miss', (room) => {
+      socket.join(room);
+      socket.emit('tick', 1);
+      setTimeout(() => {
+        socket.conn.close();
+        setTimeout(() => io.to(room).emit('missed', 2), 50);
+      }, 50);
+    });
+
   });
\ No newline at end of file
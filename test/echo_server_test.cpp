@@ -0,0 +1,421 @@
+//
+//  echo_server_test.cpp
+//
+//  Tests against test/echo_server, on http://127.0.0.1:3000 or the URL in
+//  SIO_ECHO_SERVER. They are skipped when it isn't running.
+//
+
+#include <catch2/catch_test_macros.hpp>
+#include "sio_client.h"
+#include "sio_client_hub.h"
+#include <asio/executor_work_guard.hpp>
+#include <asio/io_context.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    std::string echo_server_url()
+    {
+        char const *url = std::getenv("SIO_ECHO_SERVER");
+        return url ? url : "http://127.0.0.1:3000";
+    }
+
+    // Emits "echo" and waits for it to come back.
+    bool echo_round_trip(sio::client &client, int64_t value)
+    {
+        std::mutex m;
+        std::condition_variable cv;
+        bool echoed = false;
+        sio::socket::ptr s = client.socket();
+        s->on("echo", sio::socket::event_listener([&](sio::event &ev) {
+            std::lock_guard<std::mutex> guard(m);
+            echoed = echoed || ev.get_message()->get_int() == value;
+            cv.notify_all();
+        }));
+        s->emit("echo", sio::message::list(sio::int_message::create(value)));
+        std::unique_lock<std::mutex> lock(m);
+        bool ok = cv.wait_for(lock, std::chrono::seconds(5), [&]() { return echoed; });
+        lock.unlock();
+        s->off("echo");
+        return ok;
+    }
+
+    // Emits event_name and waits for its ack; empty if none came.
+    sio::message::list wait_for_ack(sio::socket::ptr const &s, std::string const &event_name, sio::message::list const &args)
+    {
+        // Shared: the ack may still come once this gave up on it.
+        auto acked = std::make_shared<std::promise<sio::message::list>>();
+        std::future<sio::message::list> ack = acked->get_future();
+        s->emit_with_ack(event_name, args, [acked](sio::message::list const &result) { acked->set_value(result); });
+        if (ack.wait_for(std::chrono::seconds(5)) != std::future_status::ready)
+        {
+            return sio::message::list();
+        }
+        return ack.get();
+    }
+
+    // Connects, reconnecting quickly or not at all; false if the server didn't answer.
+    bool connect_to_echo_server(sio::client &client, bool reconnect = false)
+    {
+        std::mutex m;
+        std::condition_variable cv;
+        int state = 0; // 1 open, -1 failed
+        sio::reconnect_config config(5, 100, 200);
+        client.set_reconnect_config(reconnect ? config : sio::reconnect_config::disabled());
+        client.set_open_listener([&]() {
+            std::lock_guard<std::mutex> guard(m);
+            state = 1;
+            cv.notify_all();
+        });
+        client.set_fail_listener([&](sio::client::connection_error) {
+            std::lock_guard<std::mutex> guard(m);
+            state = -1;
+            cv.notify_all();
+        });
+        client.set_logs_quiet();
+        client.connect(echo_server_url());
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait_for(lock, std::chrono::seconds(3), [&]() { return state != 0; });
+        bool opened = state == 1;
+        lock.unlock();
+        client.set_open_listener(nullptr);
+        client.set_fail_listener(nullptr);
+        return opened;
+    }
+}
+
+#define REQUIRE_ECHO_SERVER(...)                                             \
+    do                                                                       \
+    {                                                                        \
+        if (!connect_to_echo_server(__VA_ARGS__))                            \
+        {                                                                    \
+            SKIP("test/echo_server isn't running at " << echo_server_url()); \
+        }                                                                    \
+    } while (0)
+
+TEST_CASE("Echo server - disconnect runs after queued event handlers", "[echo_server]")
+{
+    for (auto ordering : {sio::client_options::handler_ordering::per_namespace, sio::client_options::handler_ordering::per_event})
+    {
+        sio::client_options options;
+        options.event_worker_threads = 2;
+        options.worker_ordering = ordering;
+        sio::client client(options);
+
+        std::mutex m;
+        std::condition_variable cv;
+        std::vector<int> received;
+        size_t received_at_close = 0;
+        bool closed = false;
+        client.set_socket_close_listener([&](std::string const &) {
+            std::lock_guard<std::mutex> guard(m);
+            received_at_close = received.size();
+            closed = true;
+            cv.notify_all();
+        });
+        REQUIRE_ECHO_SERVER(client);
+        client.socket()->on("burst", sio::socket::event_listener([&](sio::event &ev) {
+            // Slow enough that the disconnect arrives while these are queued.
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            std::lock_guard<std::mutex> guard(m);
+            received.push_back(static_cast<int>(ev.get_message()->get_int()));
+        }));
+        client.socket()->emit("burst_then_disconnect", sio::message::list(sio::int_message::create(50)));
+
+        std::unique_lock<std::mutex> lock(m);
+        REQUIRE(cv.wait_for(lock, std::chrono::seconds(5), [&]() { return closed; }));
+        CHECK(received_at_close == 50);
+        if (ordering == sio::client_options::handler_ordering::per_namespace)
+        {
+            std::vector<int> expected;
+            for (int i = 0; i < 50; ++i)
+            {
+                expected.push_back(i);
+            }
+            CHECK(received == expected);
+        }
+        lock.unlock();
+        client.sync_close();
+    }
+}
+
+TEST_CASE("Echo server - recovery offset survives a reconnect", "[echo_server]")
+{
+    sio::client_options options;
+    // The offset is taken on the io thread even when handlers aren't.
+    options.event_worker_threads = 2;
+    sio::client client(options);
+
+    std::mutex m;
+    std::condition_variable cv;
+    bool ticked = false;
+    bool missed = false;
+    bool reopened = false;
+    bool recovered = false;
+    int opens = 0;
+    client.set_socket_open_listener([&](std::string const &) {
+        std::lock_guard<std::mutex> guard(m);
+        if (++opens > 1)
+        {
+            reopened = true;
+            recovered = client.socket()->recovered();
+            cv.notify_all();
+        }
+    });
+    REQUIRE_ECHO_SERVER(client, true);
+    sio::socket::ptr s = client.socket();
+    s->on("tick", sio::socket::event_listener([&](sio::event &ev) {
+        std::lock_guard<std::mutex> guard(m);
+        // The offset stays in the arguments, after the event's own.
+        CHECK(ev.get_messages().size() == 2);
+        ticked = true;
+        cv.notify_all();
+    }));
+    s->on("missed", sio::socket::event_listener([&](sio::event &) {
+        std::lock_guard<std::mutex> guard(m);
+        missed = true;
+        cv.notify_all();
+    }));
+    s->emit("drop_and_miss", sio::message::list(sio::string_message::create("offset_round_trip")));
+
+    std::unique_lock<std::mutex> lock(m);
+    REQUIRE(cv.wait_for(lock, std::chrono::seconds(5), [&]() { return ticked && reopened; }));
+    CHECK(recovered);
+    // Replayed from the tick's offset on.
+    CHECK(cv.wait_for(lock, std::chrono::seconds(5), [&]() { return missed; }));
+    lock.unlock();
+    client.sync_close();
+}
+
+TEST_CASE("Echo server - emit_stream chunks round trip", "[echo_server]")
+{
+    sio::client_options options;
+    // The stream's own window still bounds it.
+    options.send_backlog_max_bytes = 0;
+    sio::client client(options);
+    REQUIRE_ECHO_SERVER(client);
+    sio::socket::ptr s = client.socket();
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::vector<sio::stream_chunk> chunks;
+    int done = 0; // 1 completed, -1 failed
+    s->on_stream("upload_echo", [&](sio::stream_chunk const &chunk) {
+        std::lock_guard<std::mutex> guard(m);
+        chunks.push_back(chunk);
+        cv.notify_all();
+    });
+    const size_t total = 9500;
+    size_t produced = 0;
+    unsigned id = s->emit_stream("upload", [&](std::string &chunk, size_t max_bytes) {
+        size_t n = std::min(max_bytes, total - produced);
+        chunk.assign(n, static_cast<char>('a' + produced / max_bytes));
+        produced += n;
+        return produced < total;
+    }, [&](bool completed) {
+        std::lock_guard<std::mutex> guard(m);
+        done = completed ? 1 : -1;
+        cv.notify_all();
+    }, 1000);
+    REQUIRE(id != 0);
+
+    std::unique_lock<std::mutex> lock(m);
+    REQUIRE(cv.wait_for(lock, std::chrono::seconds(5), [&]() { return done != 0 && !chunks.empty() && chunks.back().last; }));
+    CHECK(done == 1);
+    REQUIRE(chunks.size() == 10);
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+        CHECK(chunks[i].stream_id == id);
+        CHECK(chunks[i].seq == i);
+        CHECK(chunks[i].last == (i == 9));
+        CHECK(chunks[i].data->size() == (i == 9 ? 500 : 1000));
+        CHECK(chunks[i].data->front() == static_cast<char>('a' + i));
+    }
+    lock.unlock();
+    client.sync_close();
+}
+
+TEST_CASE("Echo server - emit_stream reports a closed connection", "[echo_server]")
+{
+    sio::client_options options;
+    options.send_backlog_max_bytes = 0;
+    sio::client client(options);
+    REQUIRE_ECHO_SERVER(client);
+
+    std::mutex m;
+    std::condition_variable cv;
+    int done = 0;
+    std::atomic<size_t> pulled{0};
+    // Never ends: only the close stops it, and the window keeps it from
+    // being pulled all at once meanwhile.
+    client.socket()->emit_stream("upload", [&](std::string &chunk, size_t max_bytes) {
+        chunk.assign(max_bytes, 'x');
+        pulled.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }, [&](bool completed) {
+        std::lock_guard<std::mutex> guard(m);
+        done = completed ? 1 : -1;
+        cv.notify_all();
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    client.close();
+
+    std::unique_lock<std::mutex> lock(m);
+    REQUIRE(cv.wait_for(lock, std::chrono::seconds(5), [&]() { return done != 0; }));
+    CHECK(done == -1);
+    CHECK(pulled.load() > 0);
+    lock.unlock();
+    client.sync_close();
+}
+
+TEST_CASE("Echo server - emit_volatile only sends while connected", "[echo_server]")
+{
+    sio::client client;
+    // Never buffered, unlike emit.
+    CHECK(client.socket()->emit_volatile("echo", sio::message::list(sio::int_message::create(1))) == sio::emit_status::dropped);
+    CHECK(client.socket()->get_buffered_count() == 0);
+    REQUIRE_ECHO_SERVER(client);
+
+    std::mutex m;
+    std::condition_variable cv;
+    std::vector<int64_t> echoed;
+    client.socket()->on("echo", sio::socket::event_listener([&](sio::event &ev) {
+        std::lock_guard<std::mutex> guard(m);
+        echoed.push_back(ev.get_message()->get_int());
+        cv.notify_all();
+    }));
+    CHECK(client.socket()->emit_volatile("echo", sio::message::list(sio::int_message::create(2))) == sio::emit_status::queued);
+
+    std::unique_lock<std::mutex> lock(m);
+    REQUIRE(cv.wait_for(lock, std::chrono::seconds(5), [&]() { return !echoed.empty(); }));
+    CHECK(echoed == std::vector<int64_t>{2});
+    lock.unlock();
+    client.sync_close();
+}
+
+TEST_CASE("Echo server - emit_latest sends the last value per key", "[echo_server]")
+{
+    sio::client client;
+    sio::socket::ptr s = client.socket();
+    std::mutex m;
+    std::condition_variable cv;
+    std::vector<std::string> echoed;
+    s->on("echo", sio::socket::event_listener([&](sio::event &ev) {
+        std::lock_guard<std::mutex> guard(m);
+        echoed.push_back(ev.get_messages()[0]->get_string());
+        cv.notify_all();
+    }));
+    // Buffered until connected, where newer values replace older ones.
+    for (char const *value : {"x1", "y1", "x2", "x3", "y2"})
+    {
+        char const key[] = {value[0], '\0'};
+        CHECK(s->emit_latest("echo", sio::message::list(value), key) == sio::emit_status::buffered);
+    }
+    CHECK(s->get_buffered_count() == 2);
+    REQUIRE_ECHO_SERVER(client);
+
+    std::unique_lock<std::mutex> lock(m);
+    REQUIRE(cv.wait_for(lock, std::chrono::seconds(5), [&]() { return echoed.size() >= 2; }));
+    // Each in the place of its key's first value.
+    CHECK(echoed == (std::vector<std::string>{"x3", "y2"}));
+    lock.unlock();
+    client.sync_close();
+}
+
+TEST_CASE("Echo server - hub clients share its io threads", "[echo_server]")
+{
+    sio::client_hub hub(2);
+    CHECK(hub.get_thread_count() == 2);
+    std::vector<std::unique_ptr<sio::client>> clients;
+    for (int i = 0; i < 3; ++i)
+    {
+        clients.push_back(hub.make_client());
+    }
+    for (std::unique_ptr<sio::client> &client : clients)
+    {
+        REQUIRE_ECHO_SERVER(*client);
+    }
+    for (size_t i = 0; i < clients.size(); ++i)
+    {
+        CHECK(echo_round_trip(*clients[i], static_cast<int64_t>(i)));
+    }
+    // sync_close waits for the close on the hub's thread, then the destructor.
+    clients[0]->sync_close();
+    CHECK(!clients[0]->opened());
+    clients.clear();
+}
+
+TEST_CASE("Echo server - client on a caller-run io_context", "[echo_server]")
+{
+    asio::io_context io;
+    auto work = asio::make_work_guard(io);
+    std::thread runner([&io]() { io.run(); });
+    bool connected = false;
+    {
+        sio::client_options options;
+        options.io_context = &io;
+        options.run_io_thread = false;
+        sio::client client(options);
+        // CHECK only until runner is joined: a throw here would leave it running.
+        connected = connect_to_echo_server(client);
+        if (connected)
+        {
+            CHECK(echo_round_trip(client, 42));
+            // No thread to join: waits for the connection to close on runner.
+            client.sync_close();
+            CHECK(!client.opened());
+            // Connects again on the same context.
+            CHECK(connect_to_echo_server(client));
+            CHECK(echo_round_trip(client, 43));
+        }
+        // The destructor waits for the close too, while runner still runs io.
+    }
+    work.reset();
+    runner.join();
+    if (!connected)
+    {
+        SKIP("test/echo_server isn't running at " << echo_server_url());
+    }
+}
+
+TEST_CASE("Echo server - permessage-deflate compresses frames both ways", "[echo_server]")
+{
+#if !SIO_PERMESSAGE_DEFLATE
+    SKIP("sioclient was built without ENABLE_PERMESSAGE_DEFLATE");
+#else
+    sio::client_options options;
+    options.permessage_deflate = true;
+    sio::client client(options);
+    REQUIRE_ECHO_SERVER(client);
+    sio::socket::ptr s = client.socket();
+
+    sio::message::list before = wait_for_ack(s, "wire_bytes", sio::message::list());
+    REQUIRE(before.size() == 3);
+    CHECK(before[2]->get_string() == "permessage-deflate");
+    // 64 KiB that deflate shrinks to a few hundred bytes, there and back.
+    std::string payload;
+    while (payload.size() < 65536)
+    {
+        payload += "0123456789abcdef";
+    }
+    sio::message::list echoed = wait_for_ack(s, "bench_ack", sio::message::list(payload));
+    REQUIRE(echoed.size() == 1);
+    CHECK(echoed[0]->get_string() == payload);
+    sio::message::list after = wait_for_ack(s, "wire_bytes", sio::message::list());
+    REQUIRE(after.size() == 3);
+    // Uncompressed, either direction would have carried over 64 KiB.
+    CHECK(after[0]->get_int() - before[0]->get_int() < 4096);
+    CHECK(after[1]->get_int() - before[1]->get_int() < 4096);
+    client.sync_close();
+#endif
+}
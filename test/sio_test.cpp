@@ -6,6 +6,14 @@
 
 #include <sio_client.h>
 #include <internal/sio_packet.h>
+#include <internal/sio_mpsc_queue.h>
+#include <internal/sio_timer_wheel.h>
+#include <internal/sio_ack_slab.h>
+#include <internal/sio_histogram.h>
+#include <internal/sio_send_queue.h>
+#include <internal/sio_offline_buffer.h>
+#include <internal/sio_host_resolver.h>
+#include <algorithm>
 #include <functional>
 #include <iostream>
 #include <thread>
@@ -234,3 +242,1191 @@ TEST_CASE( "test_packet_parse_4" )
     CHECK(array->get_vector()[2]->get_string() == "text");
 
 }
+
+TEST_CASE( "test_packet_parse_header_edges" )
+{
+    packet p;
+    // Separators inside the JSON are never taken for header ones.
+    CHECK(p.parse("451-[\"a-b,c/d\",{\"_placeholder\":true,\"num\":0}]"));
+    CHECK(p.get_nsp() == "/");
+    CHECK(p.get_pack_id() == -1);
+    CHECK(!p.parse("42[\"/path,with-dash\",1]"));
+    CHECK(p.get_nsp() == "/");
+    REQUIRE(p.get_message());
+    CHECK(p.get_message()->get_vector()[0]->get_string() == "/path,with-dash");
+
+    CHECK(!p.parse("40/admin,{\"sid\":\"abc\"}"));
+    CHECK(p.get_nsp() == "/admin");
+    REQUIRE(p.get_message());
+    CHECK(p.get_message()->get_map().at("sid")->get_string() == "abc");
+
+    CHECK(!p.parse("41/chat,"));
+    CHECK(p.get_nsp() == "/chat");
+    CHECK(!p.get_message());
+
+    CHECK(!p.parse("0{\"sid\":\"s\",\"pingInterval\":25000}"));
+    CHECK(p.get_frame() == packet::frame_open);
+    REQUIRE(p.get_message());
+
+    // Malformed attachment counts.
+    CHECK(!p.parse("45[\"e\"]"));
+    CHECK(!p.parse("45x-[\"e\"]"));
+    CHECK(!p.parse("45-[\"e\"]"));
+}
+
+TEST_CASE( "test_packet_parse_zero_copy" )
+{
+    decode_options options;
+    options.zero_copy = true;
+    packet p;
+    auto payload = std::make_shared<const std::string>("42/nsp,7[\"event\",\"a string well past the small string buffer\",{\"key\":\"value\"}]");
+    bool hasbin = p.parse(payload, options);
+    CHECK(!hasbin);
+    CHECK(p.get_nsp() == "/nsp");
+    CHECK(p.get_pack_id() == 7);
+    message::ptr msg = p.get_message();
+    REQUIRE(msg);
+    REQUIRE(msg->get_flag() == message::flag_array);
+    CHECK(msg->get_vector()[0]->get_string_view() == "event");
+    CHECK(msg->get_vector()[1]->get_string_view() == "a string well past the small string buffer");
+    CHECK(msg->get_vector()[1]->get_string() == "a string well past the small string buffer");
+    REQUIRE(msg->get_vector()[2]->get_flag() == message::flag_object);
+    CHECK(msg->get_vector()[2]->get_map()["key"]->get_string() == "value");
+
+    // Views stay valid after the packet and payload are gone.
+    message::ptr text = msg->get_vector()[1];
+    p = packet();
+    payload.reset();
+    msg.reset();
+    CHECK(text->get_string_view() == "a string well past the small string buffer");
+}
+
+TEST_CASE( "test_packet_parse_binary_retained_payload" )
+{
+    packet p;
+    std::string header = "451-[\"bin_event\",{\"_placeholder\":true,\"num\":0}]";
+    bool hasbin = p.parse(std::make_shared<const std::string>(header));
+    REQUIRE(hasbin);
+    char buf[10];
+    buf[0] = packet::frame_message;
+    memset(buf + 1, 2, 9);
+    CHECK(!p.parse_buffer(std::string(buf, 10)));
+    message::ptr msg = p.get_message();
+    REQUIRE(msg);
+    CHECK(msg->get_vector()[0]->get_string() == "bin_event");
+    REQUIRE(msg->get_vector()[1]->get_flag() == message::flag_binary);
+    CHECK(msg->get_vector()[1]->get_binary()->size() == 10);
+}
+
+TEST_CASE( "test_packet_parse_lazy" )
+{
+    decode_options options;
+    options.lazy = true;
+    packet p;
+    std::string payload = "42/nsp,[\"route\",{\"type\":\"move\",\"pos\":{\"x\":1.5,\"y\":-2}},[true,null]]";
+    bool hasbin = p.parse(payload, options);
+    CHECK(!hasbin);
+    CHECK(p.get_nsp() == "/nsp");
+    CHECK(p.get_raw_json() == "[\"route\",{\"type\":\"move\",\"pos\":{\"x\":1.5,\"y\":-2}},[true,null]]");
+    std::string name;
+    CHECK(p.get_event_name(name));
+    CHECK(name == "route");
+    message::ptr type = p.get_field("/1/type");
+    REQUIRE(type);
+    CHECK(type->get_string() == "move");
+    message::ptr pos = p.get_field("/1/pos");
+    REQUIRE(pos);
+    REQUIRE(pos->get_flag() == message::flag_object);
+    CHECK(pos->get_map()["x"]->get_double() == 1.5);
+    CHECK(pos->get_map()["y"]->get_int() == -2);
+    CHECK(!p.get_field("/1/missing"));
+    CHECK(!p.get_field("/7"));
+
+    // The full tree is still available, and field lookups then walk it.
+    message::ptr msg = p.get_message();
+    REQUIRE(msg);
+    REQUIRE(msg->get_flag() == message::flag_array);
+    CHECK(msg->get_vector().size() == 3);
+    CHECK(p.get_field("/2/0")->get_bool());
+    CHECK(p.get_field("/2/1")->get_flag() == message::flag_null);
+    CHECK(p.get_field("/1/type")->get_string() == "move");
+}
+
+TEST_CASE( "test_packet_parse_lazy_binary" )
+{
+    decode_options options;
+    options.lazy = true;
+    packet p;
+    bool hasbin = p.parse(std::string("451-[\"bin_event\",{\"data\":{\"_placeholder\":true,\"num\":0}}]"), options);
+    REQUIRE(hasbin);
+    CHECK(p.get_raw_json().empty());
+    char buf[4] = {packet::frame_message, 1, 2, 3};
+    CHECK(!p.parse_buffer(std::string(buf, 4)));
+    message::ptr data = p.get_field("/1/data");
+    REQUIRE(data);
+    REQUIRE(data->get_flag() == message::flag_binary);
+    CHECK(data->get_binary()->size() == 4);
+    REQUIRE(p.get_message());
+    CHECK(p.get_message()->get_vector()[1]->get_map()["data"]->get_flag() == message::flag_binary);
+}
+
+TEST_CASE( "test_message_pool_cross_thread" )
+{
+    // Nodes built on one thread and released on another stay valid and are reusable.
+    std::vector<message::ptr> built;
+    std::thread producer([&built]() {
+        for (int i = 0; i < 1000; ++i)
+        {
+            message::ptr obj = object_message::create();
+            obj->get_map()["i"] = int_message::create(i);
+            obj->get_map()["s"] = string_message::create("value");
+            built.push_back(obj);
+        }
+    });
+    producer.join();
+    CHECK(built[999]->get_map()["i"]->get_int() == 999);
+    built.clear();
+
+    message::ptr reused = array_message::create();
+    for (int i = 0; i < 100; ++i)
+    {
+        reused->get_vector().push_back(double_message::create(i * 0.5));
+    }
+    CHECK(reused->get_vector()[99]->get_double() == 49.5);
+
+    // Blocks freed on another thread go back to the thread that allocated them.
+    size_t reused_blocks = 0;
+    std::thread owner([&reused_blocks]() {
+        std::vector<void *> blocks;
+        for (int i = 0; i < 64; ++i)
+        {
+            blocks.push_back(message_pool::allocate(48));
+        }
+        std::thread releaser([&blocks]() {
+            for (void *b : blocks)
+            {
+                message_pool::deallocate(b, 48);
+            }
+        });
+        releaser.join();
+        // A pool adopted from an exited thread may hand out its own leftovers first.
+        std::vector<void *> taken;
+        while (reused_blocks < blocks.size() && taken.size() < 65536)
+        {
+            taken.push_back(message_pool::allocate(48));
+            reused_blocks += std::find(blocks.begin(), blocks.end(), taken.back()) != blocks.end();
+        }
+        for (void *b : taken)
+        {
+            message_pool::deallocate(b, 48);
+        }
+    });
+    owner.join();
+    CHECK(reused_blocks == 64);
+}
+
+TEST_CASE( "test_object_at_survives_growth" )
+{
+    message::ptr msg = object_message::create();
+    object_message &obj = static_cast<object_message &>(*msg);
+    obj.insert("first", string_message::create("kept"));
+    message::ptr first = obj.at("first");
+    for (int i = 0; i < 100; ++i)
+    {
+        obj.insert("k" + std::to_string(i), int_message::create(i));
+    }
+    CHECK(first->get_string() == "kept");
+    CHECK(!obj.at("missing"));
+
+    // Reading through the const map keeps only the map.
+    object_message const &read = obj;
+    CHECK(read.get_map().size() == 101);
+    CHECK(!read.is_ordered());
+    CHECK(read.get_fields().empty());
+    CHECK(read.at("k42")->get_int() == 42);
+}
+
+TEST_CASE( "test_object_wire_order" )
+{
+    packet p;
+    std::string json = "[\"event\",{\"z\":1,\"a\":{\"y\":true,\"b\":null},\"m\":\"text\"}]";
+    p.parse("42" + json);
+    message::ptr msg = p.get_message();
+    REQUIRE(msg);
+    object_message const *obj = static_cast<object_message const *>(msg->get_vector()[1].get());
+    CHECK(obj->is_ordered());
+    REQUIRE(obj->get_fields().size() == 3);
+    CHECK(obj->get_fields()[0].first == "z");
+    CHECK(obj->at("m")->get_string() == "text");
+    CHECK(!obj->has("missing"));
+
+    // Re-encoding a decoded object is byte-stable.
+    packet out("/", msg);
+    std::string payload;
+    std::vector<std::shared_ptr<const std::string> > buffers;
+    out.accept(payload, buffers);
+    CHECK(payload == "42" + json);
+
+    // get_map() stays available and switches the object to map storage.
+    message::ptr inner = msg->get_vector()[1];
+    inner->get_map()["k"] = int_message::create(2);
+    CHECK(!static_cast<object_message *>(inner.get())->is_ordered());
+    CHECK(static_cast<object_message *>(inner.get())->at("k")->get_int() == 2);
+    CHECK(static_cast<object_message *>(inner.get())->size() == 4);
+}
+
+TEST_CASE( "test_object_hashed_lookup" )
+{
+    message::ptr msg = object_message::create();
+    object_message *obj = static_cast<object_message *>(msg.get());
+    for (int i = 0; i < 100; ++i)
+    {
+        obj->insert("key" + std::to_string(i), int_message::create(i));
+    }
+    obj->insert("key42", int_message::create(-42));
+    CHECK(obj->size() == 100);
+    CHECK(obj->at("key42")->get_int() == -42);
+    CHECK(obj->at("key99")->get_int() == 99);
+    CHECK(!obj->at("key100"));
+    CHECK(obj->get_fields()[0].first == "key0");
+    CHECK(obj->get_fields()[99].first == "key99");
+}
+
+TEST_CASE( "test_packet_accept_numbers_and_escapes" )
+{
+    message::ptr array = array_message::create();
+    array->get_vector().push_back(string_message::create("telemetry"));
+    array->get_vector().push_back(double_message::create(0.1));
+    array->get_vector().push_back(double_message::create(3.14159265358979));
+    array->get_vector().push_back(double_message::create(1e21));
+    array->get_vector().push_back(double_message::create(-2.5e-7));
+    array->get_vector().push_back(double_message::create(42.0));
+    array->get_vector().push_back(int_message::create(-9007199254740993LL));
+    // Escapes at both ends of, and inside, runs longer than one 16-byte block.
+    array->get_vector().push_back(string_message::create("\"a long plain run of text\\then\n\x01 more plain text\t"));
+    packet p("/", array, 12);
+    std::string payload;
+    std::vector<std::shared_ptr<const std::string> > buffers;
+    p.accept(payload, buffers);
+    CHECK(buffers.empty());
+    CHECK(payload == "4212[\"telemetry\",0.1,3.14159265358979,1e+21,-2.5e-07,42,-9007199254740993,"
+                     "\"\\\"a long plain run of text\\\\then\\n\\u0001 more plain text\\t\"]");
+}
+
+TEST_CASE( "test_packet_accept_binary_header" )
+{
+    message::ptr array = array_message::create();
+    array->get_vector().push_back(string_message::create("files"));
+    for (int i = 0; i < 12; ++i)
+    {
+        array->get_vector().push_back(binary_message::create(std::make_shared<const std::string>(1, char(i))));
+    }
+    packet p("/nsp", array, 3, true);
+    std::string payload;
+    std::vector<std::shared_ptr<const std::string> > buffers;
+    CHECK(p.accept(payload, buffers));
+    CHECK(buffers.size() == 12);
+    CHECK(p.get_type() == packet::type_binary_ack);
+    CHECK(payload.rfind("4612-/nsp,3[\"files\",{\"_placeholder\":true,\"num\":0},", 0) == 0);
+}
+
+TEST_CASE( "test_mpsc_queue_producers" )
+{
+    const int producers = 8;
+    const int per_producer = 20000;
+    mpsc_queue<std::pair<int, int> > queue;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < producers; ++t)
+    {
+        threads.emplace_back([&queue, t]() {
+            for (int i = 0; i < per_producer; ++i)
+            {
+                queue.push(std::make_pair(t, i));
+            }
+        });
+    }
+    // Consume concurrently; each producer's values must come out in order.
+    std::vector<int> next(producers, 0);
+    int received = 0;
+    bool ordered = true;
+    while (received < producers * per_producer)
+    {
+        std::pair<int, int> v;
+        if (queue.pop(v))
+        {
+            ordered = ordered && v.second == next[v.first];
+            next[v.first] = v.second + 1;
+            ++received;
+        }
+    }
+    for (auto &th : threads)
+    {
+        th.join();
+    }
+    CHECK(ordered);
+    std::pair<int, int> v;
+    CHECK(!queue.pop(v));
+}
+
+namespace
+{
+    send_queue::frame queued_frame(size_t bytes, std::string const &key = std::string())
+    {
+        return send_queue::frame{std::make_shared<const std::string>(bytes, 'x'), false, key, {}};
+    }
+}
+
+TEST_CASE( "test_send_queue_batches" )
+{
+    send_queue queue(100, std::chrono::microseconds(0));
+    queue.push(queued_frame(40));
+    CHECK(queue.schedule() == send_queue::kick::flush);
+    // Already on its way.
+    queue.push(queued_frame(40));
+    queue.push(queued_frame(40));
+    queue.push(queued_frame(200));
+    CHECK(queue.schedule() == send_queue::kick::none);
+    CHECK(queue.flush_pending());
+    CHECK(queue.size() == 4);
+    CHECK(queue.bytes() == 320);
+
+    // A batch stops once it reaches batch_max_bytes...
+    std::deque<send_queue::frame> batch;
+    CHECK(queue.take_batch(batch));
+    CHECK(batch.size() == 3);
+    CHECK(queue.bytes() == 200);
+    // ...but always takes a frame, even one over the limit.
+    batch.clear();
+    CHECK(!queue.take_batch(batch));
+    REQUIRE(batch.size() == 1);
+    CHECK(batch[0].payload->size() == 200);
+    CHECK(queue.bytes() == 0);
+    CHECK(!queue.flush_pending());
+    CHECK(queue.peak() == 4);
+
+    // Idle again: the next push schedules a new flush.
+    queue.push(queued_frame(10));
+    CHECK(queue.schedule() == send_queue::kick::flush);
+}
+
+TEST_CASE( "test_send_queue_linger" )
+{
+    send_queue queue(100, std::chrono::microseconds(500));
+    queue.push(queued_frame(30));
+    CHECK(queue.schedule() == send_queue::kick::linger);
+    // The linger timer is running, not a flush.
+    CHECK(!queue.flush_pending());
+    queue.push(queued_frame(30));
+    CHECK(queue.schedule() == send_queue::kick::none);
+    // The batch fills: flush without waiting out the linger.
+    queue.push(queued_frame(50));
+    CHECK(queue.schedule() == send_queue::kick::flush_now);
+    CHECK(queue.flush_pending());
+    std::deque<send_queue::frame> batch;
+    CHECK(!queue.take_batch(batch));
+    CHECK(batch.size() == 3);
+
+    // A first frame that fills a batch on its own isn't held back.
+    queue.push(queued_frame(150));
+    CHECK(queue.schedule() == send_queue::kick::flush);
+    batch.clear();
+    CHECK(!queue.take_batch(batch));
+
+    // A flush that finds the queue already emptied just goes idle.
+    batch.clear();
+    CHECK(!queue.take_batch(batch));
+    CHECK(batch.empty());
+}
+
+TEST_CASE( "test_send_queue_coalesces_keys" )
+{
+    send_queue queue(1000, std::chrono::microseconds(0));
+    queue.push(queued_frame(10, "pos"));
+    queue.push(queued_frame(20));
+    queue.push(queued_frame(30, "pos"));
+    CHECK(queue.size() == 2);
+    CHECK(queue.bytes() == 50);
+
+    std::deque<send_queue::frame> batch;
+    queue.take_batch(batch);
+    REQUIRE(batch.size() == 2);
+    // The newer value keeps the older one's place.
+    CHECK(batch[0].payload->size() == 30);
+    CHECK(batch[1].payload->size() == 20);
+
+    // Once sent, the key starts a new frame.
+    queue.push(queued_frame(5, "pos"));
+    CHECK(queue.size() == 1);
+}
+
+TEST_CASE( "test_send_queue_coalesces_after_partial_batch" )
+{
+    send_queue queue(50, std::chrono::microseconds(0));
+    queue.push(queued_frame(30, "a"));
+    queue.push(queued_frame(30));
+    queue.push(queued_frame(10, "b"));
+    queue.push(queued_frame(10, "c"));
+    std::deque<send_queue::frame> batch;
+    REQUIRE(queue.take_batch(batch));
+    CHECK(batch.size() == 2);
+
+    // "a" went out and starts over; "b" and "c" are found where they moved.
+    queue.push(queued_frame(5, "a"));
+    queue.push(queued_frame(12, "c"));
+    queue.push(queued_frame(11, "b"));
+    CHECK(queue.size() == 3);
+    CHECK(queue.bytes() == 28);
+    batch.clear();
+    CHECK(!queue.take_batch(batch));
+    REQUIRE(batch.size() == 3);
+    CHECK(batch[0].coalesce_key == "b");
+    CHECK(batch[0].payload->size() == 11);
+    CHECK(batch[1].coalesce_key == "c");
+    CHECK(batch[1].payload->size() == 12);
+    CHECK(batch[2].coalesce_key == "a");
+    CHECK(batch[2].payload->size() == 5);
+
+    // Emptied: every key starts a new frame.
+    queue.push(queued_frame(1, "b"));
+    queue.push(queued_frame(1, "c"));
+    CHECK(queue.size() == 2);
+}
+
+TEST_CASE( "test_send_queue_counts_written_bytes" )
+{
+    send_queue queue(1000, std::chrono::microseconds(0));
+    queue.push(queued_frame(10));
+    queue.push(queued_frame(20, "pos"));
+    CHECK(queue.pushed() == 30);
+    // A replaced frame counts as written: nothing is left to wait for.
+    queue.push(queued_frame(25, "pos"));
+    CHECK(queue.pushed() == 55);
+    CHECK(queue.pushed() - queue.bytes() == 20);
+    std::deque<send_queue::frame> batch;
+    queue.take_batch(batch);
+    CHECK(queue.pushed() - queue.bytes() == 55);
+}
+
+namespace
+{
+    offline_buffer::result store_packet(offline_buffer &buffer, int pack_id, size_t bytes, std::vector<int> &evicted,
+                                        std::string const &event_name = "e", std::string const &key = std::string())
+    {
+        packet p("/", message::ptr(), pack_id);
+        return buffer.store(p, bytes, event_name, key, evicted);
+    }
+
+    std::vector<int> buffered_ids(offline_buffer &buffer)
+    {
+        std::deque<offline_buffer::entry> entries;
+        buffer.take_all(entries);
+        std::vector<int> ids;
+        for (offline_buffer::entry const &e : entries)
+        {
+            ids.push_back(e.pack.get_pack_id());
+        }
+        return ids;
+    }
+}
+
+TEST_CASE( "test_offline_buffer_drop_oldest" )
+{
+    offline_buffer buffer;
+    offline_buffer_config config;
+    config.max_packets = 2;
+    config.max_bytes = 100;
+    buffer.configure(config);
+    std::vector<int> evicted;
+    CHECK(store_packet(buffer, 1, 10, evicted) == offline_buffer::result::stored);
+    CHECK(store_packet(buffer, 2, 10, evicted) == offline_buffer::result::stored);
+    CHECK(store_packet(buffer, 3, 10, evicted) == offline_buffer::result::stored);
+    CHECK(evicted == std::vector<int>{1});
+    // Evicts as many as it takes to fit the bytes.
+    CHECK(store_packet(buffer, 4, 95, evicted) == offline_buffer::result::stored);
+    CHECK(evicted == (std::vector<int>{1, 2, 3}));
+    CHECK(buffer.bytes() == 95);
+    // Larger than the whole buffer: dropped without evicting anything.
+    CHECK(store_packet(buffer, 5, 101, evicted) == offline_buffer::result::dropped);
+    CHECK(buffered_ids(buffer) == std::vector<int>{4});
+    CHECK(buffer.bytes() == 0);
+}
+
+TEST_CASE( "test_offline_buffer_drop_newest_and_block" )
+{
+    offline_buffer buffer;
+    offline_buffer_config config;
+    config.max_packets = 2;
+    config.policy = offline_buffer_config::overflow_policy::drop_newest;
+    buffer.configure(config);
+    std::vector<int> evicted;
+    store_packet(buffer, 1, 10, evicted);
+    store_packet(buffer, 2, 10, evicted);
+    CHECK(store_packet(buffer, 3, 10, evicted) == offline_buffer::result::dropped);
+    CHECK(evicted.empty());
+    CHECK(buffer.size() == 2);
+
+    // block leaves the packet to the caller, which waits and stores again.
+    config.policy = offline_buffer_config::overflow_policy::block;
+    buffer.configure(config);
+    packet p("/", message::ptr(), 3);
+    CHECK(buffer.store(p, 10, "e", std::string(), evicted) == offline_buffer::result::full);
+    CHECK(p.get_pack_id() == 3);
+    CHECK(buffer.full(10));
+    CHECK(evicted.empty());
+    CHECK(buffered_ids(buffer) == (std::vector<int>{1, 2}));
+    CHECK(!buffer.full(10));
+    CHECK(buffer.store(p, 10, "e", std::string(), evicted) == offline_buffer::result::stored);
+}
+
+TEST_CASE( "test_offline_buffer_coalesces" )
+{
+    offline_buffer buffer;
+    offline_buffer_config config;
+    config.max_bytes = 100;
+    config.policy = offline_buffer_config::overflow_policy::coalesce_by_event;
+    buffer.configure(config);
+    std::vector<int> evicted;
+    store_packet(buffer, 1, 30, evicted, "a");
+    store_packet(buffer, 2, 30, evicted, "b");
+    CHECK(store_packet(buffer, 3, 40, evicted, "a") == offline_buffer::result::stored);
+    CHECK(evicted == std::vector<int>{1});
+    CHECK(buffer.size() == 2);
+    CHECK(buffer.bytes() == 70);
+
+    // Growing past max_bytes: the old value goes, and the new one evicts
+    // the oldest to fit instead of overrunning the cap.
+    CHECK(store_packet(buffer, 4, 80, evicted, "a") == offline_buffer::result::stored);
+    CHECK(evicted == (std::vector<int>{1, 3, 2}));
+    CHECK(buffer.bytes() == 80);
+    CHECK(buffered_ids(buffer) == std::vector<int>{4});
+
+    // emit_latest keys coalesce under any policy, events only under coalesce_by_event.
+    config.policy = offline_buffer_config::overflow_policy::drop_oldest;
+    buffer.configure(config);
+    evicted.clear();
+    store_packet(buffer, 5, 10, evicted, "a", "pos");
+    store_packet(buffer, 6, 10, evicted, "a");
+    store_packet(buffer, 7, 10, evicted, "a", "pos");
+    CHECK(evicted == std::vector<int>{5});
+    CHECK(buffered_ids(buffer) == (std::vector<int>{7, 6}));
+}
+
+TEST_CASE( "test_offline_buffer_watermarks" )
+{
+    offline_buffer buffer;
+    offline_buffer_config config;
+    config.max_packets = 4;
+    config.high_watermark = 3;
+    config.low_watermark = 1;
+    buffer.configure(config);
+    std::vector<int> evicted;
+    bool above = false;
+    store_packet(buffer, 1, 10, evicted);
+    store_packet(buffer, 2, 10, evicted);
+    CHECK(!buffer.crossed_watermark(above));
+    CHECK(!above);
+    store_packet(buffer, 3, 10, evicted);
+    CHECK(buffer.crossed_watermark(above));
+    CHECK(above);
+    // Told once, not on every packet above it.
+    store_packet(buffer, 4, 10, evicted);
+    store_packet(buffer, 5, 10, evicted);
+    CHECK(!buffer.crossed_watermark(above));
+    CHECK(above);
+
+    // Flushed on connect while above: the listener gets its false.
+    std::deque<offline_buffer::entry> entries;
+    CHECK(buffer.take_all(entries));
+    CHECK(entries.size() == 4);
+    store_packet(buffer, 6, 10, evicted);
+    CHECK(!buffer.crossed_watermark(above));
+    CHECK(!above);
+    entries.clear();
+    CHECK(!buffer.take_all(entries));
+}
+
+TEST_CASE( "test_mpsc_queue_push_chain" )
+{
+    const int producers = 4;
+    const int chains = 2000;
+    const int chain_length = 16;
+    struct item
+    {
+        int producer;
+        int seq;
+        int pos; // Position within a chain, -1 for a single push
+    };
+    mpsc_queue<item> queue;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < producers; ++t)
+    {
+        threads.emplace_back([&queue, t]() {
+            int seq = 0;
+            std::vector<item> chain(chain_length);
+            for (int c = 0; c < chains; ++c)
+            {
+                queue.push(item{t, seq++, -1});
+                for (int k = 0; k < chain_length; ++k)
+                {
+                    chain[k] = item{t, seq++, k};
+                }
+                queue.push_chain(chain.begin(), chain.end());
+            }
+        });
+    }
+    // Per-producer order holds, and no other value lands inside a chain.
+    const int total = producers * chains * (chain_length + 1);
+    std::vector<int> next(producers, 0);
+    item last{-1, -1, -1};
+    int received = 0;
+    bool ordered = true;
+    bool contiguous = true;
+    while (received < total)
+    {
+        item v;
+        if (queue.pop(v))
+        {
+            ordered = ordered && v.seq == next[v.producer];
+            next[v.producer] = v.seq + 1;
+            if (last.pos >= 0 && last.pos < chain_length - 1)
+            {
+                contiguous = contiguous && v.producer == last.producer && v.pos == last.pos + 1;
+            }
+            last = v;
+            ++received;
+        }
+    }
+    for (auto &th : threads)
+    {
+        th.join();
+    }
+    CHECK(ordered);
+    CHECK(contiguous);
+    item v;
+    CHECK(!queue.pop(v));
+    std::vector<item> none;
+    queue.push_chain(none.begin(), none.end());
+    CHECK(!queue.pop(v));
+}
+
+TEST_CASE( "test_mpsc_queue_moves_packets" )
+{
+    mpsc_queue<packet> queue;
+    packet p("/nsp", string_message::create("payload"), 3);
+    queue.push(std::move(p));
+    queue.push(packet(packet::frame_ping));
+    packet out;
+    REQUIRE(queue.pop(out));
+    CHECK(out.get_nsp() == "/nsp");
+    CHECK(out.get_message()->get_string() == "payload");
+    REQUIRE(queue.pop(out));
+    CHECK(out.get_frame() == packet::frame_ping);
+    CHECK(!queue.pop(out));
+    // Elements left behind are released with the queue.
+    queue.push(packet(packet::frame_pong));
+}
+
+TEST_CASE( "test_packet_estimated_size" )
+{
+    message::ptr array = array_message::create();
+    array->get_vector().push_back(string_message::create("upload"));
+    message::ptr obj = object_message::create();
+    obj->get_map()["name"] = string_message::create("report.pdf");
+    obj->get_map()["size"] = int_message::create(4096);
+    array->get_vector().push_back(obj);
+    packet text("/nsp", array, 7);
+    std::string payload;
+    std::vector<std::shared_ptr<const std::string> > buffers;
+    text.accept(payload, buffers);
+    size_t text_size = text.get_estimated_size();
+    CHECK(text_size >= payload.size());
+
+    array->get_vector().push_back(binary_message::create(std::make_shared<const std::string>(1000, 'x')));
+    packet binary("/nsp", array, 8);
+    CHECK(binary.get_estimated_size() >= text_size + 1000);
+}
+
+TEST_CASE( "test_timer_wheel_expiry_and_cancel" )
+{
+    using std::chrono::milliseconds;
+    timer_wheel wheel(milliseconds(10), 8);
+    timer_wheel::clock::time_point t0 = timer_wheel::clock::now();
+    std::vector<unsigned> expired;
+    auto collect = [&](unsigned id) { expired.push_back(id); };
+
+    wheel.schedule(1, milliseconds(25), t0);
+    timer_wheel::handle cancelled = wheel.schedule(2, milliseconds(25), t0);
+    // Several revolutions out: shares a slot with earlier deadlines.
+    wheel.schedule(3, milliseconds(500), t0);
+    CHECK(wheel.size() == 3);
+    wheel.cancel(cancelled);
+
+    wheel.advance(t0 + milliseconds(20), collect);
+    CHECK(expired.empty());
+    wheel.advance(t0 + milliseconds(40), collect);
+    REQUIRE(expired.size() == 1);
+    CHECK(expired[0] == 1);
+    wheel.advance(t0 + milliseconds(490), collect);
+    CHECK(expired.size() == 1);
+    wheel.advance(t0 + milliseconds(520), collect);
+    REQUIRE(expired.size() == 2);
+    CHECK(expired[1] == 3);
+    CHECK(wheel.empty());
+}
+
+// Ports on 127.0.0.1 nothing listens on: connecting to them is refused.
+static asio::ip::tcp::endpoint closed_port(asio::io_context &io)
+{
+    asio::ip::tcp::acceptor acceptor(io, asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+    return acceptor.local_endpoint();
+}
+
+TEST_CASE( "test_host_resolver_failure_and_timer_in_one_turn" )
+{
+    asio::io_context io;
+    std::vector<host_resolver::endpoint> candidates;
+    candidates.push_back(closed_port(io));
+    candidates.push_back(closed_port(io));
+    // No delay between attempts: the timer expires at once.
+    host_resolver resolver(io, std::chrono::milliseconds(60000), std::chrono::milliseconds(0));
+    int calls = 0;
+    asio::error_code result;
+    resolver.resolve_to("localhost", "80", std::move(candidates), [&](asio::error_code const &ec, host_resolver::endpoint const &) {
+        ++calls;
+        result = ec;
+    });
+    // By the time the io_context runs, the refusal of the first attempt and
+    // the timer are both ready: the failure starts the last attempt, and the
+    // timer handler, already queued, finds no candidate left.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    io.run();
+    CHECK(calls == 1);
+    CHECK(result);
+}
+
+TEST_CASE( "test_host_resolver_cancel_calls_waiters" )
+{
+    asio::io_context io;
+    std::vector<host_resolver::endpoint> candidates;
+    candidates.push_back(closed_port(io));
+    candidates.push_back(closed_port(io));
+    host_resolver resolver(io, std::chrono::milliseconds(60000), std::chrono::milliseconds(0));
+    int calls = 0;
+    asio::error_code result;
+    resolver.resolve_to("localhost", "80", std::move(candidates), [&](asio::error_code const &ec, host_resolver::endpoint const &) {
+        ++calls;
+        result = ec;
+    });
+    resolver.cancel();
+    CHECK(calls == 1);
+    CHECK(result == asio::error::operation_aborted);
+    // The attempts still queued find the race over.
+    io.run();
+    CHECK(calls == 1);
+}
+
+TEST_CASE( "test_ack_slab_generations" )
+{
+    ack_slab<std::string> slab;
+    int first = slab.insert("a");
+    int second = slab.insert("b");
+    CHECK(first >= 0);
+    CHECK(second >= 0);
+    CHECK(first != second);
+    REQUIRE(slab.find(second));
+    CHECK(*slab.find(second) == "b");
+    CHECK(!slab.find(-1));
+    CHECK(!slab.find(12345));
+
+    // The freed slot is reused under a new id; the old one no longer matches.
+    CHECK(slab.erase(first));
+    CHECK(!slab.erase(first));
+    int reused = slab.insert("c");
+    CHECK(reused != first);
+    CHECK((reused & (ack_slab<std::string>::max_slots - 1)) == (first & (ack_slab<std::string>::max_slots - 1)));
+    CHECK(!slab.find(first));
+    REQUIRE(slab.find(reused));
+    CHECK(*slab.find(reused) == "c");
+    CHECK(slab.size() == 2);
+
+    // Ids stay non-negative through generation wrap-around.
+    bool ok = true;
+    for (int i = 0; i < 70000; ++i)
+    {
+        int id = slab.insert("x");
+        ok = ok && id >= 0 && slab.erase(id);
+    }
+    CHECK(ok);
+    CHECK(slab.size() == 2);
+    CHECK(*slab.find(second) == "b");
+}
+
+TEST_CASE( "test_histogram_buckets_and_percentiles" )
+{
+    using std::chrono::nanoseconds;
+    // Buckets are contiguous and each holds the values mapping to it.
+    for (std::uint64_t v : {0ull, 15ull, 16ull, 31ull, 32ull, 33ull, 1000ull, 123456789ull, ~0ull})
+    {
+        size_t index = histogram_recorder::index_of(v);
+        CHECK(index < histogram_recorder::bucket_count);
+        CHECK(histogram_recorder::upper_bound(index) >= v);
+        if (index > 0)
+        {
+            CHECK(histogram_recorder::upper_bound(index - 1) < v);
+        }
+    }
+
+    histogram_recorder recorder;
+    CHECK(recorder.snapshot().count == 0);
+    CHECK(recorder.snapshot().percentile(0.5).count() == 0);
+    for (int i = 1; i <= 1000; ++i)
+    {
+        recorder.record(std::chrono::microseconds(i));
+    }
+    latency_histogram h = recorder.snapshot();
+    CHECK(h.count == 1000);
+    CHECK(h.min == std::chrono::microseconds(1));
+    CHECK(h.max == std::chrono::microseconds(1000));
+    CHECK(h.mean() == nanoseconds(500500));
+    // Within the 1/16 bucket resolution of the exact value.
+    CHECK(h.percentile(0.5) >= std::chrono::microseconds(500));
+    CHECK(h.percentile(0.5) <= std::chrono::microseconds(532));
+    CHECK(h.percentile(0.99) >= std::chrono::microseconds(990));
+    CHECK(h.percentile(1.0) == h.max);
+    CHECK(h.count_at_most(std::chrono::microseconds(2000)) == 1000);
+    CHECK(h.count_at_most(nanoseconds(0)) == 0);
+    std::uint64_t below = h.count_at_most(std::chrono::microseconds(100));
+    CHECK(below >= 94);
+    CHECK(below <= 100);
+}
+
+#ifndef SIO_DISABLE_TRACING
+TEST_CASE( "test_packet_manager_trace_spans" )
+{
+    std::vector<std::pair<trace_point, bool> > spans;
+    std::vector<int> pack_ids;
+    packet_manager manager;
+    manager.set_tracer([&](trace_record const &r) {
+        spans.push_back(std::make_pair(r.point, r.begin));
+        pack_ids.push_back(r.pack_id);
+    });
+    std::shared_ptr<const std::string> frame;
+    manager.set_encode_callback([&](bool, std::shared_ptr<const std::string> const &payload) { frame = payload; });
+    size_t spans_at_callback = 0;
+    manager.set_decode_callback([&](packet const &) { spans_at_callback = spans.size(); });
+
+    packet p("/", string_message::create("hi"), 5);
+    manager.encode(p);
+    REQUIRE(frame);
+    REQUIRE(spans.size() == 2);
+    CHECK(spans[0] == std::make_pair(trace_point::encode, true));
+    CHECK(spans[1] == std::make_pair(trace_point::encode, false));
+    CHECK(pack_ids[0] == 5);
+
+    manager.put_payload(frame);
+    REQUIRE(spans.size() == 4);
+    CHECK(spans[2] == std::make_pair(trace_point::decode, true));
+    CHECK(spans[3] == std::make_pair(trace_point::decode, false));
+    // The decode span closes before handlers run.
+    CHECK(spans_at_callback == 4);
+}
+#endif
+
+TEST_CASE( "test_list_to_array_message_moves" )
+{
+    message::ptr arg = string_message::create("payload");
+    message::list args(arg);
+    args.push(int_message::create(1));
+    message::ptr copied = args.to_array_message("evt");
+    CHECK(args.size() == 2);
+    CHECK(arg.use_count() == 3);
+    message::ptr moved = std::move(args).to_array_message("evt");
+    CHECK(args.size() == 0);
+    CHECK(arg.use_count() == 3);
+    REQUIRE(moved->get_vector().size() == 3);
+    CHECK(moved->get_vector()[0]->get_string() == "evt");
+    CHECK(moved->get_vector()[1] == arg);
+
+    message::list reply(int_message::create(7));
+    message::ptr ack = std::move(reply).to_array_message();
+    CHECK(ack->get_vector().size() == 1);
+    CHECK(reply.size() == 0);
+}
+
+namespace codec_test
+{
+    struct position
+    {
+        double x = 0;
+        double y = 0;
+    };
+    SIO_DEFINE_FIELDS(position, x, y)
+
+    struct telemetry
+    {
+        std::string id;
+        int seq = 0;
+        std::optional<position> pos;
+        std::vector<unsigned> samples;
+        bool ok = false;
+    };
+    SIO_DEFINE_FIELDS(telemetry, id, seq, pos, samples, ok)
+
+    bool read_telemetry(json_value &in, void *ctx)
+    {
+        return codec<telemetry>::read(in, *static_cast<telemetry *>(ctx));
+    }
+}
+
+TEST_CASE( "test_codec_typed_round_trip" )
+{
+    using codec_test::telemetry;
+    telemetry sent;
+    sent.id = "dev \"7\"";
+    sent.seq = -3;
+    sent.pos = codec_test::position{1.5, -2};
+    sent.samples = {1, 2, 3};
+    sent.ok = true;
+
+    std::string json;
+    json_writer writer(json);
+    writer.begin_array();
+    writer.value(std::string_view("telemetry"));
+    codec<telemetry>::write(writer, sent);
+    writer.end_array();
+    CHECK(json == "[\"telemetry\",{\"id\":\"dev \\\"7\\\"\",\"seq\":-3,\"pos\":{\"x\":1.5,\"y\":-2},\"samples\":[1,2,3],\"ok\":true}]");
+
+    packet out("/nsp", encoded_packet::from_json("telemetry", std::string(json)));
+    std::string payload;
+    std::vector<std::shared_ptr<const std::string> > buffers;
+    CHECK(!out.accept(payload, buffers));
+    CHECK(payload == "42/nsp," + json);
+
+    // Read straight from the raw JSON, then from a decoded message tree.
+    for (bool lazy : {true, false})
+    {
+        decode_options options;
+        options.lazy = lazy;
+        packet in;
+        in.parse(payload, options);
+        telemetry got;
+        REQUIRE(in.read_element(1, codec_test::read_telemetry, &got));
+        CHECK(got.id == sent.id);
+        CHECK(got.seq == -3);
+        REQUIRE(got.pos);
+        CHECK(got.pos->x == 1.5);
+        CHECK(got.pos->y == -2);
+        CHECK(got.samples == sent.samples);
+        CHECK(got.ok);
+        CHECK(!in.read_element(2, codec_test::read_telemetry, &got));
+    }
+
+    // Unknown keys are skipped, missing ones keep their value, mismatches fail.
+    packet partial;
+    partial.parse("42[\"t\",{\"extra\":{\"a\":[1]},\"seq\":9,\"pos\":null}]", decode_options{false, true});
+    telemetry got;
+    got.id = "kept";
+    got.pos = codec_test::position{};
+    REQUIRE(partial.read_element(1, codec_test::read_telemetry, &got));
+    CHECK(got.id == "kept");
+    CHECK(got.seq == 9);
+    CHECK(!got.pos);
+    packet wrong;
+    wrong.parse("42[\"t\",{\"samples\":[-1]}]");
+    CHECK(!wrong.read_element(1, codec_test::read_telemetry, &got));
+}
+
+TEST_CASE( "test_packet_trailing_string_offset" )
+{
+    for (bool lazy : {true, false})
+    {
+        decode_options options;
+        options.lazy = lazy;
+        std::string offset;
+        packet tagged;
+        tagged.parse("42/nsp,[\"tick\",{\"v\":[1,\"x\"]},\"1700000000000-3\"]", options);
+        CHECK(tagged.get_trailing_string(offset));
+        CHECK(offset == "1700000000000-3");
+        // The event name alone is not an offset, nor is a non-string last argument.
+        packet bare;
+        bare.parse("42[\"tick\"]", options);
+        CHECK(!bare.get_trailing_string(offset));
+        packet untagged;
+        untagged.parse("42[\"tick\",\"a\",7]", options);
+        CHECK(!untagged.get_trailing_string(offset));
+        CHECK(offset == "1700000000000-3");
+    }
+
+    // The connect reply of a recovery-enabled server carries the session id.
+    packet reply;
+    reply.parse("40/nsp,{\"sid\":\"s1\",\"pid\":\"p1\"}");
+    CHECK(reply.get_type() == packet::type_connect);
+    REQUIRE(reply.get_message()->get_flag() == message::flag_object);
+    CHECK(static_cast<object_message const &>(*reply.get_message()).at("pid")->get_string() == "p1");
+}
+
+TEST_CASE( "test_msgpack_packet_round_trip" )
+{
+    message::list args(string_message::create("text"));
+    args.push(int_message::create(-70000));
+    args.push(double_message::create(0.25));
+    args.push(std::make_shared<const std::string>("\x00\x01\x02", 3));
+    message::ptr obj = object_message::create();
+    static_cast<object_message *>(obj.get())->insert("ok", bool_message::create(true));
+    static_cast<object_message *>(obj.get())->insert("none", null_message::create());
+    args.push(obj);
+
+    packet_manager manager;
+    manager.set_parser(std::unique_ptr<packet_parser>(new msgpack_packet_parser()));
+    std::vector<std::pair<bool, std::shared_ptr<const std::string> > > frames;
+    manager.set_encode_callback([&](bool binary, std::shared_ptr<const std::string> const &payload) {
+        frames.push_back(std::make_pair(binary, payload));
+    });
+    packet out("/chat", args.to_array_message("evt"), 12);
+    manager.encode(out);
+    // One binary frame, attachment inline.
+    REQUIRE(frames.size() == 1);
+    CHECK(frames[0].first);
+    CHECK(packet::is_msgpack_message(*frames[0].second));
+
+    message::ptr received;
+    int pack_id = 0;
+    std::string nsp;
+    manager.set_decode_callback([&](packet const &p) {
+        CHECK(p.get_type() == packet::type_event);
+        received = p.get_message();
+        pack_id = p.get_pack_id();
+        nsp = p.get_nsp();
+    });
+    manager.put_payload(frames[0].second);
+    REQUIRE(received);
+    CHECK(nsp == "/chat");
+    CHECK(pack_id == 12);
+    std::vector<message::ptr> const &v = received->get_vector();
+    REQUIRE(v.size() == 6);
+    CHECK(v[0]->get_string() == "evt");
+    CHECK(v[1]->get_string() == "text");
+    CHECK(v[2]->get_int() == -70000);
+    CHECK(v[3]->get_double() == 0.25);
+    REQUIRE(v[4]->get_flag() == message::flag_binary);
+    CHECK(*v[4]->get_binary() == std::string("\x00\x01\x02", 3));
+    CHECK(v[5]->get_map().at("ok")->get_bool());
+    CHECK(v[5]->get_map().at("none")->get_flag() == message::flag_null);
+
+    // As the server's msgpack parser would write a connect reply: {type:0,nsp:"/",data:{sid:"x"}}.
+    std::string connect("\x83\xa4type\x00\xa3nsp\xa1/\xa4" "data\x81\xa3sid\xa1x", 25);
+    received.reset();
+    manager.set_decode_callback([&](packet const &p) {
+        CHECK(p.get_type() == packet::type_connect);
+        received = p.get_message();
+    });
+    manager.put_payload(connect);
+    REQUIRE(received);
+    CHECK(received->get_map().at("sid")->get_string() == "x");
+
+    // Truncated and malformed packets are dropped; engine.io frames still parse as text.
+    bool decoded = false;
+    manager.set_decode_callback([&](packet const &p) { decoded = p.get_frame() == packet::frame_ping; });
+    manager.put_payload(connect.substr(0, 20));
+    CHECK(!decoded);
+    manager.put_payload(std::string("\x82\xa4type\x02\xa3nsp\xa1/", 13));
+    CHECK(!decoded);
+    manager.put_payload(std::string("2"));
+    CHECK(decoded);
+}
+
+TEST_CASE( "test_packet_parse_buffer_adopts_frame" )
+{
+    packet_manager manager;
+    message::ptr received;
+    manager.set_decode_callback([&](packet const& p) { received = p.get_message(); });
+    manager.put_payload(std::make_shared<const std::string>("451-[\"image\",{\"_placeholder\":true,\"num\":0}]"));
+    CHECK(!received);
+    std::shared_ptr<std::string> frame = std::make_shared<std::string>(1, static_cast<char>(packet::frame_message));
+    frame->append(64, 'x');
+    manager.put_payload(std::shared_ptr<const std::string>(frame));
+    REQUIRE(received);
+    REQUIRE(received->get_vector()[1]->get_flag() == message::flag_binary);
+    // The attachment is the frame itself, not a copy of it.
+    CHECK(received->get_vector()[1]->get_binary()->data() == frame->data());
+}
+
+TEST_CASE( "test_encoded_packet_reused" )
+{
+    message::list args(string_message::create("snapshot"));
+    args.push(std::make_shared<const std::string>("\x01\x02\x03", 3));
+    encoded_packet::ptr encoded = encoded_packet::create("state", args);
+    CHECK(encoded->get_json() == "[\"state\",\"snapshot\",{\"_placeholder\":true,\"num\":0}]");
+    REQUIRE(encoded->get_buffers().size() == 1);
+
+    // Only the header differs between sends; the attachment is shared, not copied.
+    packet first("/a", encoded);
+    std::string payload;
+    std::vector<std::shared_ptr<const std::string> > buffers;
+    CHECK(first.accept(payload, buffers));
+    CHECK(payload == "451-/a," + encoded->get_json());
+    REQUIRE(buffers.size() == 1);
+    CHECK(buffers[0] == encoded->get_buffers()[0]);
+
+    packet second("/b", encoded, 7);
+    payload.clear();
+    buffers.clear();
+    CHECK(second.accept(payload, buffers));
+    CHECK(payload == "451-/b,7" + encoded->get_json());
+    CHECK(buffers.size() == 1);
+
+    packet plain("/", encoded_packet::create("ping"));
+    payload.clear();
+    buffers.clear();
+    CHECK(!plain.accept(payload, buffers));
+    CHECK(payload == "42[\"ping\"]");
+}
+
+namespace
+{
+    emit_task await_reply(emit_awaiter &awaiter)
+    {
+        co_return co_await awaiter;
+    }
+
+    emit_task await_both(emit_awaiter &first, emit_awaiter &second)
+    {
+        message::list a = co_await await_reply(first);
+        message::list b = co_await await_reply(second);
+        a.push(b[0]);
+        co_return a;
+    }
+}
+
+TEST_CASE( "test_emit_task_resumes_awaiter" )
+{
+    // Result in before the coroutine gets to suspend.
+    emit_awaiter early;
+    early.set_result(message::list(string_message::create("early")));
+    CHECK(await_reply(early).get_result()[0]->get_string() == "early");
+
+    // Both set on another thread while the outer task blocks in get_result.
+    emit_awaiter first, second;
+    emit_task chained = await_both(first, second);
+    std::thread acker([&] {
+        first.set_result(message::list(string_message::create("a")));
+        second.set_result(message::list(string_message::create("b")));
+    });
+    message::list result = chained.get_result();
+    acker.join();
+    REQUIRE(result.size() == 2);
+    CHECK(result[0]->get_string() == "a");
+    CHECK(result[1]->get_string() == "b");
+
+    // Dropped before its ack: the task finishes on its own and frees its frame.
+    emit_awaiter late;
+    {
+        emit_task dropped = await_reply(late);
+    }
+    late.set_result(message::list());
+
+    emit_awaiter failing;
+    emit_task timed_out = await_reply(failing);
+    failing.set_exception(std::make_exception_ptr(timeout_exception()));
+    CHECK_THROWS_AS(timed_out.get_result(), timeout_exception);
+}
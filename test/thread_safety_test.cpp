@@ -241,6 +241,10 @@ TEST_CASE("Connection Metrics - Basic functionality", "[metrics]") {
         REQUIRE(metrics.packets_received == 0);
         REQUIRE(metrics.reconnection_count == 0);
         REQUIRE(metrics.last_ping_latency.count() == 0);
+        REQUIRE(metrics.ack_rtt.count == 0);
+        REQUIRE(metrics.transport.frames_sent == 0);
+        REQUIRE(metrics.transport.bytes_received == 0);
+        REQUIRE(metrics.transport.send_queue_frames == 0);
     }
 
     SECTION("Connected_at timestamp is valid after connection") {